@@ -0,0 +1,74 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "DigitizerService.h"
+
+/**
+ * Logical collection describing one contact: tip switch and in range bits, contact identifier,
+ * and absolute X/Y.
+ */
+#define DIGITIZER_FINGER_COLLECTION                                         \
+    USAGE_PAGE(1),      0x0d,         /*  Digitizers */                     \
+    USAGE(1),           0x22,         /*  Finger */                         \
+    COLLECTION(1),      0x02,         /*  Logical */                        \
+    USAGE(1),           0x42,         /*   Tip Switch */                    \
+    USAGE(1),           0x32,         /*   In Range */                      \
+    LOGICAL_MINIMUM(1), 0x00,                                               \
+    LOGICAL_MAXIMUM(1), 0x01,                                               \
+    REPORT_SIZE(1),     0x01,                                               \
+    REPORT_COUNT(1),    0x02,                                               \
+    INPUT(1),           0x02,         /*   Data, Variable, Absolute */      \
+    REPORT_COUNT(1),    0x06,         /*   6 bits (Padding) */              \
+    INPUT(1),           0x03,         /*   Constant */                      \
+    USAGE(1),           0x51,         /*   Contact Identifier */            \
+    LOGICAL_MAXIMUM(1), 0x7f,                                               \
+    REPORT_SIZE(1),     0x08,                                               \
+    REPORT_COUNT(1),    0x01,                                               \
+    INPUT(1),           0x02,                                               \
+    USAGE_PAGE(1),      0x01,         /*   Generic Desktop */               \
+    USAGE(1),           0x30,         /*   X */                             \
+    USAGE(1),           0x31,         /*   Y */                             \
+    LOGICAL_MAXIMUM(2), 0xff, 0x7f,   /*   DIGITIZER_LOGICAL_MAX */         \
+    REPORT_SIZE(1),     0x10,                                               \
+    REPORT_COUNT(1),    0x02,                                               \
+    INPUT(1),           0x02,                                               \
+    END_COLLECTION(0)
+
+report_map_t DIGITIZER_REPORT_MAP = {
+    USAGE_PAGE(1),      0x0d,         // Digitizers
+    USAGE(1),           0x04,         // Touch Screen
+    COLLECTION(1),      0x01,         // Application
+    DIGITIZER_FINGER_COLLECTION,
+    DIGITIZER_FINGER_COLLECTION,
+    DIGITIZER_FINGER_COLLECTION,
+    USAGE_PAGE(1),      0x0d,         //  Digitizers
+    USAGE(1),           0x54,         //  Contact Count
+    LOGICAL_MAXIMUM(1), 0x7f,
+    REPORT_SIZE(1),     0x08,
+    REPORT_COUNT(1),    0x01,
+    INPUT(1),           0x02,
+    USAGE(1),           0x55,         //  Contact Count Maximum
+    LOGICAL_MAXIMUM(1), DIGITIZER_MAX_CONTACTS,
+    FEATURE(1),         0x02,
+    END_COLLECTION(0),
+};
+
+const uint16_t DIGITIZER_REPORT_MAP_LENGTH = sizeof(DIGITIZER_REPORT_MAP);
+
+const uint8_t digitizerFeatureReportData[DIGITIZER_FEATURE_REPORT_SIZE] = {
+    DIGITIZER_MAX_CONTACTS
+};
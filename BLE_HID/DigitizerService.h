@@ -0,0 +1,344 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HID_DIGITIZER_SERVICE_H_
+#define HID_DIGITIZER_SERVICE_H_
+
+#include <errno.h>
+
+#include "mbed.h"
+
+#include "HIDService.h"
+
+/// Number of simultaneous contacts tracked by the service
+#define DIGITIZER_MAX_CONTACTS      5
+
+/**
+ * Number of contacts in each input report. Frames with more changed contacts are split over
+ * several reports ("hybrid mode"). With 6 bytes per contact and a contact count, three contacts
+ * fit in a single notification with the default ATT MTU.
+ */
+#define DIGITIZER_CONTACTS_PER_REPORT   3
+#define DIGITIZER_CONTACT_SIZE          6
+
+/// Coordinates are in [0, DIGITIZER_LOGICAL_MAX]
+#define DIGITIZER_LOGICAL_MAX       0x7fff
+
+/// Contact flags, in the first byte of each contact
+#define DIGITIZER_TIP_SWITCH        0x01
+#define DIGITIZER_IN_RANGE          0x02
+
+/**
+ * Report descriptor for a touch screen with DIGITIZER_CONTACTS_PER_REPORT contacts per report,
+ * followed by the number of contacts in the frame. The maximum number of contacts is given by a
+ * feature report.
+ */
+extern report_map_t DIGITIZER_REPORT_MAP;
+extern const uint16_t DIGITIZER_REPORT_MAP_LENGTH;
+
+/// Contact count maximum
+#define DIGITIZER_FEATURE_REPORT_SIZE   1
+extern const uint8_t digitizerFeatureReportData[DIGITIZER_FEATURE_REPORT_SIZE];
+
+/**
+ * State of a contact slot
+ */
+typedef struct {
+    /// The slot holds a contact, which may have been lifted but not reported yet
+    bool used;
+    /// The contact is touching the surface
+    bool touching;
+    /// The contact changed since it was last reported
+    bool dirty;
+    /// Incremented on each change, to detect the ones made while a report was being sent
+    uint8_t generation;
+    uint8_t id;
+    uint16_t x;
+    uint16_t y;
+} digitizer_contact_t;
+
+/**
+ * @class DigitizerService
+ * @brief HID-over-Gatt multi-touch digitizer service
+ *
+ * Send absolute positions of up to DIGITIZER_MAX_CONTACTS contacts, for touch screens and panels.
+ *
+ * The application tracks contacts with setContact() and releaseContact(), identifying each one with
+ * an ID of its choice. The service only reports contacts that changed: each frame starts with a
+ * report whose contact count is the number of changed contacts, and continues with reports whose
+ * contact count is 0 until all of them have been sent. When nothing changes, the report ticker is
+ * stopped.
+ *
+ * @code
+ * BLE ble;
+ * DigitizerService touch(ble);
+ *
+ * void on_panel_event(uint8_t finger, bool down, uint16_t x, uint16_t y)
+ * {
+ *     if (down)
+ *         touch.setContact(finger, x, y);
+ *     else
+ *         touch.releaseContact(finger);
+ * }
+ * @endcode
+ */
+class DigitizerService: public HIDService<DigitizerService, HID_WITH_FEATURE_REPORT>
+{
+public:
+    DigitizerService(BLE &_ble) :
+        HIDService<DigitizerService, HID_WITH_FEATURE_REPORT>(_ble,
+                DIGITIZER_REPORT_MAP, DIGITIZER_REPORT_MAP_LENGTH,
+                inputReport          = emptyReport,
+                outputReport         = NULL,
+                featureReport        = digitizerFeatureReportData,
+                inputReportLength    = sizeof(digitizerInputReportData),
+                outputReportLength   = 0,
+                featureReportLength  = sizeof(digitizerFeatureReportData),
+                reportTickerDelay    = 12),
+        frame(0),
+        failedReports(0)
+    {
+        memset(contacts, 0, sizeof(contacts));
+    }
+
+    virtual void onConnection(const Gap::ConnectionCallbackParams_t *params)
+    {
+        HIDServiceBase::onConnection(params);
+
+        /* The host forgot about all contacts: report the current ones again */
+        frame = 0;
+        for (unsigned i = 0; i < DIGITIZER_MAX_CONTACTS; i++)
+            contacts[i].dirty = contacts[i].used;
+
+        startReportTicker();
+    }
+
+    /**
+     * Put a contact down, or move it
+     *
+     * @param id    Identifier of the contact, in [0, 127]. It must stay the same until the
+     *              contact is released.
+     * @param x     Horizontal position, in [0, DIGITIZER_LOGICAL_MAX]
+     * @param y     Vertical position, in [0, DIGITIZER_LOGICAL_MAX]
+     *
+     * @return 0 on success, EINVAL if the id is out of range, or ENOMEM if DIGITIZER_MAX_CONTACTS
+     * are already tracked.
+     */
+    int setContact(uint8_t id, uint16_t x, uint16_t y)
+    {
+        if (id > 0x7f)
+            return EINVAL;
+
+        if (x > DIGITIZER_LOGICAL_MAX)
+            x = DIGITIZER_LOGICAL_MAX;
+        if (y > DIGITIZER_LOGICAL_MAX)
+            y = DIGITIZER_LOGICAL_MAX;
+
+        __disable_irq();
+
+        int slot = findContact(id);
+        if (slot < 0)
+            slot = findContact(id, false);
+
+        if (slot < 0) {
+            __enable_irq();
+            return ENOMEM;
+        }
+
+        digitizer_contact_t &contact = contacts[slot];
+
+        if (!contact.used || !contact.touching || contact.x != x || contact.y != y) {
+            contact.used = true;
+            contact.touching = true;
+            contact.dirty = true;
+            contact.generation++;
+            contact.id = id;
+            contact.x = x;
+            contact.y = y;
+        }
+
+        __enable_irq();
+
+        wakeReportTicker();
+
+        return 0;
+    }
+
+    /**
+     * Lift a contact. It is reported one last time, and its slot is then freed.
+     *
+     * @return 0 on success, or EINVAL if the contact isn't known
+     */
+    int releaseContact(uint8_t id)
+    {
+        __disable_irq();
+
+        int slot = findContact(id);
+
+        if (slot < 0 || !contacts[slot].touching) {
+            __enable_irq();
+            return EINVAL;
+        }
+
+        contacts[slot].touching = false;
+        contacts[slot].dirty = true;
+        contacts[slot].generation++;
+
+        __enable_irq();
+
+        wakeReportTicker();
+
+        return 0;
+    }
+
+    /**
+     * Lift all contacts
+     */
+    void releaseAllContacts(void)
+    {
+        for (unsigned i = 0; i < DIGITIZER_MAX_CONTACTS; i++) {
+            if (contacts[i].used && contacts[i].touching)
+                releaseContact(contacts[i].id);
+        }
+    }
+
+    /**
+     * Called by the report ticker
+     */
+    virtual void sendCallback(void) {
+        if (!connected)
+            return;
+
+        if (sendReleaseAll())
+            return;
+
+        bool first = false;
+
+        if (!frame) {
+            /* Start a new frame with all contacts that changed */
+            for (unsigned i = 0; i < DIGITIZER_MAX_CONTACTS; i++) {
+                if (contacts[i].dirty)
+                    frame |= 1 << i;
+            }
+
+            if (!frame) {
+                stopReportTicker();
+                return;
+            }
+
+            first = true;
+        }
+
+        uint8_t sent = 0;
+        uint8_t generations[DIGITIZER_MAX_CONTACTS];
+        unsigned count = 0;
+        unsigned frameSize = 0;
+
+        memset(digitizerInputReportData, 0, sizeof(digitizerInputReportData));
+
+        for (unsigned i = 0; i < DIGITIZER_MAX_CONTACTS; i++) {
+            if (!(frame & (1 << i)))
+                continue;
+
+            frameSize++;
+
+            if (count == DIGITIZER_CONTACTS_PER_REPORT)
+                continue;
+
+            uint8_t *p = &digitizerInputReportData[count * DIGITIZER_CONTACT_SIZE];
+
+            /* setContact() and releaseContact() may be called from interrupts */
+            __disable_irq();
+            digitizer_contact_t contact = contacts[i];
+            __enable_irq();
+
+            generations[i] = contact.generation;
+
+            p[0] = contact.touching ? DIGITIZER_TIP_SWITCH | DIGITIZER_IN_RANGE : 0;
+            p[1] = contact.id;
+            p[2] = contact.x & 0xff;
+            p[3] = contact.x >> 8;
+            p[4] = contact.y & 0xff;
+            p[5] = contact.y >> 8;
+
+            sent |= 1 << i;
+            count++;
+        }
+
+        /* Only the first report of a frame carries the number of contacts */
+        digitizerInputReportData[sizeof(digitizerInputReportData) - 1] = first ? frameSize : 0;
+
+        if (sendReport(digitizerInputReportData)) {
+            failedReports++;
+            /* Retry the whole frame, the host didn't see its first report */
+            if (first)
+                frame = 0;
+            return;
+        }
+
+        frame &= ~sent;
+
+        /*
+         * Contacts that changed since the report was built stay dirty, and are sent again in the
+         * next frame. The others are up to date, and lifted ones free their slot.
+         */
+        __disable_irq();
+
+        for (unsigned i = 0; i < DIGITIZER_MAX_CONTACTS; i++) {
+            if (!(sent & (1 << i)) || contacts[i].generation != generations[i])
+                continue;
+
+            contacts[i].dirty = false;
+            if (!contacts[i].touching)
+                contacts[i].used = false;
+        }
+
+        __enable_irq();
+    }
+
+protected:
+    /**
+     * @param id    Contact to look for
+     * @param used  Look for a used slot with this id, or for any free slot
+     *
+     * @return index of the slot, or -1
+     */
+    int findContact(uint8_t id, bool used = true) const
+    {
+        for (unsigned i = 0; i < DIGITIZER_MAX_CONTACTS; i++) {
+            if (used && contacts[i].used && contacts[i].id == id)
+                return i;
+            if (!used && !contacts[i].used)
+                return i;
+        }
+
+        return -1;
+    }
+
+protected:
+    digitizer_contact_t contacts[DIGITIZER_MAX_CONTACTS];
+
+    /// Contacts of the current frame that haven't been sent yet, one bit per slot
+    uint8_t frame;
+
+    /// Contacts, then contact count
+    uint8_t digitizerInputReportData[DIGITIZER_CONTACTS_PER_REPORT * DIGITIZER_CONTACT_SIZE + 1];
+
+public:
+    uint32_t failedReports;
+};
+
+#endif /* !HID_DIGITIZER_SERVICE_H_ */
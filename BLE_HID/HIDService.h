@@ -0,0 +1,193 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HID_SERVICE_H_
+#define HID_SERVICE_H_
+
+#include "HIDServiceBase.h"
+
+/**
+ * @class HIDReportCharacteristic
+ *
+ * A report characteristic, with its Report Reference descriptor.
+ *
+ * The specialization for absent reports is empty. HIDService inherits from both, so a service
+ * only pays for the reports it declares.
+ */
+template <ReportType type, bool present = true>
+class HIDReportCharacteristic
+{
+public:
+    HIDReportCharacteristic(report_t report, uint16_t length) :
+        referenceDescriptor(BLE_UUID_DESCRIPTOR_REPORT_REFERENCE,
+                (uint8_t *)&referenceData, 2, 2),
+        characteristic(GattCharacteristic::UUID_REPORT_CHAR,
+                (uint8_t *)report, length, length, properties(),
+                descriptors, 1)
+    {
+        referenceData.ID = 0;
+        referenceData.type = type;
+        descriptors[0] = &referenceDescriptor;
+
+        characteristic.requireSecurity(SecurityManager::SECURITY_MODE_ENCRYPTION_NO_MITM);
+    }
+
+    GattCharacteristic *getCharacteristic(void)
+    {
+        return &characteristic;
+    }
+
+protected:
+    static uint8_t properties(void)
+    {
+        switch (type) {
+            case INPUT_REPORT:
+                return GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ
+                     | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY
+                     | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE;
+            case OUTPUT_REPORT:
+                return GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ
+                     | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE_WITHOUT_RESPONSE
+                     | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE;
+            default:
+                return GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ
+                     | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE;
+        }
+    }
+
+protected:
+    report_reference_t referenceData;
+    GattAttribute referenceDescriptor;
+    GattAttribute *descriptors[1];
+    GattCharacteristic characteristic;
+};
+
+template <ReportType type>
+class HIDReportCharacteristic<type, false>
+{
+public:
+    HIDReportCharacteristic(report_t report, uint16_t length)
+    {
+        /* The report is declared in the length arguments but not in the template parameters */
+        MBED_ASSERT(length == 0);
+    }
+
+    GattCharacteristic *getCharacteristic(void)
+    {
+        return NULL;
+    }
+};
+
+/**
+ * @class HIDService
+ *
+ * Base of the concrete HID services, bound to them at compile time.
+ *
+ * HIDServiceBase calls sendCallback() through the vtable on every tick. HIDService<Derived>
+ * instead registers a non-virtual trampoline with the scheduler, which calls
+ * Derived::sendCallback() directly: the compiler sees the whole tick path, from the task to
+ * sendReport(), and can inline it. The virtual interface of HIDServiceBase stays available, so a
+ * service can still be used through a HIDServiceBase pointer.
+ *
+ * The optional report characteristics are also chosen at compile time, with the reports parameter
+ * (a combination of HIDOptionalReports). The service only contains the GattCharacteristic and
+ * GattAttribute objects of the reports it has, and its characteristic table is sized exactly.
+ *
+ * @code
+ * class MyService: public HIDService<MyService, HID_WITH_OUTPUT_REPORT>
+ * {
+ * public:
+ *     MyService(BLE &_ble) :
+ *         HIDService<MyService, HID_WITH_OUTPUT_REPORT>(_ble, MY_REPORT_MAP,
+ *                                                       sizeof(MY_REPORT_MAP), ...)
+ *     {
+ *     }
+ *
+ *     virtual void sendCallback(void)
+ *     {
+ *         ...
+ *         sendReport(report);
+ *     }
+ * };
+ * @endcode
+ */
+template <class Derived, unsigned reports = HID_INPUT_REPORT_ONLY>
+class HIDService: public HIDServiceBase,
+                  private HIDReportCharacteristic<INPUT_REPORT>,
+                  private HIDReportCharacteristic<OUTPUT_REPORT,
+                                                  (reports & HID_WITH_OUTPUT_REPORT) != 0>,
+                  private HIDReportCharacteristic<FEATURE_REPORT,
+                                                  (reports & HID_WITH_FEATURE_REPORT) != 0>
+{
+    typedef HIDReportCharacteristic<INPUT_REPORT> InputReport;
+    typedef HIDReportCharacteristic<OUTPUT_REPORT,
+                                    (reports & HID_WITH_OUTPUT_REPORT) != 0> OutputReport;
+    typedef HIDReportCharacteristic<FEATURE_REPORT,
+                                    (reports & HID_WITH_FEATURE_REPORT) != 0> FeatureReport;
+
+    enum {
+        CHARACTERISTIC_COUNT = HID_REQUIRED_CHARACTERISTICS + 1
+                             + ((reports & HID_WITH_OUTPUT_REPORT) != 0)
+                             + ((reports & HID_WITH_FEATURE_REPORT) != 0),
+    };
+
+protected:
+    /**
+     * See HIDServiceBase::HIDServiceBase
+     */
+    HIDService(BLE &_ble,
+               report_map_t reportMap,
+               uint16_t reportMapLength,
+               report_t inputReport,
+               report_t outputReport,
+               report_t featureReport,
+               uint16_t inputReportLength = 0,
+               uint16_t outputReportLength = 0,
+               uint16_t featureReportLength = 0,
+               uint8_t inputReportTickerDelay = 50) :
+        HIDServiceBase(_ble, reportMap, reportMapLength, inputReport, outputReport, featureReport,
+                       inputReportLength, outputReportLength, featureReportLength,
+                       inputReportTickerDelay),
+        InputReport(inputReport, inputReportLength),
+        OutputReport(outputReport, outputReportLength),
+        FeatureReport(featureReport, featureReportLength)
+    {
+        GattCharacteristic *characteristics[CHARACTERISTIC_COUNT];
+        unsigned count = HID_REQUIRED_CHARACTERISTICS;
+
+        characteristics[count++] = InputReport::getCharacteristic();
+        if (OutputReport::getCharacteristic())
+            characteristics[count++] = OutputReport::getCharacteristic();
+        if (FeatureReport::getCharacteristic())
+            characteristics[count++] = FeatureReport::getCharacteristic();
+
+        addService(characteristics, count, InputReport::getCharacteristic(),
+                   OutputReport::getCharacteristic());
+
+        reportTask.attach(this, &HIDService::tick);
+    }
+
+    /**
+     * Called by reportTask
+     */
+    void tick(void)
+    {
+        /* The qualified call bypasses the vtable */
+        static_cast<Derived *>(this)->Derived::sendCallback();
+    }
+};
+
+#endif /* !HID_SERVICE_H_ */
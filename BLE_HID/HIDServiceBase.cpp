@@ -17,18 +17,23 @@
 #include "mbed.h"
 #include "HIDServiceBase.h"
 
+const HID_information_t HIDServiceBase::HIDInformation = {HID_VERSION_1_11, 0x00, 0x03};
+
+const uint8_t HIDServiceBase::emptyReport[MAX_HID_REPORT_SIZE] = { 0 };
+
 HIDServiceBase::HIDServiceBase(BLE          &_ble,
                                report_map_t reportMap,
-                               uint8_t      reportMapSize,
+                               uint16_t     reportMapSize,
                                report_t     inputReport,
                                report_t     outputReport,
                                report_t     featureReport,
-                               uint8_t      inputReportLength,
-                               uint8_t      outputReportLength,
-                               uint8_t      featureReportLength,
+                               uint16_t     inputReportLength,
+                               uint16_t     outputReportLength,
+                               uint16_t     featureReportLength,
                                uint8_t      inputReportTickerDelay) :
     ble(_ble),
     connected (false),
+    connectionHandle(0),
     reportMapLength(reportMapSize),
 
     inputReport(inputReport),
@@ -39,38 +44,16 @@ HIDServiceBase::HIDServiceBase(BLE          &_ble,
     outputReportLength(outputReportLength),
     featureReportLength(featureReportLength),
 
-    protocolMode(REPORT_PROTOCOL),
+    attMtu(HID_ATT_MTU_DEFAULT),
 
-    inputReportReferenceDescriptor(BLE_UUID_DESCRIPTOR_REPORT_REFERENCE,
-            (uint8_t *)&inputReportReferenceData, 2, 2),
-    outputReportReferenceDescriptor(BLE_UUID_DESCRIPTOR_REPORT_REFERENCE,
-            (uint8_t *)&outputReportReferenceData, 2, 2),
-    featureReportReferenceDescriptor(BLE_UUID_DESCRIPTOR_REPORT_REFERENCE,
-            (uint8_t *)&featureReportReferenceData, 2, 2),
+    protocolMode(REPORT_PROTOCOL),
 
     protocolModeCharacteristic(GattCharacteristic::UUID_PROTOCOL_MODE_CHAR, &protocolMode, 1, 1,
               GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ
             | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE_WITHOUT_RESPONSE),
 
-    inputReportCharacteristic(GattCharacteristic::UUID_REPORT_CHAR,
-            (uint8_t *)inputReport, inputReportLength, inputReportLength,
-              GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ
-            | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY
-            | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE,
-            inputReportDescriptors(), 1),
-
-    outputReportCharacteristic(GattCharacteristic::UUID_REPORT_CHAR,
-            (uint8_t *)outputReport, outputReportLength, outputReportLength,
-              GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ
-            | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE_WITHOUT_RESPONSE
-            | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE,
-            outputReportDescriptors(), 1),
-
-    featureReportCharacteristic(GattCharacteristic::UUID_REPORT_CHAR,
-            (uint8_t *)featureReport, featureReportLength, featureReportLength,
-              GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ
-            | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE,
-            featureReportDescriptors(), 1),
+    inputReportCharacteristic(NULL),
+    outputReportCharacteristic(NULL),
 
     /*
      * We need to set reportMap content as const, in order to let the compiler put it into flash
@@ -81,53 +64,51 @@ HIDServiceBase::HIDServiceBase(BLE          &_ble,
             const_cast<uint8_t*>(reportMap), reportMapLength, reportMapLength,
             GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ),
 
-    HIDInformationCharacteristic(GattCharacteristic::UUID_HID_INFORMATION_CHAR, HIDInformation()),
+    /* Read-only as well, see above */
+    HIDInformationCharacteristic(GattCharacteristic::UUID_HID_INFORMATION_CHAR,
+            const_cast<HID_information_t *>(&HIDInformation)),
     HIDControlPointCharacteristic(GattCharacteristic::UUID_HID_CONTROL_POINT_CHAR,
             &controlPointCommand, 1, 1,
             GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE_WITHOUT_RESPONSE),
 
     reportTickerDelay(inputReportTickerDelay),
-    reportTickerIsActive(false)
+    linkEvents(0),
+    linkEventsHandled(0),
+    controlPointEvent(-1),
+    subscriptionEvent(-1),
+    reportTickerIsActive(false),
+    reportRate(0),
+    maxReportRate(1000 / inputReportTickerDelay),
+    reportTickerInterval(0),
+    radioAligned(false),
+    lastRadioReport(0),
+    reportsQueued(0),
+    reportsDelivered(0),
+    congested(false),
+    releaseAllPending(false),
+    suspended(false),
+    reportsBlocked(false),
+    bondStore(NULL),
+    bondSlot(-1),
+    subscribed(false),
+    subscriptionRestorePending(false)
 {
-    static GattCharacteristic *characteristics[] = {
-        &HIDInformationCharacteristic,
-        &reportMapCharacteristic,
-        &protocolModeCharacteristic,
-        &HIDControlPointCharacteristic,
-        NULL,
-        NULL,
-        NULL,
-        NULL,
-        NULL
-    };
+    /* Longer reports don't fit in our buffers (see sendReleaseAll) */
+    MBED_ASSERT(inputReportLength <= MAX_HID_REPORT_SIZE);
+    MBED_ASSERT(outputReportLength <= MAX_HID_REPORT_SIZE);
+    MBED_ASSERT(featureReportLength <= MAX_HID_REPORT_SIZE);
 
-    unsigned int charIndex = 4;
-    /*
-     * Report characteristics are optional, and depend on the reportMap descriptor
-     * Note: at least one should be present, but we don't check that at the moment.
-     */
-    if (inputReportLength)
-        characteristics[charIndex++] = &inputReportCharacteristic;
-    if (outputReportLength)
-        characteristics[charIndex++] = &outputReportCharacteristic;
-    if (featureReportLength)
-        characteristics[charIndex++] = &featureReportCharacteristic;
-
-    /* TODO: let children add some more characteristics, namely boot keyboard and mouse (They are
-     * mandatory as per HIDS spec.) Ex:
-     *
-     * addExtraCharacteristics(characteristics, int& charIndex);
-     */
-
-    GattService service(GattService::UUID_HUMAN_INTERFACE_DEVICE_SERVICE,
-                        characteristics, charIndex);
+    ble.gap().onConnection(this, &HIDServiceBase::onConnectionEvent);
+    ble.gap().onDisconnection(this, &HIDServiceBase::onDisconnectionEvent);
 
-    ble.gattServer().addService(service);
+    ble.gattServer().onDataSent(this, &HIDServiceBase::onDataSent);
+    ble.gattServer().onDataWritten(this, &HIDServiceBase::onDataWritten);
 
-    ble.gap().onConnection(this, &HIDServiceBase::onConnection);
-    ble.gap().onDisconnection(this, &HIDServiceBase::onDisconnection);
+    reportTask.attach(this, &HIDServiceBase::sendCallback);
+    eventTask.attach(this, &HIDServiceBase::handleEvents);
+    wakeTask.attach(this, &HIDServiceBase::startReportTicker);
 
-    ble.gattServer().onDataSent(this, &HIDServiceBase::onDataSent);
+    setReportRate(maxReportRate);
 
     /*
      * Change preferred connection params, in order to optimize the notification frequency. Most
@@ -147,81 +128,439 @@ HIDServiceBase::HIDServiceBase(BLE          &_ble,
     SecurityManager::SecurityMode_t securityMode = SecurityManager::SECURITY_MODE_ENCRYPTION_NO_MITM;
     protocolModeCharacteristic.requireSecurity(securityMode);
     reportMapCharacteristic.requireSecurity(securityMode);
-    inputReportCharacteristic.requireSecurity(securityMode);
-    outputReportCharacteristic.requireSecurity(securityMode);
-    featureReportCharacteristic.requireSecurity(securityMode);
+}
+
+void HIDServiceBase::addService(GattCharacteristic *characteristics[], unsigned count,
+                                GattCharacteristic *input, GattCharacteristic *output)
+{
+    characteristics[0] = &HIDInformationCharacteristic;
+    characteristics[1] = &reportMapCharacteristic;
+    characteristics[2] = &protocolModeCharacteristic;
+    characteristics[3] = &HIDControlPointCharacteristic;
+
+    inputReportCharacteristic = input;
+    outputReportCharacteristic = output;
+
+    /* TODO: let children add some more characteristics, namely boot keyboard and mouse (They are
+     * mandatory as per HIDS spec.) They would be appended to the table by HIDService.
+     */
+
+    /* The stack keeps pointers to the characteristics, not to the table */
+    GattService service(GattService::UUID_HUMAN_INTERFACE_DEVICE_SERVICE,
+                        characteristics, count);
+
+    ble.gattServer().addService(service);
 }
 
 void HIDServiceBase::startReportTicker(void) {
-    if (reportTickerIsActive)
+    /* Nothing can be sent until onConnection, which starts the ticker */
+    if (reportTickerIsActive || suspended || reportsBlocked || !connected)
+        return;
+
+    /* Reports will be sent on the next radio notification */
+    if (radioAligned) {
+        reportTickerIsActive = true;
         return;
-    reportTicker.attach_us(this, &HIDServiceBase::sendCallback, reportTickerDelay * 1000);
+    }
+
+    scheduleReportTask();
     reportTickerIsActive = true;
 }
 
 void HIDServiceBase::stopReportTicker(void) {
-    reportTicker.detach();
+    TaskScheduler::instance().cancel(reportTask);
     reportTickerIsActive = false;
 }
 
+void HIDServiceBase::setReportRate(uint32_t rate) {
+    if (rate > maxReportRate)
+        rate = maxReportRate;
+    if (rate < HID_REPORT_RATE_MIN)
+        rate = HID_REPORT_RATE_MIN;
+
+    if (rate == reportRate)
+        return;
+
+    reportRate = rate;
+    reportTickerInterval = 1000000 / rate;
+
+    if (reportTickerIsActive && !radioAligned)
+        scheduleReportTask();
+}
+
+void HIDServiceBase::scheduleReportTask(void) {
+    TaskScheduler::instance().schedule(reportTask, reportTickerInterval, reportTickerInterval,
+                                       reportTickerInterval / HID_REPORT_TOLERANCE_DIVIDER);
+}
+
+void HIDServiceBase::setRadioAlignment(bool enable) {
+    bool active = reportTickerIsActive;
+
+    if (enable == radioAligned)
+        return;
+
+    stopReportTicker();
+    radioAligned = enable;
+
+    if (enable) {
+        ble.gap().onRadioNotification(this, &HIDServiceBase::onRadioNotification);
+        ble.gap().initRadioNotification();
+    }
+
+    if (active)
+        startReportTicker();
+}
+
+void HIDServiceBase::onRadioNotification(bool active) {
+    uint32_t now = us_ticker_read();
+
+    if (!active || !radioAligned || !reportTickerIsActive || !connected)
+        return;
+
+    if (now - lastRadioReport < reportTickerInterval - reportTickerInterval / 4)
+        return;
+
+    /* Build the report in the main loop, which this interrupt wakes up */
+    lastRadioReport = now;
+    TaskScheduler::instance().post(reportTask);
+}
+
 void HIDServiceBase::onDataSent(unsigned count) {
-    startReportTicker();
+    reportsDelivered += count;
+    if ((int32_t)(reportsDelivered - reportsQueued) > 0)
+        reportsDelivered = reportsQueued;
+
+    if (!congested)
+        return;
+
+    congested = false;
+    wakeReportTicker();
 }
 
-GattAttribute** HIDServiceBase::inputReportDescriptors() {
-    inputReportReferenceData.ID = 0;
-    inputReportReferenceData.type = INPUT_REPORT;
+void HIDServiceBase::setAttMtu(uint16_t mtu) {
+    if (mtu < HID_ATT_MTU_DEFAULT)
+        mtu = HID_ATT_MTU_DEFAULT;
 
-    static GattAttribute * descs[] = {
-        &inputReportReferenceDescriptor,
-    };
-    return descs;
+    if (mtu == attMtu)
+        return;
+
+    attMtu = mtu;
+
+    if (reportsBlocked) {
+        reportsBlocked = false;
+        startReportTicker();
+    }
+
+    onAttMtuChanged(mtu);
 }
 
-GattAttribute** HIDServiceBase::outputReportDescriptors() {
-    outputReportReferenceData.ID = 0;
-    outputReportReferenceData.type = OUTPUT_REPORT;
+void HIDServiceBase::setSubscribed(bool enabled) {
+    subscribed = enabled;
 
-    static GattAttribute * descs[] = {
-        &outputReportReferenceDescriptor,
-    };
-    return descs;
+    if (enabled && reportsBlocked) {
+        reportsBlocked = false;
+        startReportTicker();
+    }
 }
 
-GattAttribute** HIDServiceBase::featureReportDescriptors() {
-    featureReportReferenceData.ID = 0;
-    featureReportReferenceData.type = FEATURE_REPORT;
+void HIDServiceBase::onDataWritten(const GattWriteCallbackParams *params) {
+    if (outputReportCharacteristic
+            && params->handle == outputReportCharacteristic->getValueHandle()) {
+        onOutputReport(params->data, params->len);
+        return;
+    }
+
+    if (inputReportCharacteristic && params->len >= 1 && params->handle
+            == inputReportCharacteristic->getValueHandle() + HID_CCCD_HANDLE_OFFSET) {
+        /* Bit 0 of the CCCD enables notifications */
+        subscriptionEvent = params->data[0] & 0x01;
+        eventTask.post();
+        return;
+    }
 
-    static GattAttribute * descs[] = {
-        &featureReportReferenceDescriptor,
+    if (params->handle != HIDControlPointCharacteristic.getValueHandle() || params->len < 1)
+        return;
+
+    controlPointEvent = params->data[0];
+    eventTask.post();
+}
+
+void HIDServiceBase::onConnectionEvent(const Gap::ConnectionCallbackParams_t *params) {
+    connectionParams = *params;
+    if (params->connectionParams) {
+        connectionIntervals = *params->connectionParams;
+        connectionParams.connectionParams = &connectionIntervals;
+    }
+
+    linkEvents++;
+    eventTask.post();
+}
+
+void HIDServiceBase::onDisconnectionEvent(const Gap::DisconnectionCallbackParams_t *params) {
+    disconnectionParams = *params;
+
+    linkEvents++;
+    eventTask.post();
+}
+
+void HIDServiceBase::handleEvents(void) {
+    Gap::ConnectionCallbackParams_t connection;
+    Gap::DisconnectionCallbackParams_t disconnection;
+    int16_t command;
+    int8_t subscription;
+
+    /* Take a consistent copy, in case another event arrives meanwhile */
+    __disable_irq();
+    connection = connectionParams;
+    disconnection = disconnectionParams;
+    command = controlPointEvent;
+    controlPointEvent = -1;
+    subscription = subscriptionEvent;
+    subscriptionEvent = -1;
+    __enable_irq();
+
+    /* Replay missed events in order. Parameters of intermediate connections are lost. */
+    while (linkEventsHandled != linkEvents) {
+        linkEventsHandled++;
+
+        if (connected)
+            onDisconnection(&disconnection);
+        else
+            onConnection(&connection);
+    }
+
+    if (!connected)
+        return;
+
+    if (subscription >= 0)
+        setSubscribed(subscription);
+
+    if (command == CONTROL_POINT_SUSPEND)
+        suspend();
+    else if (command == CONTROL_POINT_EXIT_SUSPEND)
+        exitSuspend();
+}
+
+void HIDServiceBase::suspend(void) {
+    if (suspended || !connected)
+        return;
+
+    stopReportTicker();
+    suspended = true;
+
+    Gap::ConnectionParams_t params = {
+        Gap::MSEC_TO_GAP_DURATION_UNITS(HID_SUSPEND_MIN_INTERVAL_MS),
+        Gap::MSEC_TO_GAP_DURATION_UNITS(HID_SUSPEND_MAX_INTERVAL_MS),
+        HID_SUSPEND_SLAVE_LATENCY,
+        3200
     };
-    return descs;
+    ble.gap().updateConnectionParams(connectionHandle, &params);
+
+    onSuspend();
 }
 
+void HIDServiceBase::exitSuspend(void) {
+    Gap::ConnectionParams_t params;
+
+    if (!suspended)
+        return;
+
+    suspended = false;
+
+    if (connected && ble.gap().getPreferredConnectionParams(&params) == BLE_ERROR_NONE)
+        ble.gap().updateConnectionParams(connectionHandle, &params);
 
-HID_information_t* HIDServiceBase::HIDInformation() {
-    static HID_information_t info = {HID_VERSION_1_11, 0x00, 0x03};
+    onExitSuspend();
 
-    return &info;
+    /* Send whatever was held while suspended. Idle services stop the ticker on the first call. */
+    if (connected)
+        startReportTicker();
 }
 
-ble_error_t HIDServiceBase::send(const report_t report) {
-    return ble.gattServer().write(inputReportCharacteristic.getValueHandle(),
-                                  report,
-                                  inputReportLength);
+ble_error_t HIDServiceBase::sendReport(const report_t report) {
+    bool enabled = false;
+    ble_error_t ret;
+
+    if (!connected)
+        return BLE_ERROR_INVALID_STATE;
+
+    /* The stack would reject or truncate it. Don't retry on every tick. */
+    if (inputReportLength > getMaxReportLength()) {
+        reportsBlocked = true;
+        stopReportTicker();
+        return BLE_ERROR_PARAM_OUT_OF_RANGE;
+    }
+
+    if (subscriptionRestorePending)
+        restoreSubscription();
+
+    ret = ble.gattServer().write(inputReportCharacteristic->getValueHandle(),
+                                 report,
+                                 inputReportLength);
+
+    if (ret == BLE_ERROR_NONE) {
+        subscribed = true;
+        reportsQueued++;
+
+        /* Additive increase */
+        setReportRate(reportRate + HID_REPORT_RATE_INCREASE);
+        return ret;
+    }
+
+    /*
+     * BUSY is not only returned when we're short of notification buffers. Find out if the host
+     * actually listens to our reports, before assuming that the link is congested.
+     */
+    if (ret == BLE_STACK_BUSY
+            && ble.gattServer().areUpdatesEnabled(*inputReportCharacteristic, &enabled)
+               == BLE_ERROR_NONE
+            && enabled) {
+        /*
+         * Multiplicative decrease, and wait until a buffer is available. The ticker will be
+         * restarted by onDataSent.
+         */
+        setReportRate(reportRate / 2);
+        congested = true;
+        stopReportTicker();
+
+        return ret;
+    }
+
+    /*
+     * The host doesn't listen (Nordic's stack returns INVALID_STATE until it subscribes), or the
+     * stack rejects the report. Wait for a subscription, rather than failing on every tick. A
+     * subscription restored from the bond store only needs the link to be encrypted: keep polling.
+     */
+    subscribed = false;
+
+    if (!subscriptionRestorePending) {
+        reportsBlocked = true;
+        stopReportTicker();
+    }
+
+    return ret == BLE_STACK_BUSY ? BLE_ERROR_INVALID_STATE : ret;
+}
+
+bool HIDServiceBase::sendReleaseAll(void) {
+    if (!releaseAllPending)
+        return false;
+
+    if (sendReport(emptyReport) == BLE_ERROR_NONE)
+        releaseAllPending = false;
+
+    return true;
 }
 
 ble_error_t HIDServiceBase::read(report_t report) {
-    // TODO. For the time being, we'll just have HID input reports...
-    return BLE_ERROR_NOT_IMPLEMENTED;
+    uint16_t length = outputReportLength;
+
+    if (!outputReportCharacteristic)
+        return BLE_ERROR_INVALID_STATE;
+
+    return ble.gattServer().read(outputReportCharacteristic->getValueHandle(),
+                                 const_cast<uint8_t *>(report), &length);
+}
+
+void HIDServiceBase::loadBondRecord(const Gap::ConnectionCallbackParams_t *params)
+{
+    uint16_t keyBase = inputReportCharacteristic->getValueHandle() << 3;
+    int freeSlot = -1;
+
+    bondSlot = -1;
+    subscribed = false;
+    subscriptionRestorePending = false;
+
+    if (!bondStore)
+        return;
+
+    for (int slot = 0; slot < HID_MAX_BONDS; slot++) {
+        hid_bond_record_t record;
+
+        if (!bondStore->load(keyBase | slot, &record, sizeof(record))) {
+            if (freeSlot < 0)
+                freeSlot = slot;
+            continue;
+        }
+
+        if (record.peerAddrType == params->peerAddrType
+                && !memcmp(record.peerAddr, params->peerAddr, sizeof(record.peerAddr))) {
+            bondSlot = slot;
+            bondRecord = record;
+            subscribed = record.subscribed;
+            subscriptionRestorePending = record.subscribed;
+            return;
+        }
+    }
+
+    /* New host. When the store is full, evict an arbitrary one. */
+    bondSlot = freeSlot >= 0 ? freeSlot : params->peerAddr[0] % HID_MAX_BONDS;
+    bondRecord.peerAddrType = params->peerAddrType;
+    memcpy(bondRecord.peerAddr, params->peerAddr, sizeof(bondRecord.peerAddr));
+    bondRecord.subscribed = false;
+}
+
+void HIDServiceBase::saveBondRecord(void)
+{
+    uint16_t keyBase = inputReportCharacteristic->getValueHandle() << 3;
+
+    if (!bondStore || bondSlot < 0 || bondRecord.subscribed == subscribed)
+        return;
+
+    bondRecord.subscribed = subscribed;
+    bondStore->store(keyBase | bondSlot, &bondRecord, sizeof(bondRecord));
+}
+
+void HIDServiceBase::restoreSubscription(void)
+{
+    static const uint8_t notificationsEnabled[] = { 0x01, 0x00 };
+    SecurityManager::LinkSecurityStatus_t security;
+
+    /* Input reports must not leave the device before the link is encrypted */
+    if (ble.securityManager().getLinkSecurity(connectionHandle, &security) != BLE_ERROR_NONE
+            || security != SecurityManager::ENCRYPTED)
+        return;
+
+    ble.gattServer().write(connectionHandle,
+                           inputReportCharacteristic->getValueHandle() + HID_CCCD_HANDLE_OFFSET,
+                           notificationsEnabled, sizeof(notificationsEnabled), true);
+
+    subscriptionRestorePending = false;
 }
 
 void HIDServiceBase::onConnection(const Gap::ConnectionCallbackParams_t *params)
 {
     this->connected = true;
+    this->connectionHandle = params->handle;
+    this->attMtu = HID_ATT_MTU_DEFAULT;
+    loadBondRecord(params);
+    this->congested = false;
+    this->reportsQueued = 0;
+    this->reportsDelivered = 0;
+    this->releaseAllPending = true;
+    this->suspended = false;
+    this->reportsBlocked = false;
+    setReportRate(maxReportRate);
+
+    /*
+     * The ticker may have been stopped on the previous connection (congestion, suspend), and
+     * onDataSent or exitSuspend won't come to restart it. The release-all report needs it anyway;
+     * idle services stop it again once it is sent.
+     */
+    startReportTicker();
 }
 
 void HIDServiceBase::onDisconnection(const Gap::DisconnectionCallbackParams_t *params)
 {
+    /* Don't wake the CPU up for reports that can't be sent */
+    stopReportTicker();
+
+    saveBondRecord();
     this->connected = false;
+    this->congested = false;
+
+    /* The ticker stopped by suspend() is restarted by the next onConnection */
+    if (suspended) {
+        suspended = false;
+        onExitSuspend();
+    }
 }
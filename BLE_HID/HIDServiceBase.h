@@ -21,9 +21,76 @@
 
 #include "ble/BLE.h"
 #include "USBHID_Types.h"
+#include "KeyValueStore.h"
+#include "TaskScheduler.h"
 
 #define BLE_UUID_DESCRIPTOR_REPORT_REFERENCE 0x2908
 
+/**
+ * Congestion control of input reports: when the stack runs out of notification buffers, the report
+ * rate is halved and the ticker waits for onDataSent. Each successful report then increases the
+ * rate by HID_REPORT_RATE_INCREASE reports per second, up to the rate given by
+ * inputReportTickerDelay.
+ */
+#ifndef HID_REPORT_RATE_INCREASE
+#define HID_REPORT_RATE_INCREASE 1
+#endif
+
+/** Lowest report rate reached when backing off, in reports per second */
+#ifndef HID_REPORT_RATE_MIN
+#define HID_REPORT_RATE_MIN 2
+#endif
+
+/**
+ * How late a report may be sent, in 1/HID_REPORT_TOLERANCE_DIVIDER of the report interval, so
+ * that the report tasks of several services can share a wakeup of the TaskScheduler.
+ */
+#ifndef HID_REPORT_TOLERANCE_DIVIDER
+#define HID_REPORT_TOLERANCE_DIVIDER 8
+#endif
+
+/** Number of hosts whose state is kept in the bond store (up to 8) */
+#ifndef HID_MAX_BONDS
+#define HID_MAX_BONDS 4
+#endif
+
+/**
+ * Offset between the value handle of a characteristic and its Client Characteristic Configuration
+ * Descriptor. The CCCD directly follows the value on Nordic stacks.
+ */
+#ifndef HID_CCCD_HANDLE_OFFSET
+#define HID_CCCD_HANDLE_OFFSET 1
+#endif
+
+/**
+ * Connection parameters requested while the host is suspended: long intervals and some slave
+ * latency, so that the link costs almost nothing until the host wakes up.
+ */
+#ifndef HID_SUSPEND_MIN_INTERVAL_MS
+#define HID_SUSPEND_MIN_INTERVAL_MS 400
+#endif
+
+#ifndef HID_SUSPEND_MAX_INTERVAL_MS
+#define HID_SUSPEND_MAX_INTERVAL_MS 500
+#endif
+
+#ifndef HID_SUSPEND_SLAVE_LATENCY
+#define HID_SUSPEND_SLAVE_LATENCY 4
+#endif
+
+/**
+ * ATT MTU of a new connection. A notification carries at most ATT_MTU - HID_ATT_HEADER_SIZE bytes
+ * of report.
+ */
+#define HID_ATT_MTU_DEFAULT 23
+#define HID_ATT_HEADER_SIZE 3
+
+/**
+ * Characteristics of every HID service: HID Information, Report Map, Protocol Mode and HID
+ * Control Point. They come first in the characteristic table, before the report characteristics.
+ */
+#define HID_REQUIRED_CHARACTERISTICS 4
+
 typedef const uint8_t report_map_t[];
 typedef const uint8_t * report_t;
 
@@ -39,6 +106,21 @@ enum ReportType {
     FEATURE_REPORT  = 0x3,
 };
 
+/**
+ * Optional report characteristics of a service, combined in the reports parameter of HIDService.
+ * Every service has an input report.
+ */
+enum HIDOptionalReports {
+    HID_INPUT_REPORT_ONLY       = 0,
+    HID_WITH_OUTPUT_REPORT      = 1 << 0,
+    HID_WITH_FEATURE_REPORT     = 1 << 1,
+};
+
+enum ControlPointCommand {
+    CONTROL_POINT_SUSPEND       = 0x0,
+    CONTROL_POINT_EXIT_SUSPEND  = 0x1,
+};
+
 enum ProtocolMode {
     BOOT_PROTOCOL   = 0x0,
     REPORT_PROTOCOL = 0x1,
@@ -49,12 +131,25 @@ typedef struct {
     uint8_t type;
 } report_reference_t;
 
+/**
+ * State of a host, persisted across connections
+ */
+typedef struct {
+    uint8_t peerAddrType;
+    uint8_t peerAddr[6];
+    /// The host enabled notifications of input reports
+    uint8_t subscribed;
+} hid_bond_record_t;
+
 
 class HIDServiceBase {
 public:
     /**
      *  Constructor
      *
+     *  The service is added to the GATT server by HIDService, once it has constructed the report
+     *  characteristics.
+     *
      *  @param _ble
      *         BLE object to add this service to
      *  @param reportMap
@@ -62,10 +157,13 @@ public:
      *         is called "HID report descriptor".
      *  @param reportMapLength 
      *         Size of the reportMap array
-     *  @param outputReportLength
-     *         Maximum length of a sent report (up to 64 bytes) (default: 64 bytes)
      *  @param inputReportLength
-     *         Maximum length of a received report (up to 64 bytes) (default: 64 bytes)
+     *         Length of a sent report (up to MAX_HID_REPORT_SIZE). It can only be notified if it
+     *         fits in the ATT MTU: reports longer than 20 bytes require an MTU exchange.
+     *  @param outputReportLength
+     *         Length of a received report (up to MAX_HID_REPORT_SIZE)
+     *  @param featureReportLength
+     *         Length of the feature report (up to MAX_HID_REPORT_SIZE)
      *  @param inputReportTickerDelay
      *         Delay between input report notifications, in ms. Acceptable values depend directly on
      *         GAP's connInterval parameter, so it shouldn't be less than 12ms
@@ -75,34 +173,60 @@ public:
      */
     HIDServiceBase(BLE &_ble,
                    report_map_t reportMap,
-                   uint8_t reportMapLength,
+                   uint16_t reportMapLength,
                    report_t inputReport,
                    report_t outputReport,
                    report_t featureReport,
-                   uint8_t inputReportLength = 0,
-                   uint8_t outputReportLength = 0,
-                   uint8_t featureReportLength = 0,
+                   uint16_t inputReportLength = 0,
+                   uint16_t outputReportLength = 0,
+                   uint16_t featureReportLength = 0,
                    uint8_t inputReportTickerDelay = 50);
 
     /**
      *  Send Report
      *
      *  @param report   Report to send. Must be of size @ref inputReportLength
-     *  @return         The write status
+     *  @return         The write status:
+     *                  - BLE_STACK_BUSY when the stack is out of notification buffers. The report
+     *                    ticker is then stopped until the stack calls onDataSent.
+     *                  - BLE_ERROR_INVALID_STATE when we're not connected, or when the host hasn't
+     *                    subscribed to input reports. The ticker is then stopped until the host
+     *                    subscribes (see setSubscribed).
+     *                  - BLE_ERROR_PARAM_OUT_OF_RANGE when the report doesn't fit in a
+     *                    notification with the current ATT MTU. The ticker is then stopped until
+     *                    the MTU changes (see setAttMtu).
+     *                  - Any other error from the stack. The ticker is then stopped until the
+     *                    host subscribes again, as for BLE_ERROR_INVALID_STATE.
      *
      *  @note Don't call send() directly for multiple reports! Use reportTicker for that, in order
      *  to avoid overloading the BLE stack, and let it handle events between each report.
+     *
+     *  @note Services call sendReport(), which isn't virtual. Overriding send() only affects
+     *  external callers.
      */
-    virtual ble_error_t send(const report_t report);
+    virtual ble_error_t send(const report_t report)
+    {
+        return sendReport(report);
+    }
 
     /**
      *  Read Report
      *
+     *  Copy the last output report written by the host.
+     *
      *  @param report   Report to fill. Must be of size @ref outputReportLength
-     *  @return         The read status
+     *  @return         The read status, BLE_ERROR_INVALID_STATE if the service has no output report
      */
     virtual ble_error_t read(report_t report);
 
+    /**
+     * Reset the state of the link, and start the report ticker to send the release-all report.
+     * Services overriding this must call it first.
+     *
+     * @note Connection and disconnection events are recorded by the BLE callbacks, which may run
+     * in interrupt context, and these handlers are called later from the main loop by eventTask.
+     * They can therefore safely modify the state used by sendCallback.
+     */
     virtual void onConnection(const Gap::ConnectionCallbackParams_t *params);
     virtual void onDisconnection(const Gap::DisconnectionCallbackParams_t *params);
 
@@ -111,51 +235,251 @@ public:
         return connected;
     }
 
+    /**
+     * Generate reports right before connection events, instead of from a free-running ticker.
+     *
+     * With a ticker, a report can wait in the stack's buffers for almost a whole connection
+     * interval before going on air. Radio notifications tell us when the radio is about to wake
+     * up; generating the report at that moment means it is built from the freshest state, and sent
+     * right away. Reports are still spaced by at least 3/4 of the report interval, so the report
+     * rate follows the connection interval when it is shorter than inputReportTickerDelay.
+     *
+     * @note BLE_API only holds one radio notification callback: enable this on a single service.
+     * Radio notifications also fire for advertising, which doesn't matter since reports are only
+     * sent while connected.
+     */
+    void setRadioAlignment(bool enable);
+
+    /**
+     * Set the ATT MTU negotiated on the current connection. BLE_API doesn't report MTU exchanges,
+     * so ports whose stack supports them must forward the result here. It is reset to
+     * HID_ATT_MTU_DEFAULT on each connection.
+     */
+    void setAttMtu(uint16_t mtu);
+
+    /**
+     * Tell the service whether the host enabled notifications of input reports. Writes to the CCCD
+     * of the input report are caught by onDataWritten; ports whose stack only reports them
+     * through GattServer::onUpdatesEnabled must forward them here.
+     */
+    void setSubscribed(bool enabled);
+
+    uint16_t getAttMtu(void) const
+    {
+        return attMtu;
+    }
+
+    /**
+     * @return the longest input report that can be notified on the current connection
+     */
+    uint16_t getMaxReportLength(void) const
+    {
+        return attMtu - HID_ATT_HEADER_SIZE;
+    }
+
+    /**
+     * @return true if the host told us it is suspended, through the HID Control Point
+     */
+    bool isSuspended(void)
+    {
+        return suspended;
+    }
+
+    /**
+     * Persist the state of each host in a key-value store. When a known host reconnects,
+     * notifications are re-enabled as soon as the link is encrypted, and reports can be sent
+     * without waiting for the host to write the CCCD again.
+     *
+     * Bonding keys themselves are kept by the stack's SecurityManager.
+     *
+     * @note Hosts are identified by their address. Those using resolvable private addresses will
+     * be seen as new hosts on each connection.
+     */
+    void setBondStore(KeyValueStore *store)
+    {
+        bondStore = store;
+    }
+
 protected:
     /**
-     * Called by BLE API when data has been successfully sent.
+     * Called by BLE API when data has been successfully sent. Restart the report ticker if it was
+     * stopped because the stack was out of buffers.
      *
      * @param count     Number of reports sent
-     *
-     * @note Subclasses can override this to avoid starting the report ticker when there is nothing
-     * to send
      */
     virtual void onDataSent(unsigned count);
 
     /**
-     * Start the ticker that sends input reports at regular interval
+     * Called by BLE API shortly before the radio becomes active, and when it becomes inactive
+     */
+    void onRadioNotification(bool active);
+
+    /**
+     * Called when the ATT MTU of the current connection changes
+     */
+    virtual void onAttMtuChanged(uint16_t mtu)
+    {
+    }
+
+    /**
+     * Called by BLE API when a client wrote one of our characteristics. Dispatch output reports to
+     * onOutputReport, and record writes to the HID Control Point and to the CCCD of the input
+     * report for eventTask.
+     */
+    virtual void onDataWritten(const GattWriteCallbackParams *params);
+
+    /**
+     * Called by BLE API, possibly in interrupt context: record the event for eventTask
+     */
+    void onConnectionEvent(const Gap::ConnectionCallbackParams_t *params);
+    void onDisconnectionEvent(const Gap::DisconnectionCallbackParams_t *params);
+
+    /**
+     * Called by eventTask, from the main loop: handle the events recorded by the BLE callbacks
+     */
+    void handleEvents(void);
+
+    /**
+     * Called when the host writes an output report. Services with output reports can override this
+     * instead of polling read().
+     *
+     * @note This runs in the context of the BLE callback, which may be an interrupt. Copy the
+     * data, and post a task for the rest.
+     */
+    virtual void onOutputReport(const uint8_t *data, uint16_t length)
+    {
+    }
+
+    /**
+     * The host entered suspend: stop sending reports, and switch to power-saving connection
+     * parameters. Reports requested while suspended are held until the host exits suspend, or
+     * until the next connection if the host disconnects while suspended.
+     */
+    void suspend(void);
+
+    /**
+     * The host exited suspend: restore the preferred connection parameters and resume reports.
+     */
+    void exitSuspend(void);
+
+    /**
+     * Called after entering suspend. Services can override this to slow down their sources of
+     * input, for instance.
+     */
+    virtual void onSuspend(void)
+    {
+    }
+
+    /**
+     * Called when exiting suspend, before reports resume
+     */
+    virtual void onExitSuspend(void)
+    {
+    }
+
+    /**
+     * Start the ticker that sends input reports at regular interval. The ticker is a task of the
+     * shared TaskScheduler. It only runs while connected: this does nothing before onConnection,
+     * and onDisconnection stops it.
      *
      * @note reportTickerIsActive describes the state of the ticker and can be used by HIDS
      * implementations.
      */
-    virtual void startReportTicker(void);
+    void startReportTicker(void);
+
+    /**
+     * Start the report ticker from any context, including interrupts. The ticker is started by
+     * wakeTask, from the main loop: started directly, it could find reportTickerIsActive still
+     * set by a sendCallback that is about to stop the ticker, and the new state would never be
+     * reported.
+     */
+    void wakeReportTicker(void)
+    {
+        wakeTask.post();
+    }
 
     /**
      * Stop the input report ticker
      */
-    virtual void stopReportTicker(void);
+    void stopReportTicker(void);
 
     /**
-     * Called by input report ticker at regular interval (reportTickerDelay). This must be
-     * overriden by HIDS implementations to call the @ref send() with a report, if necessary.
+     * Called by input report ticker at regular interval (reportTickerInterval). This must be
+     * overriden by HIDS implementations to call the @ref sendReport() with a report, if necessary.
+     *
+     * Services deriving from HIDService<Derived> are ticked without going through this virtual
+     * call.
      */
     virtual void sendCallback(void) = 0;
 
     /**
-     * Create the Gatt descriptor for a report characteristic
+     * Implementation of send(), for services. See send() for the return values.
+     */
+    ble_error_t sendReport(const report_t report);
+
+    /**
+     * Send an empty report if a release-all is pending. Hosts don't always reset the state of a
+     * device when it disconnects, so we send one after each connection, before any other report.
+     *
+     * @return true if a release-all report was pending. It is cleared once the report has been
+     * sent successfully.
+     */
+    bool sendReleaseAll(void);
+
+    /**
+     * Look the connecting host up in the bond store
+     */
+    void loadBondRecord(const Gap::ConnectionCallbackParams_t *params);
+
+    /**
+     * Update the record of the current host, if its subscription changed
      */
-    GattAttribute** inputReportDescriptors();
-    GattAttribute** outputReportDescriptors();
-    GattAttribute** featureReportDescriptors();
+    void saveBondRecord(void);
 
     /**
-     * Create the HID information structure
+     * Write the CCCD of the input report locally, once the link is encrypted
      */
-    HID_information_t* HIDInformation();
+    void restoreSubscription(void);
+
+    /**
+     * Change the report rate, and update the ticker if it is running.
+     *
+     * @param rate  New rate, in reports per second. Clamped to [HID_REPORT_RATE_MIN, maxReportRate]
+     */
+    void setReportRate(uint32_t rate);
+
+    /**
+     * (Re)schedule reportTask with the current report interval
+     */
+    void scheduleReportTask(void);
+
+    /**
+     * Register the service with the GATT server. The report characteristics are owned by the
+     * derived class, which only instantiates those it needs (see HIDService), and must be
+     * constructed before this is called.
+     *
+     * @param characteristics   Table of all characteristics. The first HID_REQUIRED_CHARACTERISTICS
+     *                          entries are filled here, the report characteristics follow.
+     * @param count             Size of the table
+     * @param input             Input report characteristic
+     * @param output            Output report characteristic, or NULL
+     */
+    void addService(GattCharacteristic *characteristics[], unsigned count,
+                    GattCharacteristic *input, GattCharacteristic *output);
 
 protected:
+    /// Value of the HID Information characteristic, shared by all services
+    static const HID_information_t HIDInformation;
+
+    /**
+     * An all-zero report, longer than any report. It is the initial value of input and output
+     * reports, and the release-all report.
+     */
+    static const uint8_t emptyReport[MAX_HID_REPORT_SIZE];
+
     BLE &ble;
     bool connected;
+    Gap::Handle_t connectionHandle;
 
     int reportMapLength;
 
@@ -163,37 +487,89 @@ protected:
     report_t outputReport;
     report_t featureReport;
 
-    uint8_t inputReportLength;
-    uint8_t outputReportLength;
-    uint8_t featureReportLength;
+    uint16_t inputReportLength;
+    uint16_t outputReportLength;
+    uint16_t featureReportLength;
+
+    uint16_t attMtu;
 
     uint8_t controlPointCommand;
     uint8_t protocolMode;
 
-    report_reference_t inputReportReferenceData;
-    report_reference_t outputReportReferenceData;
-    report_reference_t featureReportReferenceData;
-
-    GattAttribute inputReportReferenceDescriptor;
-    GattAttribute outputReportReferenceDescriptor;
-    GattAttribute featureReportReferenceDescriptor;
-
     // Optional gatt characteristics:
     GattCharacteristic protocolModeCharacteristic;
 
-    // Report characteristics (each sort of optional)
-    GattCharacteristic inputReportCharacteristic;
-    GattCharacteristic outputReportCharacteristic;
-    GattCharacteristic featureReportCharacteristic;
+    // Report characteristics, owned by HIDService. The output report is optional.
+    GattCharacteristic *inputReportCharacteristic;
+    GattCharacteristic *outputReportCharacteristic;
 
     // Required gatt characteristics: Report Map, Information, Control Point
     GattCharacteristic reportMapCharacteristic;
     ReadOnlyGattCharacteristic<HID_information_t> HIDInformationCharacteristic;
     GattCharacteristic HIDControlPointCharacteristic;
 
-    Ticker reportTicker;
+    ScheduledTask reportTask;
     uint32_t reportTickerDelay;
+
+    /// Runs handleEvents() from the main loop
+    ScheduledTask eventTask;
+    /// Runs startReportTicker() from the main loop, see wakeReportTicker()
+    ScheduledTask wakeTask;
+    /**
+     * Connections and disconnections recorded by the BLE callbacks, and handled by eventTask.
+     * They alternate, so counting them is enough to replay them in order.
+     */
+    volatile uint8_t linkEvents;
+    uint8_t linkEventsHandled;
+    /// Parameters of the latest connection and disconnection
+    Gap::ConnectionCallbackParams_t connectionParams;
+    Gap::ConnectionParams_t connectionIntervals;
+    Gap::DisconnectionCallbackParams_t disconnectionParams;
+    /// Last command written to the HID Control Point, or -1
+    volatile int16_t controlPointEvent;
+    /// Last subscription state written to the CCCD of the input report, or -1
+    volatile int8_t subscriptionEvent;
     bool reportTickerIsActive;
+
+    /// Current report rate and interval (in us), adjusted by congestion control
+    uint32_t reportRate;
+    uint32_t maxReportRate;
+    uint32_t reportTickerInterval;
+
+    /// Reports are generated by radio notifications rather than by reportTask
+    bool radioAligned;
+    uint32_t lastRadioReport;
+
+    /**
+     * Reports accepted by the stack, and reports it then reported as sent, since the connection
+     * started. onDataSent counts the notifications of all services, so reportsDelivered is only
+     * an upper bound when other services notify as well.
+     */
+    uint32_t reportsQueued;
+    uint32_t reportsDelivered;
+
+    /// The stack ran out of buffers, and the ticker is waiting for onDataSent
+    bool congested;
+
+    /// An empty report must be sent before anything else
+    bool releaseAllPending;
+
+    /// The host is suspended: the report ticker must stay stopped
+    bool suspended;
+
+    /**
+     * The host can't receive our reports (not subscribed, or MTU too small): the ticker stays
+     * stopped until the host writes the CCCD or the MTU changes
+     */
+    bool reportsBlocked;
+
+    KeyValueStore *bondStore;
+    hid_bond_record_t bondRecord;
+    /// Slot of the current host in the bond store, or -1
+    int bondSlot;
+    /// Last known subscription state of the current host
+    bool subscribed;
+    bool subscriptionRestorePending;
 };
 
 #endif /* !HID_SERVICE_BASE_H_ */
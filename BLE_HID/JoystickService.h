@@ -14,15 +14,14 @@
  * limitations under the License.
  */
 
-#include "mbed.h"
+#ifndef HID_JOYSTICK_SERVICE_H_
+#define HID_JOYSTICK_SERVICE_H_
 
-#include "HIDServiceBase.h"
+#include "mbed.h"
 
-enum ButtonState
-{
-    BUTTON_UP,
-    BUTTON_DOWN
-};
+#include "HIDService.h"
+#include "MotionResampler.h"
+#include "PointerState.h"
 
 enum JoystickButton
 {
@@ -30,77 +29,67 @@ enum JoystickButton
     JOYSTICK_BUTTON_2       = 0x2,
 };
 
-report_map_t JOYSTICK_REPORT_MAP = {
-    USAGE_PAGE(1),      0x01,         // Generic Desktop
-    USAGE(1),           0x04,         // Joystick
-    COLLECTION(1),      0x01,         // Application
-    COLLECTION(1),      0x00,         //  Physical
-    USAGE_PAGE(1),      0x09,         //   Buttons
-    USAGE_MINIMUM(1),   0x01,
-    USAGE_MAXIMUM(1),   0x03,
-    LOGICAL_MINIMUM(1), 0x00,
-    LOGICAL_MAXIMUM(1), 0x01,
-    REPORT_COUNT(1),    0x03,         //   2 bits (Buttons)
-    REPORT_SIZE(1),     0x01,
-    INPUT(1),           0x02,         //   Data, Variable, Absolute
-    REPORT_COUNT(1),    0x01,         //   6 bits (Padding)
-    REPORT_SIZE(1),     0x05,
-    INPUT(1),           0x01,         //   Constant
-    USAGE_PAGE(1),      0x01,         //   Generic Desktop
-    USAGE(1),           0x30,         //   X
-    USAGE(1),           0x31,         //   Y
-    USAGE(1),           0x32,         //   Z
-    USAGE(1),           0x33,         //   Rx
-    LOGICAL_MINIMUM(1), 0x81,         //   -127
-    LOGICAL_MAXIMUM(1), 0x7f,         //   127
-    REPORT_SIZE(1),     0x08,         //   Three bytes
-    REPORT_COUNT(1),    0x04,
-    INPUT(1),           0x02,         //   Data, Variable, Absolute (unlike mouse)
-    END_COLLECTION(0),
-    END_COLLECTION(0),
-};
-
-uint8_t report[] = { 0, 0, 0, 0, 0 };
+extern report_map_t JOYSTICK_REPORT_MAP;
+extern const uint16_t JOYSTICK_REPORT_MAP_LENGTH;
 
-class JoystickService: public HIDServiceBase
+class JoystickService: public HIDService<JoystickService>
 {
 public:
     JoystickService(BLE &_ble) :
-        HIDServiceBase(_ble,
-                       JOYSTICK_REPORT_MAP, sizeof(JOYSTICK_REPORT_MAP),
-                       inputReport          = report,
-                       outputReport         = NULL,
-                       featureReport        = NULL,
-                       inputReportLength    = sizeof(inputReport),
-                       outputReportLength   = 0,
-                       featureReportLength  = 0,
-                       reportTickerDelay    = 20),
-        buttonsState (0),
+        HIDService<JoystickService>(_ble,
+                                    JOYSTICK_REPORT_MAP, JOYSTICK_REPORT_MAP_LENGTH,
+                                    inputReport          = emptyReport,
+                                    outputReport         = NULL,
+                                    featureReport        = NULL,
+                                    inputReportLength    = sizeof(report),
+                                    outputReportLength   = 0,
+                                    featureReportLength  = 0,
+                                    reportTickerDelay    = 20),
+        resampler (NULL),
         failedReports (0)
     {
-        speed[0] = 0;
-        speed[1] = 0;
-        speed[2] = 0;
-        speed[3] = 0;
+    }
 
-        startReportTicker();
+    virtual void onConnection(const Gap::ConnectionCallbackParams_t *params)
+    {
+        HIDServiceBase::onConnection(params);
+
+        if (resampler)
+            resampler->reset(us_ticker_read());
+    }
+
+    virtual void onExitSuspend(void)
+    {
+        if (resampler)
+            resampler->reset(us_ticker_read());
+    }
+
+    /**
+     * Resample positions to the actual report times. Without a resampler, each report carries the
+     * latest position, regardless of when it was set.
+     *
+     * @param _resampler A RESAMPLER_ABSOLUTE resampler, or NULL to disable resampling.
+     */
+    void setResampler(MotionResampler *_resampler)
+    {
+        resampler = _resampler;
     }
 
     int setSpeed(int8_t x, int8_t y, int8_t z)
     {
-        speed[0] = x;
-        speed[1] = y;
-        speed[2] = z;
+        const int8_t speed[3] = { x, y, z };
+
+        state.setAxes(speed, 3);
+
+        if (resampler)
+            resampler->push(speed, us_ticker_read());
 
         return 0;
     }
 
-    int setButton(JoystickButton button, ButtonState state)
+    int setButton(JoystickButton button, ButtonState buttonState)
     {
-        if (state == BUTTON_UP)
-            buttonsState &= ~(button);
-        else
-            buttonsState |= button;
+        state.setButtons(button, buttonState == BUTTON_DOWN);
 
         return 0;
     }
@@ -109,20 +98,39 @@ public:
         if (!connected)
             return;
 
-        report[0] = buttonsState & 0x7;
-        report[1] = speed[0];
-        report[2] = speed[1];
-        report[3] = speed[2];
-        report[4] = speed[3];
+        if (sendReleaseAll())
+            return;
+
+        pointer_state_t snapshot;
+        state.read(snapshot);
 
-        if (send(report))
+        report[0] = snapshot.buttons & 0x7;
+
+        if (resampler) {
+            resampler->take((int8_t *)&report[1], us_ticker_read());
+        } else {
+            report[1] = snapshot.axis[0];
+            report[2] = snapshot.axis[1];
+            report[3] = snapshot.axis[2];
+        }
+
+        report[4] = snapshot.axis[3];
+
+        if (sendReport(report))
             failedReports++;
     }
 
 protected:
-    uint8_t buttonsState;
-    uint8_t speed[4];
+    /// Buttons and position (X, Y, Z, Rx)
+    PointerState state;
+
+    MotionResampler *resampler;
+
+    /// Buttons, X, Y, Z, Rx
+    uint8_t report[5];
 
 public:
     uint32_t failedReports;
 };
+
+#endif /* !HID_JOYSTICK_SERVICE_H_ */
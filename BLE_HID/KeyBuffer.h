@@ -0,0 +1,309 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HID_KEY_BUFFER_H_
+#define HID_KEY_BUFFER_H_
+
+#include "mbed.h"
+
+/* TODO: make this easier to configure by application (e.g. as a template parameter for
+ * KeyboardService) */
+#ifndef KEYBUFFER_SIZE
+#define KEYBUFFER_SIZE 256
+#endif
+
+/**
+ * Key events are stored in the buffer as a stream of variable-length records. The first byte of a
+ * record gives its type:
+ * - Below KEY_EVENT_ESCAPE: an ASCII character (or one of FUNCTION_KEY), translated with keymap.
+ *   This is the common case and only takes one byte.
+ * - Otherwise, an escape byte followed by its operands.
+ */
+enum KeyEventType {
+    KEY_EVENT_CHAR      = 0x00,     // 1 byte: the character itself
+    KEY_EVENT_TAP       = 0xf8,     // usage. Press and release a key
+    KEY_EVENT_DOWN      = 0xf9,     // usage. Press a key, until the matching KEY_EVENT_UP
+    KEY_EVENT_UP        = 0xfa,     // usage
+    KEY_EVENT_MODIFIERS = 0xfb,     // modifier bitmap (logical OR of enum MODIFIER_KEY)
+    KEY_EVENT_HOLD      = 0xfc,     // usage, duration. Press a key, release it after duration
+    KEY_EVENT_PAUSE     = 0xfd,     // duration. Don't send anything for a while
+    KEY_EVENT_MARKER    = 0xfe,     // identifier. Sends nothing, tells the consumer that all
+                                    // preceding events have been consumed
+    KEY_EVENT_MACRO     = 0xff,     // unused. Play the macro passed to playMacro
+};
+
+#define KEY_EVENT_ESCAPE    KEY_EVENT_TAP
+
+/** Unit of the duration operand, in ms. A single byte gives us up to 2.55s */
+#define KEY_EVENT_DURATION_UNIT_MS  10
+
+/** Longest record, in bytes */
+#define KEY_EVENT_MAX_LENGTH        3
+
+/**
+ * Macros are const arrays of records, stored in flash and played by KeyboardService::playMacro.
+ * Plain characters are written as such, other records with the following helpers, and the macro
+ * ends with KEY_MACRO_END (a NUL character, which doesn't type anything).
+ *
+ * @code
+ * // Ctrl+L, then type a URL after the browser had time to select the address bar
+ * const uint8_t open_mbed[] = {
+ *     KEY_MACRO_DOWN(0xe0), KEY_MACRO_TAP(0x0f), KEY_MACRO_UP(0xe0),
+ *     KEY_MACRO_PAUSE(200),
+ *     'm', 'b', 'e', 'd', '.', 'o', 'r', 'g', '\n',
+ *     KEY_MACRO_END
+ * };
+ * @endcode
+ *
+ * Since characters take a single byte, a macro that only types text and pauses can also be
+ * written as a string literal, with the escape bytes in hex ("\xfd\x14" pauses for 200ms).
+ * KEY_EVENT_MARKER and KEY_EVENT_MACRO records are ignored in macros.
+ */
+#define KEY_MACRO_DURATION(ms)      (uint8_t)(((ms) + KEY_EVENT_DURATION_UNIT_MS - 1) \
+                                              / KEY_EVENT_DURATION_UNIT_MS)
+
+#define KEY_MACRO_TAP(usage)        KEY_EVENT_TAP, (usage)
+#define KEY_MACRO_DOWN(usage)       KEY_EVENT_DOWN, (usage)
+#define KEY_MACRO_UP(usage)         KEY_EVENT_UP, (usage)
+#define KEY_MACRO_MODIFIERS(mods)   KEY_EVENT_MODIFIERS, (mods)
+/** Up to 2550ms */
+#define KEY_MACRO_HOLD(usage, ms)   KEY_EVENT_HOLD, (usage), KEY_MACRO_DURATION(ms)
+/** Up to 2550ms. Chain them for longer pauses. */
+#define KEY_MACRO_PAUSE(ms)         KEY_EVENT_PAUSE, KEY_MACRO_DURATION(ms)
+#define KEY_MACRO_END               0
+
+/**
+ * Decoded key event
+ */
+typedef struct {
+    uint8_t type;
+    uint8_t data;       // Character or usage, depending on type
+    uint8_t duration;   // In units of KEY_EVENT_DURATION_UNIT_MS
+} key_event_t;
+
+/**
+ * Decode a record from a linear buffer, such as a macro
+ *
+ * @return the length of the record, or 0 at KEY_MACRO_END
+ */
+static inline unsigned decodeKeyEvent(const uint8_t *record, key_event_t &event)
+{
+    unsigned length = 1;
+
+    if (record[0] < KEY_EVENT_ESCAPE) {
+        event.type = KEY_EVENT_CHAR;
+        event.data = record[0];
+        event.duration = 0;
+        return record[0] == KEY_MACRO_END ? 0 : 1;
+    }
+
+    event.type = record[0];
+    event.data = 0;
+    event.duration = 0;
+
+    if (event.type != KEY_EVENT_PAUSE)
+        event.data = record[length++];
+
+    if (event.type == KEY_EVENT_HOLD || event.type == KEY_EVENT_PAUSE)
+        event.duration = record[length++];
+
+    return length;
+}
+
+/**
+ * @class KeyBuffer
+ *
+ * Buffer used to store key events to send.
+ *
+ * Internally, it is a byte ring containing encoded events (see KeyEventType). Characters only take
+ * one byte, so this is as compact as the plain character buffer it replaces, but it can also hold
+ * raw usages, modifiers, holds and pauses.
+ *
+ * A record is only made visible to the consumer once it has been completely written, so one
+ * producer (e.g. printf from the main loop) and one consumer (the report ticker) can safely access
+ * the buffer concurrently, without disabling interrupts.
+ */
+class KeyBuffer
+{
+public:
+    KeyBuffer() :
+        head(0),
+        tail(0)
+    {
+    }
+
+    bool empty(void) const
+    {
+        return head == tail;
+    }
+
+    /**
+     * Number of bytes currently stored
+     */
+    unsigned size(void) const
+    {
+        unsigned h = head;
+        unsigned t = tail;
+
+        return h >= t ? h - t : h + KEYBUFFER_SIZE - t;
+    }
+
+    /**
+     * Number of bytes that can still be pushed
+     */
+    unsigned available(void) const
+    {
+        return KEYBUFFER_SIZE - 1 - size();
+    }
+
+    /**
+     * Position of the first record. Positions are only meant to be compared: once begin()
+     * returns a position previously returned by end(), all records pushed before it are gone.
+     */
+    unsigned begin(void) const
+    {
+        return tail;
+    }
+
+    /**
+     * Position following the last record
+     */
+    unsigned end(void) const
+    {
+        return head;
+    }
+
+    /**
+     * Append an event to the buffer
+     *
+     * @param type      Type of event. For KEY_EVENT_CHAR, the character is passed in data.
+     * @param data      Character, usage or modifiers
+     * @param duration  Duration of KEY_EVENT_HOLD and KEY_EVENT_PAUSE
+     *
+     * @return false if there isn't enough room for the whole record
+     */
+    bool push(uint8_t type, uint8_t data = 0, uint8_t duration = 0)
+    {
+        uint8_t record[KEY_EVENT_MAX_LENGTH];
+        unsigned length = 0;
+
+        if (type == KEY_EVENT_CHAR) {
+            if (data >= KEY_EVENT_ESCAPE)
+                return false;
+            record[length++] = data;
+        } else {
+            record[length++] = type;
+            if (type != KEY_EVENT_PAUSE)
+                record[length++] = data;
+            if (type == KEY_EVENT_HOLD || type == KEY_EVENT_PAUSE)
+                record[length++] = duration;
+        }
+
+        if (length > available())
+            return false;
+
+        unsigned h = head;
+        for (unsigned i = 0; i < length; i++) {
+            buffer[h] = record[i];
+            h = next(h);
+        }
+
+        /* Publish the whole record at once */
+        head = h;
+
+        return true;
+    }
+
+    /**
+     * Decode the next event, without removing it from the buffer
+     *
+     * @return false if the buffer is empty
+     */
+    bool peek(key_event_t &event) const
+    {
+        return decode(event) != tail;
+    }
+
+    /**
+     * Decode and remove the next event
+     *
+     * @return false if the buffer is empty
+     */
+    bool pop(key_event_t &event)
+    {
+        unsigned t = decode(event);
+
+        if (t == tail)
+            return false;
+
+        tail = t;
+        return true;
+    }
+
+protected:
+    static unsigned next(unsigned index)
+    {
+        return index + 1 == KEYBUFFER_SIZE ? 0 : index + 1;
+    }
+
+    /**
+     * Decode the event at tail.
+     *
+     * @return the index following the event, or tail if the buffer is empty.
+     */
+    unsigned decode(key_event_t &event) const
+    {
+        unsigned t = tail;
+
+        if (t == head)
+            return t;
+
+        uint8_t type = buffer[t];
+        t = next(t);
+
+        if (type < KEY_EVENT_ESCAPE) {
+            event.type = KEY_EVENT_CHAR;
+            event.data = type;
+            event.duration = 0;
+            return t;
+        }
+
+        event.type = type;
+        event.data = 0;
+        event.duration = 0;
+
+        if (type != KEY_EVENT_PAUSE) {
+            event.data = buffer[t];
+            t = next(t);
+        }
+
+        if (type == KEY_EVENT_HOLD || type == KEY_EVENT_PAUSE) {
+            event.duration = buffer[t];
+            t = next(t);
+        }
+
+        return t;
+    }
+
+protected:
+    uint8_t buffer[KEYBUFFER_SIZE];
+
+    /* head is only written by the producer, tail by the consumer. */
+    volatile unsigned head;
+    volatile unsigned tail;
+};
+
+#endif /* !HID_KEY_BUFFER_H_ */
@@ -0,0 +1,207 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "KeyMatrix.h"
+
+KeyMatrix::KeyMatrix(KeyboardService &_keyboard,
+                     const PinName *rows, unsigned rowCount,
+                     const PinName *columns, unsigned columnCount,
+                     const uint8_t *_usages) :
+    keyboard(_keyboard),
+    usages(_usages),
+    nRows(rowCount),
+    nColumns(columnCount),
+    ghostDetection(true),
+    idleScan(false),
+    ghostScans(0)
+{
+    MBED_ASSERT(rowCount <= KEYMATRIX_MAX_ROWS);
+    MBED_ASSERT(columnCount <= KEYMATRIX_MAX_COLUMNS);
+
+    /* Rows float until they are selected */
+    for (unsigned row = 0; row < nRows; row++)
+        gpio_init_in(&rowPins[row], rows[row]);
+
+    for (unsigned column = 0; column < nColumns; column++)
+        gpio_init_in_ex(&columnPins[column], columns[column], PullUp);
+
+    memset(counters, 0, sizeof(counters));
+    memset(debounced, 0, sizeof(debounced));
+    memset(settling, 0, sizeof(settling));
+    memset(reported, 0, sizeof(reported));
+
+    scanTask.attach(this, &KeyMatrix::scan);
+}
+
+void KeyMatrix::start(void)
+{
+    setIdle(true);
+}
+
+void KeyMatrix::stop(void)
+{
+    TaskScheduler::instance().cancel(scanTask);
+
+    memset(counters, 0, sizeof(counters));
+    memset(debounced, 0, sizeof(debounced));
+    memset(settling, 0, sizeof(settling));
+
+    sendChanges();
+}
+
+void KeyMatrix::setIdle(bool idle)
+{
+    uint32_t interval = idle ? KEYMATRIX_IDLE_SCAN_INTERVAL_US : KEYMATRIX_SCAN_INTERVAL_US;
+
+    TaskScheduler::instance().schedule(scanTask, interval, interval, interval / 4);
+    idleScan = idle;
+}
+
+void KeyMatrix::selectRow(unsigned row)
+{
+    gpio_write(&rowPins[row], 0);
+    gpio_dir(&rowPins[row], PIN_OUTPUT);
+}
+
+void KeyMatrix::unselectRow(unsigned row)
+{
+    gpio_dir(&rowPins[row], PIN_INPUT);
+}
+
+uint32_t KeyMatrix::readColumns(void)
+{
+    uint32_t down = 0;
+
+    for (unsigned column = 0; column < nColumns; column++) {
+        if (!gpio_read(&columnPins[column]))
+            down |= 1UL << column;
+    }
+
+    return down;
+}
+
+void KeyMatrix::scan(void)
+{
+    uint32_t raw[KEYMATRIX_MAX_ROWS];
+
+    for (unsigned row = 0; row < nRows; row++) {
+        selectRow(row);
+        wait_us(KEYMATRIX_SETTLE_US);
+        raw[row] = readColumns();
+        unselectRow(row);
+    }
+
+    if (ghostDetection)
+        maskGhosts(raw);
+
+    bool active = false;
+
+    for (unsigned row = 0; row < nRows; row++) {
+        debounce(row, raw[row]);
+        if (debounced[row] || settling[row])
+            active = true;
+    }
+
+    sendChanges();
+
+    if (active == idleScan)
+        setIdle(!active);
+}
+
+void KeyMatrix::maskGhosts(uint32_t *raw)
+{
+    uint32_t ghosted = 0;
+
+    for (unsigned i = 0; i < nRows; i++) {
+        /* A row needs two keys down to be part of a rectangle */
+        if (!(raw[i] & (raw[i] - 1)))
+            continue;
+
+        for (unsigned j = i + 1; j < nRows; j++) {
+            uint32_t common = raw[i] & raw[j];
+
+            if (common & (common - 1))
+                ghosted |= (1UL << i) | (1UL << j);
+        }
+    }
+
+    if (!ghosted)
+        return;
+
+    ghostScans++;
+
+    /* Any key of these rows may be a ghost: only keep those that were already down */
+    for (unsigned row = 0; row < nRows; row++) {
+        if (ghosted & (1UL << row))
+            raw[row] &= debounced[row];
+    }
+}
+
+void KeyMatrix::debounce(unsigned row, uint32_t raw)
+{
+    /* Keys that disagree with their debounced state, or whose counter is still moving */
+    uint32_t work = (raw ^ debounced[row]) | settling[row];
+
+    for (unsigned column = 0; work; column++) {
+        uint32_t bit = 1UL << column;
+        uint8_t &counter = counters[row][column];
+
+        if (!(work & bit))
+            continue;
+        work &= ~bit;
+
+        if (raw & bit) {
+            if (counter < KEYMATRIX_DEBOUNCE_SCANS && ++counter == KEYMATRIX_DEBOUNCE_SCANS)
+                debounced[row] |= bit;
+        } else {
+            if (counter > 0 && --counter == 0)
+                debounced[row] &= ~bit;
+        }
+
+        if (counter == ((debounced[row] & bit) ? KEYMATRIX_DEBOUNCE_SCANS : 0))
+            settling[row] &= ~bit;
+        else
+            settling[row] |= bit;
+    }
+}
+
+void KeyMatrix::sendChanges(void)
+{
+    /* All changes of a scan go out in a single report */
+    for (unsigned row = 0; row < nRows; row++) {
+        uint32_t changed = debounced[row] ^ reported[row];
+
+        for (unsigned column = 0; changed; column++) {
+            uint32_t bit = 1UL << column;
+            uint8_t usage = usages[row * nColumns + column];
+
+            if (!(changed & bit))
+                continue;
+            changed &= ~bit;
+
+            if (usage == KEYMATRIX_NO_KEY)
+                continue;
+
+            if (debounced[row] & bit)
+                keyboard.press(usage);
+            else
+                keyboard.release(usage);
+        }
+
+        reported[row] = debounced[row];
+    }
+}
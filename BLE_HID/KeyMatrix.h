@@ -0,0 +1,228 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HID_KEY_MATRIX_H_
+#define HID_KEY_MATRIX_H_
+
+#include "mbed.h"
+
+#include "KeyboardService.h"
+#include "TaskScheduler.h"
+
+/** Largest matrix supported. Columns are read into a 32-bit word. */
+#ifndef KEYMATRIX_MAX_ROWS
+#define KEYMATRIX_MAX_ROWS          8
+#endif
+
+#ifndef KEYMATRIX_MAX_COLUMNS
+#define KEYMATRIX_MAX_COLUMNS       16
+#endif
+
+#if KEYMATRIX_MAX_COLUMNS > 32
+#error "KEYMATRIX_MAX_COLUMNS can't exceed 32"
+#endif
+
+/** Interval between two scans of the whole matrix, in us */
+#ifndef KEYMATRIX_SCAN_INTERVAL_US
+#define KEYMATRIX_SCAN_INTERVAL_US  1000
+#endif
+
+/**
+ * Interval between two scans while all keys are up and settled, in us. The first scan that sees a
+ * key down returns to KEYMATRIX_SCAN_INTERVAL_US, so this adds at most one idle interval to the
+ * latency of the first press.
+ */
+#ifndef KEYMATRIX_IDLE_SCAN_INTERVAL_US
+#define KEYMATRIX_IDLE_SCAN_INTERVAL_US 16000
+#endif
+
+/**
+ * Number of consecutive scans, net of bounces, that a key must agree on before its state changes.
+ * With the default interval, a clean press is reported 5ms after the contact closes.
+ */
+#ifndef KEYMATRIX_DEBOUNCE_SCANS
+#define KEYMATRIX_DEBOUNCE_SCANS    5
+#endif
+
+/** Time for the columns to settle after selecting a row, in us */
+#ifndef KEYMATRIX_SETTLE_US
+#define KEYMATRIX_SETTLE_US         3
+#endif
+
+/** No key at this position of the matrix */
+#define KEYMATRIX_NO_KEY            0
+
+/**
+ * @class KeyMatrix
+ *
+ * Scan a matrix of switches, and feed key presses and releases to a KeyboardService.
+ *
+ * Rows are selected one at a time by driving them low, and pressed keys pull their column down
+ * (columns have pull-ups). Each position of the matrix is mapped to a key usage of the
+ * Keyboard/Keypad page, including modifiers, which is held with KeyboardService::press() and
+ * release() without going through the ASCII keymap or the key buffer.
+ *
+ * Each key has an integrating debouncer: a counter that goes up on each scan that sees the key
+ * down, and down on each scan that sees it up. The key is pressed when the counter reaches
+ * KEYMATRIX_DEBOUNCE_SCANS and released when it gets back to 0, so short bounces and glitches
+ * don't produce events. Only keys whose state or counter is moving are visited, so an idle
+ * matrix costs one read per row.
+ *
+ * Without a diode per key, three keys pressed at the corners of a rectangle make the fourth one
+ * look pressed too (ghosting). When two rows share two pressed columns, new presses on those rows
+ * are ignored until the ambiguity clears; keys already down stay down. Matrices with diodes can
+ * disable this with setGhostDetection().
+ *
+ * Scans run from the main loop, as a task of the TaskScheduler. All the keys that change during a
+ * scan go out in the same report. While no key is down or settling, the matrix is only scanned
+ * every KEYMATRIX_IDLE_SCAN_INTERVAL_US, so that the CPU can sleep.
+ *
+ * @code
+ * BLE ble;
+ * KeyboardService kbd(ble);
+ *
+ * const PinName rows[] = { P0_1, P0_2 };
+ * const PinName columns[] = { P0_3, P0_4, P0_5 };
+ * const uint8_t usages[] = {
+ *     0x04, 0x05, 0x06,       // a, b, c
+ *     0xe1, 0x2c, 0x28,       // Left Shift, Space, Return
+ * };
+ *
+ * KeyMatrix matrix(kbd, rows, 2, columns, 3, usages);
+ *
+ * int main()
+ * {
+ *     ...
+ *     matrix.start();
+ * }
+ * @endcode
+ */
+class KeyMatrix {
+public:
+    /**
+     * Constructor
+     *
+     * @param _keyboard     Service receiving the key events
+     * @param rows          Row pins, up to KEYMATRIX_MAX_ROWS
+     * @param rowCount      Number of rows
+     * @param columns       Column pins, up to KEYMATRIX_MAX_COLUMNS
+     * @param columnCount   Number of columns
+     * @param _usages       Key usage of each position, row after row. KEYMATRIX_NO_KEY for
+     *                      unused positions. The table isn't copied.
+     */
+    KeyMatrix(KeyboardService &_keyboard,
+              const PinName *rows, unsigned rowCount,
+              const PinName *columns, unsigned columnCount,
+              const uint8_t *_usages);
+
+    virtual ~KeyMatrix() {}
+
+    /**
+     * Start scanning the matrix
+     */
+    void start(void);
+
+    /**
+     * Stop scanning, and release the keys that are down
+     */
+    void stop(void);
+
+    /**
+     * Enable or disable ghost detection. It is enabled by default.
+     */
+    void setGhostDetection(bool enable)
+    {
+        ghostDetection = enable;
+    }
+
+    /**
+     * @return the debounced state of a key
+     */
+    bool isPressed(unsigned row, unsigned column) const
+    {
+        return row < nRows && column < nColumns && (debounced[row] & (1UL << column));
+    }
+
+protected:
+    /**
+     * Drive a row low. Unselected rows are left floating, so that pressed keys of two rows can't
+     * short them.
+     */
+    virtual void selectRow(unsigned row);
+
+    virtual void unselectRow(unsigned row);
+
+    /**
+     * Read the columns of the selected row
+     *
+     * @return a bit per column, set when the key is down
+     */
+    virtual uint32_t readColumns(void);
+
+    /**
+     * Called by scanTask
+     */
+    void scan(void);
+
+    /**
+     * Clear the new presses of rows that share two or more pressed columns
+     */
+    void maskGhosts(uint32_t *raw);
+
+    /**
+     * Run the debouncers of a row
+     */
+    void debounce(unsigned row, uint32_t raw);
+
+    /**
+     * Send the keys whose debounced state differs from what the keyboard was told
+     */
+    void sendChanges(void);
+
+    /**
+     * Switch between the idle and active scan rates
+     */
+    void setIdle(bool idle);
+
+protected:
+    KeyboardService &keyboard;
+    const uint8_t *usages;
+
+    unsigned nRows;
+    unsigned nColumns;
+    gpio_t rowPins[KEYMATRIX_MAX_ROWS];
+    gpio_t columnPins[KEYMATRIX_MAX_COLUMNS];
+
+    /// Debouncer of each key, from 0 (up) to KEYMATRIX_DEBOUNCE_SCANS (down)
+    uint8_t counters[KEYMATRIX_MAX_ROWS][KEYMATRIX_MAX_COLUMNS];
+    /// Debounced state
+    uint32_t debounced[KEYMATRIX_MAX_ROWS];
+    /// Keys whose counter isn't at rest yet
+    uint32_t settling[KEYMATRIX_MAX_ROWS];
+    /// State last sent to the keyboard
+    uint32_t reported[KEYMATRIX_MAX_ROWS];
+
+    bool ghostDetection;
+    ScheduledTask scanTask;
+    /// Scanning at KEYMATRIX_IDLE_SCAN_INTERVAL_US
+    bool idleScan;
+
+public:
+    /// Scans in which ghosting blocked some presses
+    uint32_t ghostScans;
+};
+
+#endif /* !HID_KEY_MATRIX_H_ */
@@ -0,0 +1,337 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "KeyValueStore.h"
+
+/* Page header: magic number and generation of the page */
+#define KVSTORE_MAGIC       0x4b56
+#define KVSTORE_ERASED      0xffffffff
+
+#define RECORD_KEY(header)      ((header) & 0xffff)
+#define RECORD_LENGTH(header)   ((header) >> 16)
+#define RECORD_SIZE(length)     (4 + (((length) + 3) & ~3))
+
+FlashKeyValueStore::FlashKeyValueStore(uint32_t page0, uint32_t page1, uint32_t _pageSize) :
+    pageSize(_pageSize),
+    mounted(false),
+    activePage(0),
+    generation(0),
+    writeOffset(0)
+{
+    pages[0] = page0;
+    pages[1] = page1;
+}
+
+bool FlashKeyValueStore::mount(void)
+{
+    uint32_t header0 = readWord(pages[0]);
+    uint32_t header1 = readWord(pages[1]);
+    bool valid0 = (header0 >> 16) == KVSTORE_MAGIC;
+    bool valid1 = (header1 >> 16) == KVSTORE_MAGIC;
+
+    if (!valid0 && !valid1) {
+        uint32_t header = KVSTORE_MAGIC << 16;
+
+        if (!erase(pages[0]) || !program(pages[0], &header, 1))
+            return false;
+
+        activePage = 0;
+    } else if (valid0 && valid1) {
+        /* The page with the most recent generation wins */
+        activePage = (int16_t)((header1 & 0xffff) - (header0 & 0xffff)) > 0 ? 1 : 0;
+    } else {
+        activePage = valid0 ? 0 : 1;
+    }
+
+    generation = readWord(pages[activePage]) & 0xffff;
+
+    writeOffset = 4;
+    while (writeOffset + 4 <= pageSize) {
+        uint32_t header = readWord(pages[activePage] + writeOffset);
+
+        if (header == KVSTORE_ERASED)
+            break;
+
+        writeOffset += RECORD_SIZE(RECORD_LENGTH(header));
+    }
+
+    /*
+     * A write might have been interrupted after programming the value but before its header.
+     * Don't program anything on top of it: the next store will compact the page.
+     */
+    for (uint32_t offset = writeOffset; offset + 4 <= pageSize; offset += 4) {
+        if (readWord(pages[activePage] + offset) != KVSTORE_ERASED) {
+            writeOffset = pageSize;
+            break;
+        }
+    }
+
+    mounted = true;
+    return true;
+}
+
+uint32_t FlashKeyValueStore::find(uint16_t key)
+{
+    uint32_t found = 0;
+    uint32_t offset = 4;
+
+    while (offset < writeOffset && offset + 4 <= pageSize) {
+        uint32_t address = pages[activePage] + offset;
+        uint32_t header = readWord(address);
+
+        if (header == KVSTORE_ERASED)
+            break;
+
+        if (RECORD_KEY(header) == key)
+            found = address;
+
+        offset += RECORD_SIZE(RECORD_LENGTH(header));
+    }
+
+    return found;
+}
+
+bool FlashKeyValueStore::append(uint32_t page, uint32_t &offset, uint16_t key,
+                                const void *value, uint16_t length)
+{
+    uint32_t words[(KVSTORE_MAX_VALUE_SIZE + 3) / 4];
+    unsigned count = (length + 3) / 4;
+    uint32_t header = key | (length << 16);
+
+    memset(words, 0xff, sizeof(words));
+    if (length)
+        memcpy(words, value, length);
+
+    if (count && !program(pages[page] + offset + 4, words, count))
+        return false;
+
+    if (!program(pages[page] + offset, &header, 1))
+        return false;
+
+    offset += RECORD_SIZE(length);
+    return true;
+}
+
+bool FlashKeyValueStore::compact(void)
+{
+    unsigned otherPage = !activePage;
+    uint32_t offset = 4;
+    uint32_t header;
+
+    if (!erase(pages[otherPage]))
+        return false;
+
+    for (uint32_t source = 4; source < writeOffset && source + 4 <= pageSize;
+            source += RECORD_SIZE(RECORD_LENGTH(header))) {
+        uint32_t address = pages[activePage] + source;
+        uint8_t value[KVSTORE_MAX_VALUE_SIZE];
+
+        header = readWord(address);
+        if (header == KVSTORE_ERASED)
+            break;
+
+        /*
+         * Skip records superseded by a more recent one, and records that store() can't have
+         * written (corrupted, or from a build with a larger KVSTORE_MAX_VALUE_SIZE)
+         */
+        if (RECORD_LENGTH(header) > KVSTORE_MAX_VALUE_SIZE || find(RECORD_KEY(header)) != address)
+            continue;
+
+        read(address + 4, value, RECORD_LENGTH(header));
+
+        if (!append(otherPage, offset, RECORD_KEY(header), value, RECORD_LENGTH(header)))
+            return false;
+    }
+
+    /* Only now does the new page become valid */
+    header = (KVSTORE_MAGIC << 16) | (uint16_t)(generation + 1);
+    if (!program(pages[otherPage], &header, 1))
+        return false;
+
+    activePage = otherPage;
+    generation++;
+    writeOffset = offset;
+
+    return true;
+}
+
+bool FlashKeyValueStore::load(uint16_t key, void *value, uint16_t length)
+{
+    if (!mounted && !mount())
+        return false;
+
+    uint32_t address = find(key);
+    if (!address)
+        return false;
+
+    uint16_t recordLength = RECORD_LENGTH(readWord(address));
+    read(address + 4, value, length < recordLength ? length : recordLength);
+
+    return true;
+}
+
+bool FlashKeyValueStore::store(uint16_t key, const void *value, uint16_t length)
+{
+    if (key == 0xffff || length > KVSTORE_MAX_VALUE_SIZE)
+        return false;
+
+    if (!mounted && !mount())
+        return false;
+
+    if (writeOffset + RECORD_SIZE(length) > pageSize) {
+        if (!compact() || writeOffset + RECORD_SIZE(length) > pageSize)
+            return false;
+    }
+
+    return append(activePage, writeOffset, key, value, length);
+}
+
+FileKeyValueStore::FileKeyValueStore(const char *path, uint32_t _pageSize) :
+    FlashKeyValueStore(0, _pageSize, _pageSize)
+{
+    file = fopen(path, "r+b");
+    if (file)
+        return;
+
+    /* New file: both pages are erased */
+    file = fopen(path, "w+b");
+    if (file) {
+        erase(pages[0]);
+        erase(pages[1]);
+    }
+}
+
+FileKeyValueStore::~FileKeyValueStore()
+{
+    if (file)
+        fclose(file);
+}
+
+void FileKeyValueStore::read(uint32_t address, void *data, unsigned length)
+{
+    memset(data, 0xff, length);
+
+    if (!file || fseek(file, address, SEEK_SET))
+        return;
+
+    if (fread(data, 1, length, file) != length)
+        clearerr(file);
+}
+
+bool FileKeyValueStore::program(uint32_t address, const uint32_t *data, unsigned words)
+{
+    if (!file)
+        return false;
+
+    for (unsigned i = 0; i < words; i++) {
+        /* Like flash, programming can only clear bits */
+        uint32_t word = readWord(address + i * 4) & data[i];
+
+        if (fseek(file, address + i * 4, SEEK_SET) || fwrite(&word, 4, 1, file) != 1)
+            return false;
+    }
+
+    return fflush(file) == 0;
+}
+
+bool FileKeyValueStore::erase(uint32_t address)
+{
+    static const uint32_t erased = KVSTORE_ERASED;
+
+    if (!file || fseek(file, address, SEEK_SET))
+        return false;
+
+    for (uint32_t offset = 0; offset < pageSize; offset += 4) {
+        if (fwrite(&erased, 4, 1, file) != 1)
+            return false;
+    }
+
+    return fflush(file) == 0;
+}
+
+#ifdef TARGET_NRF51822
+#define NRF51_KVSTORE_PENDING  0xffffffff
+
+volatile uint32_t NRF51FlashKeyValueStore::result = NRF_SUCCESS;
+
+NRF51FlashKeyValueStore::NRF51FlashKeyValueStore() :
+    FlashKeyValueStore(0, 0, PSTORAGE_FLASH_PAGE_SIZE),
+    valid(false)
+{
+    pstorage_module_param_t param;
+    pstorage_handle_t base;
+
+    param.cb = onFlashEvent;
+    param.block_size = PSTORAGE_FLASH_PAGE_SIZE;
+    param.block_count = 2;
+
+    if (pstorage_register(&param, &base) != NRF_SUCCESS)
+        return;
+
+    for (unsigned i = 0; i < 2; i++) {
+        if (pstorage_block_identifier_get(&base, i, &pageHandles[i]) != NRF_SUCCESS)
+            return;
+        pages[i] = pageHandles[i].block_id;
+    }
+
+    valid = true;
+}
+
+void NRF51FlashKeyValueStore::onFlashEvent(pstorage_handle_t *handle, uint8_t opCode,
+                                           uint32_t _result, uint8_t *data, uint32_t length)
+{
+    result = _result;
+}
+
+bool NRF51FlashKeyValueStore::wait(uint32_t err)
+{
+    if (err != NRF_SUCCESS) {
+        result = err;
+        return false;
+    }
+
+    /* Completed by onFlashEvent, in the SoftDevice event interrupt */
+    while (result == NRF51_KVSTORE_PENDING)
+        ;
+
+    return result == NRF_SUCCESS;
+}
+
+bool NRF51FlashKeyValueStore::program(uint32_t address, const uint32_t *data, unsigned words)
+{
+    unsigned page = address >= pages[1] ? 1 : 0;
+
+    if (!valid)
+        return false;
+
+    /* The data stays valid since we wait for the operation to complete */
+    result = NRF51_KVSTORE_PENDING;
+    return wait(pstorage_store(&pageHandles[page], (uint8_t *)data, words * 4,
+                               address - pages[page]));
+}
+
+bool NRF51FlashKeyValueStore::erase(uint32_t address)
+{
+    unsigned page = address >= pages[1] ? 1 : 0;
+
+    if (!valid)
+        return false;
+
+    result = NRF51_KVSTORE_PENDING;
+    return wait(pstorage_clear(&pageHandles[page], pageSize));
+}
+#endif
@@ -0,0 +1,205 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HID_KEY_VALUE_STORE_H_
+#define HID_KEY_VALUE_STORE_H_
+
+#include <stdio.h>
+#include "mbed.h"
+
+#ifdef TARGET_NRF51822
+#include "pstorage.h"
+#endif
+
+/** Largest value accepted by FlashKeyValueStore, in bytes */
+#ifndef KVSTORE_MAX_VALUE_SIZE
+#define KVSTORE_MAX_VALUE_SIZE 32
+#endif
+
+/**
+ * @class KeyValueStore
+ *
+ * Minimal interface to non-volatile storage of small values
+ */
+class KeyValueStore {
+public:
+    virtual ~KeyValueStore() {}
+
+    /**
+     * Read a value
+     *
+     * @param key       Identifier of the value
+     * @param value     Buffer filled with the value
+     * @param length    Size of the buffer. Longer values are truncated.
+     *
+     * @return true if the key was found
+     */
+    virtual bool load(uint16_t key, void *value, uint16_t length) = 0;
+
+    /**
+     * Write a value, replacing the previous one
+     *
+     * @return true on success
+     */
+    virtual bool store(uint16_t key, const void *value, uint16_t length) = 0;
+};
+
+/**
+ * @class FlashKeyValueStore
+ *
+ * Log-structured store spread over two flash pages. Values are appended to the active page, and
+ * the latest record of a key wins. When the active page is full, the latest records are copied
+ * to the other page, which becomes active.
+ *
+ * Records are made of a header word (key and length) followed by the value, padded to a word.
+ * The value is programmed before its header, so that an interrupted write is simply ignored.
+ *
+ * Platforms must implement program() and erase() (see NRF51FlashKeyValueStore). By default,
+ * flash is read through memory.
+ */
+class FlashKeyValueStore : public KeyValueStore {
+public:
+    /**
+     * @param page0, page1  Addresses of two flash pages reserved for the store
+     * @param pageSize      Size of a page, in bytes
+     */
+    FlashKeyValueStore(uint32_t page0, uint32_t page1, uint32_t pageSize);
+
+    virtual bool load(uint16_t key, void *value, uint16_t length);
+    virtual bool store(uint16_t key, const void *value, uint16_t length);
+
+protected:
+    /**
+     * Program words at a word-aligned address. Bits can only be cleared.
+     */
+    virtual bool program(uint32_t address, const uint32_t *data, unsigned words) = 0;
+
+    /**
+     * Erase a page. All its bits are set to 1.
+     */
+    virtual bool erase(uint32_t address) = 0;
+
+    virtual void read(uint32_t address, void *data, unsigned length)
+    {
+        memcpy(data, (const void *)(uintptr_t)address, length);
+    }
+
+    uint32_t readWord(uint32_t address)
+    {
+        uint32_t word;
+
+        read(address, &word, sizeof(word));
+        return word;
+    }
+
+    /**
+     * Find the active page and the end of its log
+     */
+    bool mount(void);
+
+    /**
+     * Copy the latest records to the other page, and make it active
+     */
+    bool compact(void);
+
+    /**
+     * Find the latest record of a key in the active page
+     *
+     * @return the address of the record header, or 0 if not found
+     */
+    uint32_t find(uint16_t key);
+
+    bool append(uint32_t page, uint32_t &offset, uint16_t key, const void *value,
+                uint16_t length);
+
+protected:
+    uint32_t pages[2];
+    uint32_t pageSize;
+
+    bool mounted;
+    unsigned activePage;
+    uint16_t generation;
+    /// Offset of the first free word in the active page
+    uint32_t writeOffset;
+};
+
+/**
+ * @class FileKeyValueStore
+ *
+ * Stand-in for FlashKeyValueStore, on a file. The file emulates the behaviour of flash memory,
+ * which allows to run the exact same code on a host, or on boards that have a file system.
+ */
+class FileKeyValueStore : public FlashKeyValueStore {
+public:
+    FileKeyValueStore(const char *path, uint32_t pageSize = 1024);
+    virtual ~FileKeyValueStore();
+
+protected:
+    virtual bool program(uint32_t address, const uint32_t *data, unsigned words);
+    virtual bool erase(uint32_t address);
+    virtual void read(uint32_t address, void *data, unsigned length);
+
+protected:
+    FILE *file;
+};
+
+#ifdef TARGET_NRF51822
+/**
+ * @class NRF51FlashKeyValueStore
+ *
+ * FlashKeyValueStore on two pages of the nRF51 application data area. Flash can't be written
+ * directly while the SoftDevice runs, so the pages are registered with the SDK's pstorage module,
+ * which the nRF51822 port of BLE_API already initializes and feeds with the SoftDevice's flash
+ * events. pstorage_platform.h must leave room for one more module and two more pages
+ * (PSTORAGE_MAX_APPLICATIONS and PSTORAGE_NUM_OF_PAGES).
+ *
+ * Flash operations complete in the SoftDevice event interrupt, and program() and erase() wait for
+ * them: call load() and store() from the main loop (services do). Only one instance may exist.
+ */
+class NRF51FlashKeyValueStore : public FlashKeyValueStore {
+public:
+    NRF51FlashKeyValueStore();
+
+    /**
+     * @return false if pstorage had no room for the pages. The store then always fails.
+     */
+    bool isValid(void) const
+    {
+        return valid;
+    }
+
+protected:
+    virtual bool program(uint32_t address, const uint32_t *data, unsigned words);
+    virtual bool erase(uint32_t address);
+
+    /**
+     * Wait for the completion of the operation started with status err
+     */
+    bool wait(uint32_t err);
+
+    static void onFlashEvent(pstorage_handle_t *handle, uint8_t opCode, uint32_t result,
+                             uint8_t *data, uint32_t length);
+
+protected:
+    pstorage_handle_t pageHandles[2];
+    bool valid;
+
+    /// Result of the last operation, or NRF51_KVSTORE_PENDING while it is in progress
+    static volatile uint32_t result;
+};
+#endif
+
+#endif /* !HID_KEY_VALUE_STORE_H_ */
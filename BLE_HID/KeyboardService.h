@@ -14,152 +14,129 @@
  * limitations under the License.
  */
 
+#ifndef HID_KEYBOARD_SERVICE_H_
+#define HID_KEYBOARD_SERVICE_H_
+
 #include <errno.h>
 #include "mbed.h"
-#include "CircularBuffer.h"
 
-#include "HIDServiceBase.h"
+#include "HIDService.h"
 #include "Keyboard_types.h"
-
-/* TODO: make this easier to configure by application (e.g. as a template parameter for
- * KeyboardService) */
-#ifndef KEYBUFFER_SIZE
-#define KEYBUFFER_SIZE 256
-#endif
+#include "KeyBuffer.h"
 
 /**
  * Report descriptor for a standard 101 keys keyboard, following the HID specification example:
- * - 8 bytes input report (1 byte for modifiers and 6 for keys)
+ * - 8 bytes input report (1 byte for modifiers, 1 reserved and 6 for keys), or with KEYBOARD_NKRO,
+ *   the modifier and reserved bytes followed by a bitmap of KEYBOARD_NKRO_USAGES keys
  * - 1 byte output report (LEDs)
  */
-report_map_t KEYBOARD_REPORT_MAP = {
-    USAGE_PAGE(1),      0x01,       // Generic Desktop Ctrls
-    USAGE(1),           0x06,       // Keyboard
-    COLLECTION(1),      0x01,       // Application
-    USAGE_PAGE(1),      0x07,       //   Kbrd/Keypad
-    USAGE_MINIMUM(1),   0xE0,
-    USAGE_MAXIMUM(1),   0xE7,
-    LOGICAL_MINIMUM(1), 0x00,
-    LOGICAL_MAXIMUM(1), 0x01,
-    REPORT_SIZE(1),     0x01,       //   1 byte (Modifier)
-    REPORT_COUNT(1),    0x08,
-    INPUT(1),           0x02,       //   Data,Var,Abs,No Wrap,Linear,Preferred State,No Null Position
-    REPORT_COUNT(1),    0x01,       //   1 byte (Reserved)
-    REPORT_SIZE(1),     0x08,
-    INPUT(1),           0x01,       //   Const,Array,Abs,No Wrap,Linear,Preferred State,No Null Position
-    REPORT_COUNT(1),    0x05,       //   5 bits (Num lock, Caps lock, Scroll lock, Compose, Kana)
-    REPORT_SIZE(1),     0x01,
-    USAGE_PAGE(1),      0x08,       //   LEDs
-    USAGE_MINIMUM(1),   0x01,       //   Num Lock
-    USAGE_MAXIMUM(1),   0x05,       //   Kana
-    OUTPUT(1),          0x02,       //   Data,Var,Abs,No Wrap,Linear,Preferred State,No Null Position,Non-volatile
-    REPORT_COUNT(1),    0x01,       //   3 bits (Padding)
-    REPORT_SIZE(1),     0x03,
-    OUTPUT(1),          0x01,       //   Const,Array,Abs,No Wrap,Linear,Preferred State,No Null Position,Non-volatile
-    REPORT_COUNT(1),    0x06,       //   6 bytes (Keys)
-    REPORT_SIZE(1),     0x08,
-    LOGICAL_MINIMUM(1), 0x00,
-    LOGICAL_MAXIMUM(1), 0x65,       //   101 keys
-    USAGE_PAGE(1),      0x07,       //   Kbrd/Keypad
-    USAGE_MINIMUM(1),   0x00,
-    USAGE_MAXIMUM(1),   0x65,
-    INPUT(1),           0x00,       //   Data,Array,Abs,No Wrap,Linear,Preferred State,No Null Position
-    END_COLLECTION(0),
-};
+extern report_map_t KEYBOARD_REPORT_MAP;
+extern const uint16_t KEYBOARD_REPORT_MAP_LENGTH;
 
-/// "keys pressed" report
-static uint8_t inputReportData[] = { 0, 0, 0, 0, 0, 0, 0, 0 };
-/// "keys released" report
-static const uint8_t emptyInputReportData[] = { 0, 0, 0, 0, 0, 0, 0, 0 };
-/// LEDs report
-static uint8_t outputReportData[] = { 0 };
+/// First and last usages of the modifier keys (LeftControl to Right GUI)
+#define KEY_USAGE_MODIFIER_MIN  0xe0
+#define KEY_USAGE_MODIFIER_MAX  0xe7
 
+/// Number of key slots in the input report
+#define KEY_REPORT_SLOTS        6
+
+/// Offset of the key slots, or of the NKRO bitmap, in the input report
+#define KEY_REPORT_KEYS_OFFSET  2
+
+/// Value of all key slots when more than KEY_REPORT_SLOTS keys are held (ErrorRollOver)
+#define KEY_USAGE_ROLLOVER      0x01
 
 /**
- * @class KeyBuffer
- *
- * Buffer used to store keys to send.
- * Internally, it is a CircularBuffer, with the added capability of putting the last char back in,
- * when we're unable to send it (ie. when BLE stack is busy)
+ * Report the held keys as a bitmap (N-key rollover) rather than in KEY_REPORT_SLOTS slots. Any
+ * number of keys can then be held together, but hosts that only speak the boot protocol (BIOSes,
+ * some TVs) can't parse the report.
  */
-class KeyBuffer: public CircularBuffer<uint8_t, KEYBUFFER_SIZE>
-{
-public:
-    KeyBuffer() :
-        CircularBuffer(),
-        dataIsPending (false),
-        keyUpIsPending (false)
-    {
-    }
+#ifndef KEYBOARD_NKRO
+#define KEYBOARD_NKRO           0
+#endif
 
-    /**
-     * Mark a character as pending. When a freshly popped character cannot be sent, because the
-     * underlying stack is busy, we set it as pending, and it will get popped in priority by @ref
-     * getPending once reports can be sent again.
-     *
-     * @param data  The character to send in priority. The second keyUp report is implied.
-     */
-    void setPending(uint8_t data)
-    {
-        MBED_ASSERT(dataIsPending == false);
+/**
+ * Number of usages covered by the NKRO bitmap, starting at 0. The default covers the 101 keys, the
+ * keypad and F13 to F24, in a 17 bytes report. Beyond 144 usages, the report doesn't fit in a
+ * notification without an MTU exchange.
+ */
+#ifndef KEYBOARD_NKRO_USAGES
+#define KEYBOARD_NKRO_USAGES    120
+#endif
 
-        dataIsPending = true;
-        pendingData = data;
-        keyUpIsPending = true;
-    }
+#if KEYBOARD_NKRO_USAGES % 8 || KEYBOARD_NKRO_USAGES > KEY_USAGE_MODIFIER_MIN
+#error "KEYBOARD_NKRO_USAGES must be a multiple of 8, up to the first modifier"
+#endif
 
-    /**
-     * Get pending char. Either from the high priority buffer (set with setPending), or from the
-     * circular buffer.
-     *
-     * @param   data Filled with the pending data, when present
-     * @return  true if data was filled
-     */
-    bool getPending(uint8_t &data)
-    {
-        if (dataIsPending) {
-            dataIsPending = false;
-            data = pendingData;
-            return true;
-        }
+#if KEYBOARD_NKRO
+#define KEYBOARD_INPUT_REPORT_SIZE  (KEY_REPORT_KEYS_OFFSET + KEYBOARD_NKRO_USAGES / 8)
+#else
+#define KEYBOARD_INPUT_REPORT_SIZE  (KEY_REPORT_KEYS_OFFSET + KEY_REPORT_SLOTS)
+#endif
 
-        return pop(data);
-    }
+/**
+ * Last key usage declared by the report map, below the modifiers. Hosts discard the others. The
+ * 6-key report only declares the 101 keys (up to Application); F13 to F24 and the international
+ * keys need KEYBOARD_NKRO.
+ */
+#if KEYBOARD_NKRO
+#define KEY_REPORT_USAGE_MAX        (KEYBOARD_NKRO_USAGES - 1)
+#else
+#define KEY_REPORT_USAGE_MAX        0x65
+#endif
 
-    bool isSomethingPending(void)
-    {
-        return dataIsPending || keyUpIsPending || !empty();
-    }
+/**
+ * Keys typed while disconnected are delivered on reconnection, unless they are older than
+ * KEYBOARD_OFFLINE_TTL_MS (0 keeps them forever). At most KEYBOARD_OFFLINE_MAX_BYTES of the buffer
+ * can be filled while disconnected.
+ */
+#ifndef KEYBOARD_OFFLINE_TTL_MS
+#define KEYBOARD_OFFLINE_TTL_MS     30000
+#endif
 
-    /**
-     * Signal that a keyUp report is pending. This means that a character has successfully been
-     * sent, but the subsequent keyUp report failed. This report is of highest priority than the
-     * next character.
-     */
-    void setKeyUpPending(void)
-    {
-        keyUpIsPending = true;
-    }
+#ifndef KEYBOARD_OFFLINE_MAX_BYTES
+#define KEYBOARD_OFFLINE_MAX_BYTES  KEYBUFFER_SIZE
+#endif
 
-    /**
-     * Signal that no high-priority report is pending anymore, we can go back to the normal queue.
-     */
-    void clearKeyUpPending(void)
-    {
-        keyUpIsPending = false;
-    }
+/** Number of typeAsync() texts that can be in flight at the same time */
+#ifndef KEYBOARD_MAX_ASYNC_TEXTS
+#define KEYBOARD_MAX_ASYNC_TEXTS    4
+#endif
 
-    bool isKeyUpPending(void)
-    {
-        return keyUpIsPending;
-    }
+/**
+ * Called once a text queued with typeAsync() has been delivered to the host (status 0), or when it
+ * can't be anymore: ENOTCONN if the link was lost while sending it, ETIMEDOUT if it was dropped
+ * by the offline policy.
+ */
+typedef void (*keyboard_typed_callback_t)(int handle, int status);
 
-protected:
-    bool dataIsPending;
-    uint8_t pendingData;
-    bool keyUpIsPending;
+/**
+ * Called when the key buffer crosses a watermark
+ */
+typedef void (*keyboard_watermark_callback_t)(void);
+
+/**
+ * State of a typeAsync() text
+ */
+enum KeyboardTextState {
+    KEYBOARD_TEXT_FREE,
+    /// Its keys are still in the buffer
+    KEYBOARD_TEXT_QUEUED,
+    /// Its last report was handed to the stack, waiting for onDataSent
+    KEYBOARD_TEXT_SENT,
+    /// Its callback is due
+    KEYBOARD_TEXT_DONE,
 };
 
+typedef struct {
+    int handle;
+    keyboard_typed_callback_t callback;
+    uint8_t state;
+    int status;
+    /// Value of reportsQueued once the last report of the text was queued
+    uint32_t lastReport;
+} keyboard_text_t;
+
 
 /**
  * @class KeyboardService
@@ -169,6 +146,23 @@ protected:
  * Stream API. Because we can't send batches of HID reports, we store pending keys in a circular
  * buffer and rely on the report ticker to spread them over time.
  *
+ * Besides characters, the buffer holds raw key usages, explicit presses and releases, modifiers
+ * and pauses, queued with the push* methods.
+ *
+ * Sequences known in advance can be stored in flash as macros (see KEY_MACRO_END), and played with
+ * playMacro(). They are read in place, so their length isn't limited by the size of the buffer.
+ *
+ * Keys can also be held directly with press() and release(), which bypass the buffer. The service
+ * keeps the set of held keys, and reports are built from that set plus the key being typed from
+ * the buffer: a report is only sent when its content changes, and several changes between two
+ * ticks go out in a single report. With KEYBOARD_NKRO, the report is a bitmap and any number of
+ * keys can be held together. Otherwise, when more than KEY_REPORT_SLOTS keys are held, the report
+ * says so with KEY_USAGE_ROLLOVER and the host keeps its previous state until some are released.
+ *
+ * A held key stays down in the reports, so the host repeats it with its own typematic settings,
+ * without any traffic. For hosts that don't, setTypematic() makes the service repeat the last
+ * held key itself.
+ *
  * @code
  * BLE ble;
  * KeyboardService kbd(ble);
@@ -177,81 +171,150 @@ protected:
  * {
  *     // Sequentially send keys 'Shift'+'h', 'e', 'l', 'l', 'o', '!' and <enter>
  *     kbd.printf("Hello!\n");
+ *
+ *     // Hold 'Left GUI' while typing 'l', then wait for half a second
+ *     kbd.pushKeyDown(0xe3);
+ *     kbd.putc('l');
+ *     kbd.pushKeyUp(0xe3);
+ *     kbd.pushPause(500);
+ * }
+ *
+ * void on_shift_button(bool down)
+ * {
+ *     // Hold Left Shift for as long as the button is down
+ *     if (down)
+ *         kbd.press(0xe1);
+ *     else
+ *         kbd.release(0xe1);
  * }
  * @endcode
+ *
+ * printf() returns as soon as the keys are in the buffer. To know when the host actually received
+ * them, use typeAsync(), whose callback is called once the stack confirms that the last report of
+ * the text was sent. setWatermarks() tells producers when to pause and resume.
  */
-class KeyboardService : public HIDServiceBase, public Stream
+class KeyboardService : public HIDService<KeyboardService, HID_WITH_OUTPUT_REPORT>, public Stream
 {
 public:
     KeyboardService(BLE &_ble) :
-        HIDServiceBase(_ble,
-                KEYBOARD_REPORT_MAP, sizeof(KEYBOARD_REPORT_MAP),
-                inputReport         = emptyInputReportData,
-                outputReport        = outputReportData,
+        HIDService<KeyboardService, HID_WITH_OUTPUT_REPORT>(_ble,
+                KEYBOARD_REPORT_MAP, KEYBOARD_REPORT_MAP_LENGTH,
+                inputReport         = emptyReport,
+                outputReport        = emptyReport,
                 featureReport       = NULL,
                 inputReportLength   = sizeof(inputReportData),
-                outputReportLength  = sizeof(outputReportData),
+                outputReportLength  = 1,
                 featureReportLength = 0,
                 reportTickerDelay   = 24),
-        failedReports(0)
+        failedReports(0),
+        modifiers(0),
+        typedKey(0),
+        typedModifiers(0),
+        remainingDelay(0),
+        reportIsPending(false),
+        offlineTTL(KEYBOARD_OFFLINE_TTL_MS),
+        offlineMaxBytes(KEYBOARD_OFFLINE_MAX_BYTES),
+        staleMark(0),
+        previousMark(0),
+        latestMark(0),
+        nextTextHandle(0),
+        lowWatermark(0),
+        highWatermark(KEYBUFFER_SIZE),
+        lowWatermarkCallback(NULL),
+        highWatermarkCallback(NULL),
+        aboveHighWatermark(false),
+        pendingMacro(NULL),
+        macroCursor(NULL),
+        repeatDelay(0),
+        repeatInterval(0),
+        repeatKey(0),
+        repeatReleased(false)
     {
+        offlineTask.attach(this, &KeyboardService::onOfflineTick);
+        textTask.attach(this, &KeyboardService::completeTexts);
+        repeatTask.attach(this, &KeyboardService::onRepeat);
+
+        memset(texts, 0, sizeof(texts));
+        memset(heldKeys, 0, sizeof(heldKeys));
+        memset(inputReportData, 0, sizeof(inputReportData));
     }
 
     virtual void onConnection(const Gap::ConnectionCallbackParams_t *params)
     {
         HIDServiceBase::onConnection(params);
 
-        /* Drain buffer, in case we've been disconnected while transmitting */
-        if (!reportTickerIsActive && keyBuffer.isSomethingPending())
-            startReportTicker();
-    }
+        TaskScheduler::instance().cancel(offlineTask);
+        if (offlineTTL)
+            dropStaleKeys();
 
-    virtual void onDisconnection(const Gap::DisconnectionCallbackParams_t *params)
-    {
-        stopReportTicker();
-        HIDServiceBase::onDisconnection(params);
+        /*
+         * The host released all keys when we disconnected. Send a release-all report, then the
+         * keys that are still held, and drain the buffer.
+         */
+        memset(inputReportData, 0, sizeof(inputReportData));
+        typedKey = 0;
+        typedModifiers = 0;
+        remainingDelay = 0;
+        reportIsPending = false;
+        updateReportData();
+
+        startReportTicker();
     }
 
-    /**
-     * Send raw report. Should only be called by sendCallback.
-     */
-    virtual ble_error_t send(const report_t report)
+    virtual void onDisconnection(const Gap::DisconnectionCallbackParams_t *params)
     {
-        static unsigned int consecutiveFailures = 0;
-        ble_error_t ret = HIDServiceBase::send(report);
+        stopRepeat();
 
         /*
-         * Wait until a buffer is available (onDataSent)
-         * TODO. This won't work, because BUSY error is not only returned when we're short of
-         * notification buffers, but in other cases as well (e.g. when disconnected). We need to
-         * find a reliable way of knowing when we actually need to wait for onDataSent to be called.
-        if (ret == BLE_STACK_BUSY)
-            stopReportTicker();
+         * Reports still in the stack's buffers are lost. Settle all sent texts now: the next
+         * connection restarts the report counters, before textTask could compare them.
          */
-        if (ret == BLE_STACK_BUSY)
-            consecutiveFailures++;
-        else
-            consecutiveFailures = 0;
+        for (unsigned i = 0; i < KEYBOARD_MAX_ASYNC_TEXTS; i++) {
+            if (texts[i].state != KEYBOARD_TEXT_SENT)
+                continue;
 
-        if (consecutiveFailures > 20) {
-            /*
-             * We're not transmitting anything anymore. Might as well avoid overloading the
-             * system in case it can magically fix itself. Ticker will start again on next _putc
-             * call, or on next connection.
-             */
-            stopReportTicker();
-            consecutiveFailures = 0;
+            if ((int32_t)(reportsDelivered - texts[i].lastReport) < 0)
+                finishText(i, ENOTCONN);
+            else
+                finishText(i, 0);
         }
+        textTask.post();
+
+        HIDServiceBase::onDisconnection(params);
+
+        staleMark = keyBuffer.begin();
+        previousMark = keyBuffer.begin();
+        latestMark = keyBuffer.end();
 
-        return ret;
+        /* Marks only need to be roughly on time */
+        if (offlineTTL)
+            TaskScheduler::instance().schedule(offlineTask, offlineTTL * 500, offlineTTL * 500,
+                                               offlineTTL * 100);
+    }
+
+    /**
+     * Configure the handling of keys typed while disconnected
+     *
+     * @param ttl_ms    Keys older than this are dropped on reconnection. 0 keeps them forever.
+     *                  The age of the keys is tracked with a granularity of ttl_ms / 2, so keys
+     *                  a little over 1.5 * ttl_ms old might be delivered.
+     * @param maxBytes  Maximum size of the buffer while disconnected. Calls to putc fail with
+     *                  ENOMEM beyond that.
+     */
+    void setOfflinePolicy(unsigned ttl_ms, unsigned maxBytes)
+    {
+        offlineTTL = ttl_ms;
+        offlineMaxBytes = maxBytes;
     }
 
     /**
      * Send an empty report, representing keyUp event
+     *
+     * @note This bypasses the key buffer.
      */
     ble_error_t keyUpCode(void)
     {
-        return send(emptyInputReportData);
+        return send(emptyReport);
     }
 
     /**
@@ -261,13 +324,114 @@ public:
      * @param modifier Optional modifiers (logical OR of enum MODIFIER_KEY)
      *
      * @returns BLE_ERROR_NONE on success, or an error code otherwise.
+     *
+     * @note This bypasses the key buffer.
      */
     ble_error_t keyDownCode(uint8_t key, uint8_t modifier)
     {
-        inputReportData[0] = modifier;
-        inputReportData[2] = keymap[key].usage;
+        static uint8_t keyDownReportData[KEYBOARD_INPUT_REPORT_SIZE];
+        uint8_t usage = keymap[key].usage;
+
+        memset(keyDownReportData, 0, sizeof(keyDownReportData));
+        keyDownReportData[0] = modifier;
+#if KEYBOARD_NKRO
+        if (usage < KEYBOARD_NKRO_USAGES)
+            keyDownReportData[KEY_REPORT_KEYS_OFFSET + usage / 8] = 1 << (usage % 8);
+#else
+        keyDownReportData[KEY_REPORT_KEYS_OFFSET] = usage;
+#endif
+
+        return send(keyDownReportData);
+    }
+
+    /**
+     * Press a key, and hold it until release() or releaseAll()
+     *
+     * Unlike pushKeyDown(), this bypasses the key buffer: the key is added to the held keys right
+     * away, and the next report carries it, ahead of the events still in the buffer. Pressing a
+     * key that is already held does nothing. Call this from the main loop, not from interrupt
+     * handlers.
+     *
+     * @param usage Key usage, as defined in USB HID Usage Tables (Keyboard/Keypad page).
+     *              Modifier keys (usages 0xe0 to 0xe7) are accepted as well.
+     *
+     * @returns 0 on success, or EINVAL if the usage can't be reported (0, or above
+     * KEY_REPORT_USAGE_MAX and not a modifier).
+     */
+    int press(uint8_t usage)
+    {
+        if (!isReportable(usage))
+            return EINVAL;
+
+        if (pressUsage(usage))
+            onHeldKeysChange();
 
-        return send(inputReportData);
+        return 0;
+    }
+
+    /**
+     * Release a key held by press() or pushKeyDown(). Releasing a key that isn't held does
+     * nothing.
+     *
+     * @returns 0 on success, or EINVAL if the usage can't be reported.
+     */
+    int release(uint8_t usage)
+    {
+        if (!isReportable(usage))
+            return EINVAL;
+
+        if (releaseUsage(usage))
+            onHeldKeysChange();
+
+        return 0;
+    }
+
+    /**
+     * Release all held keys and modifiers, including those held by pushKeyDown() and
+     * pushModifiers(). Events still in the buffer are left alone.
+     */
+    void releaseAll(void)
+    {
+        memset(heldKeys, 0, sizeof(heldKeys));
+        modifiers = 0;
+        stopRepeat();
+
+        onHeldKeysChange();
+    }
+
+    /**
+     * Repeat held keys on the device
+     *
+     * Hosts repeat a held key on their own, so this is only needed for hosts without autorepeat,
+     * or to impose a rate. The last key held with press() or pushKeyDown() repeats until it is
+     * released or another key is pressed: after delay_ms, and then every interval_ms, a report
+     * releases it and the next one presses it again. The release shares a report with any other
+     * pending change. Modifiers don't repeat.
+     *
+     * @param delay_ms      Time before the first repeat. 0 disables repeating, which is the
+     *                      default.
+     * @param interval_ms   Time between repeats. Each repeat takes two reports, so repeats
+     *                      faster than two report intervals are skipped.
+     *
+     * @note The host still applies its own autorepeat when the interval is longer than its delay.
+     */
+    void setTypematic(unsigned delay_ms, unsigned interval_ms)
+    {
+        stopRepeat();
+
+        repeatDelay = interval_ms ? delay_ms : 0;
+        repeatInterval = interval_ms;
+    }
+
+    /**
+     * @returns true if the key is held, by press(), pushKeyDown() or pushModifiers()
+     */
+    bool isPressed(uint8_t usage) const
+    {
+        if (usage >= KEY_USAGE_MODIFIER_MIN && usage <= KEY_USAGE_MODIFIER_MAX)
+            return modifiers & (1 << (usage - KEY_USAGE_MODIFIER_MIN));
+
+        return usage < KEY_USAGE_MODIFIER_MIN && (heldKeys[usage / 8] & (1 << (usage % 8)));
     }
 
     /**
@@ -275,111 +439,775 @@ public:
      *
      * @param c ASCII character to send
      *
-     * @returns 0 on success, or ENOMEM when the FIFO is full.
+     * @returns 0 on success, ENOMEM when the FIFO is full, or EINVAL if the character isn't in
+     * the keymap.
      */
     virtual int _putc(int c) {
-        if (keyBuffer.full()) {
-            return ENOMEM;
+        if (c < 0 || c >= KEYMAP_SIZE)
+            return EINVAL;
+
+        return pushEvent(KEY_EVENT_CHAR, c);
+    }
+
+    /**
+     * Push a key press followed by its release, bypassing the keymap.
+     *
+     * @param usage Key usage, as defined in USB HID Usage Tables (Keyboard/Keypad page)
+     *
+     * @returns 0 on success, or ENOMEM when the FIFO is full.
+     */
+    int pushKeyTap(uint8_t usage)
+    {
+        return pushEvent(KEY_EVENT_TAP, usage);
+    }
+
+    /**
+     * Push a key press. The key stays down until a matching pushKeyUp, or a call to release().
+     *
+     * Modifier keys (usages 0xe0 to 0xe7) are accepted as well.
+     *
+     * @returns 0 on success, or ENOMEM when the FIFO is full.
+     */
+    int pushKeyDown(uint8_t usage)
+    {
+        return pushEvent(KEY_EVENT_DOWN, usage);
+    }
+
+    /**
+     * Push a key release
+     *
+     * @returns 0 on success, or ENOMEM when the FIFO is full.
+     */
+    int pushKeyUp(uint8_t usage)
+    {
+        return pushEvent(KEY_EVENT_UP, usage);
+    }
+
+    /**
+     * Push a new set of modifiers, which are held until the next call to pushModifiers.
+     *
+     * @param modifiers Logical OR of enum MODIFIER_KEY, or any combination of the modifier bits
+     *                  of the report.
+     *
+     * @returns 0 on success, or ENOMEM when the FIFO is full.
+     */
+    int pushModifiers(uint8_t modifiers)
+    {
+        return pushEvent(KEY_EVENT_MODIFIERS, modifiers);
+    }
+
+    /**
+     * Push a key press, and release the key after some time
+     *
+     * @param duration_ms   Time to hold the key, rounded up to KEY_EVENT_DURATION_UNIT_MS.
+     *
+     * @returns 0 on success, or ENOMEM when the FIFO is full.
+     */
+    int pushKeyHold(uint8_t usage, unsigned duration_ms)
+    {
+        return pushEvent(KEY_EVENT_HOLD, usage, duration_ms);
+    }
+
+    /**
+     * Push a pause. Reports following it will be sent after the given time.
+     *
+     * @param duration_ms   Time to wait, rounded up to KEY_EVENT_DURATION_UNIT_MS.
+     *
+     * @returns 0 on success, or ENOMEM when the FIFO is full.
+     */
+    int pushPause(unsigned duration_ms)
+    {
+        return pushEvent(KEY_EVENT_PAUSE, 0, duration_ms);
+    }
+
+    /**
+     * Type a string, and get notified once the host received it
+     *
+     * The whole string is queued, or nothing at all. Other events queued before the string are
+     * delivered first.
+     *
+     * @param text      Characters to type
+     * @param callback  Called from the main loop once the last report of the text was sent. May
+     *                  be NULL.
+     * @param handle    If not NULL, receives the handle passed to the callback
+     *
+     * @returns 0 on success, ENOMEM when the buffer doesn't have room for the whole text or
+     * KEYBOARD_MAX_ASYNC_TEXTS are already in flight, or EINVAL if a character isn't in the keymap.
+     *
+     * @note The stack confirms notifications of all services together. If other services notify
+     * at the same time, the callback may be called slightly early.
+     */
+    int typeAsync(const char *text, keyboard_typed_callback_t callback, int *handle = NULL)
+    {
+        size_t length = strlen(text);
+        int slot = -1;
+
+        for (size_t i = 0; i < length; i++) {
+            if ((uint8_t)text[i] >= KEYMAP_SIZE)
+                return EINVAL;
         }
 
-        keyBuffer.push((unsigned char)c);
+        for (unsigned i = 0; i < KEYBOARD_MAX_ASYNC_TEXTS; i++) {
+            if (texts[i].state == KEYBOARD_TEXT_FREE) {
+                slot = i;
+                break;
+            }
+        }
 
-        if (!reportTickerIsActive)
-            startReportTicker();
+        /* Characters take one byte each, and the marker two */
+        unsigned room = keyBuffer.available();
+        if (!connected) {
+            unsigned size = keyBuffer.size();
+            unsigned offlineRoom = offlineMaxBytes > size ? offlineMaxBytes - size : 0;
+
+            if (offlineRoom < room)
+                room = offlineRoom;
+        }
+
+        if (slot < 0 || length + 2 > room)
+            return ENOMEM;
+
+        for (size_t i = 0; i < length; i++)
+            keyBuffer.push(KEY_EVENT_CHAR, text[i]);
+
+        nextTextHandle = (nextTextHandle + 1) & 0x7fffffff;
+        texts[slot].handle = nextTextHandle;
+        texts[slot].callback = callback;
+        texts[slot].state = KEYBOARD_TEXT_QUEUED;
+        texts[slot].status = 0;
+
+        pushEvent(KEY_EVENT_MARKER, slot);
+
+        if (handle)
+            *handle = nextTextHandle;
 
         return 0;
     }
 
+    /**
+     * Play a macro
+     *
+     * The macro starts once the events queued before it have been consumed, and is read from
+     * where it is stored while it plays. Keys typed by the macro share reports the same way as
+     * typed text, and keys it holds with KEY_MACRO_DOWN are part of the held keys (see press()).
+     *
+     * @param macro Records ending with KEY_MACRO_END. It must stay valid until the macro ends,
+     *              which is easiest with a const array in flash.
+     *
+     * @returns 0 on success, EBUSY if a macro is already queued or playing, or ENOMEM when the
+     * FIFO is full.
+     *
+     * @note A macro interrupted by a disconnection resumes on the next connection, like the rest
+     * of the buffer.
+     */
+    int playMacro(const uint8_t *macro)
+    {
+        int err;
+
+        if (pendingMacro || macroCursor)
+            return EBUSY;
+
+        pendingMacro = macro;
+
+        err = pushEvent(KEY_EVENT_MACRO);
+        if (err)
+            pendingMacro = NULL;
+
+        return err;
+    }
+
+    /**
+     * @returns true if a macro is queued or playing
+     */
+    bool isPlayingMacro(void) const
+    {
+        return pendingMacro || macroCursor;
+    }
+
+    /**
+     * Get notified when the key buffer fills up and drains
+     *
+     * @param low           highCallback can't be called again until the buffer holds at most
+     *                      this many bytes, at which point lowCallback is called.
+     * @param high          highCallback is called when a push leaves at least this many bytes in
+     *                      the buffer
+     * @param lowCallback   Called from the report task. May be NULL.
+     * @param highCallback  Called from the producer that crossed the watermark. May be NULL.
+     */
+    void setWatermarks(unsigned low, unsigned high, keyboard_watermark_callback_t lowCallback,
+                       keyboard_watermark_callback_t highCallback)
+    {
+        lowWatermark = low;
+        highWatermark = high;
+        lowWatermarkCallback = lowCallback;
+        highWatermarkCallback = highCallback;
+        aboveHighWatermark = false;
+    }
+
     uint8_t lockStatus() {
         // TODO: implement numlock/capslock/scrolllock
         return 0;
     }
 
     /**
-     * Pop a key from the internal FIFO, and attempt to send it over BLE
+     * Update the report with the next key events, and attempt to send it over BLE
+     *
+     * In case of error, keep the report and retry on next tick. When the stack is out of buffers,
+     * HIDServiceBase stops the ticker and restarts it once a report has been sent.
+     */
+    virtual void sendCallback(void) {
+        if (sendReleaseAll())
+            return;
+
+        if (!reportIsPending) {
+            updateReport();
+            checkLowWatermark();
+        }
+
+        if (!reportIsPending) {
+            /* Idle when there is nothing more to send */
+            if (!isSomethingPending())
+                stopReportTicker();
+            return;
+        }
+
+        if (sendReport(inputReportData)) {
+            failedReports++;
+            return;
+        }
+
+        reportIsPending = false;
+
+        /* The host saw the repeated key go up: press it again in the next report */
+        if (repeatReleased) {
+            repeatReleased = false;
+            updateReportData();
+        }
+
+        if (!isSomethingPending())
+            stopReportTicker();
+    }
+
+    unsigned long failedReports;
+
+protected:
+    virtual int _getc() {
+        return 0;
+    }
+
+    /**
+     * Account for delivered reports, and complete the texts they carried
+     */
+    virtual void onDataSent(unsigned count)
+    {
+        HIDServiceBase::onDataSent(count);
+
+        for (unsigned i = 0; i < KEYBOARD_MAX_ASYNC_TEXTS; i++) {
+            if (texts[i].state == KEYBOARD_TEXT_SENT) {
+                textTask.post();
+                break;
+            }
+        }
+    }
+
+    /**
+     * Mark a text as done. Its callback is called by the next completeTexts().
+     */
+    void finishText(unsigned slot, int status)
+    {
+        texts[slot].state = KEYBOARD_TEXT_DONE;
+        texts[slot].status = status;
+    }
+
+    /**
+     * Call the callbacks of completed texts. Runs from the main loop.
+     */
+    void completeTexts(void)
+    {
+        for (unsigned i = 0; i < KEYBOARD_MAX_ASYNC_TEXTS; i++) {
+            keyboard_text_t &text = texts[i];
+
+            if (text.state == KEYBOARD_TEXT_SENT
+                    && (int32_t)(reportsDelivered - text.lastReport) >= 0)
+                finishText(i, 0);
+
+            if (text.state != KEYBOARD_TEXT_DONE)
+                continue;
+
+            /* Free the slot first, so that the callback can queue another text */
+            keyboard_typed_callback_t callback = text.callback;
+            text.state = KEYBOARD_TEXT_FREE;
+
+            if (callback)
+                callback(text.handle, text.status);
+        }
+    }
+
+    /**
+     * Drop keys typed offline that are older than offlineTTL, and cancel the texts they belonged
+     * to.
+     */
+    void dropStaleKeys(void)
+    {
+        key_event_t event;
+
+        while (keyBuffer.begin() != staleMark && keyBuffer.pop(event)) {
+            if (event.type == KEY_EVENT_MARKER)
+                finishText(event.data, ETIMEDOUT);
+            else if (event.type == KEY_EVENT_MACRO)
+                pendingMacro = NULL;
+        }
+
+        textTask.post();
+    }
+
+    void checkLowWatermark(void)
+    {
+        if (!aboveHighWatermark || keyBuffer.size() > lowWatermark)
+            return;
+
+        aboveHighWatermark = false;
+        if (lowWatermarkCallback)
+            lowWatermarkCallback();
+    }
+
+    /**
+     * Encode an event into the key buffer, and wake the report ticker up.
+     *
+     * @returns 0 on success, or ENOMEM when the FIFO is full.
+     */
+    int pushEvent(uint8_t type, uint8_t data = 0, unsigned duration_ms = 0)
+    {
+        unsigned duration = (duration_ms + KEY_EVENT_DURATION_UNIT_MS - 1)
+                          / KEY_EVENT_DURATION_UNIT_MS;
+
+        if (duration > 0xff)
+            duration = 0xff;
+
+        if (!connected && keyBuffer.size() >= offlineMaxBytes)
+            return ENOMEM;
+
+        if (!keyBuffer.push(type, data, duration))
+            return ENOMEM;
+
+        if (!aboveHighWatermark && keyBuffer.size() >= highWatermark) {
+            aboveHighWatermark = true;
+            if (highWatermarkCallback)
+                highWatermarkCallback();
+        }
+
+        if (connected && !reportTickerIsActive)
+            startReportTicker();
+
+        return 0;
+    }
+
+    bool isSomethingPending(void)
+    {
+        return reportIsPending || typedKey || remainingDelay || macroCursor || !keyBuffer.empty();
+    }
+
+    /**
+     * Called every offlineTTL / 2 while disconnected. Records are only ever added at the end of
+     * the buffer, so remembering its end at each tick is enough to know which keys are older
+     * than offlineTTL: those preceding the end recorded two ticks ago.
+     */
+    void onOfflineTick(void)
+    {
+        staleMark = previousMark;
+        previousMark = latestMark;
+        latestMark = keyBuffer.end();
+    }
+
+    /**
+     * Get the key pressed and released by an event
+     *
+     * @param event     Decoded event
+     * @param modifier  Filled with the modifiers required by the key
+     *
+     * @returns the usage, or 0 if the event doesn't type a key.
+     */
+    static uint8_t typedUsage(const key_event_t &event, uint8_t &modifier)
+    {
+        modifier = 0;
+
+        switch (event.type) {
+        case KEY_EVENT_CHAR:
+            modifier = keymap[event.data].modifier;
+            return keymap[event.data].usage;
+        case KEY_EVENT_TAP:
+        case KEY_EVENT_HOLD:
+            return event.data;
+        default:
+            return 0;
+        }
+    }
+
+    /**
+     * Consume key events until the report changes, or a delay is started.
      *
      * keyUp reports should theoretically be sent after every keyDown, but we optimize the
      * throughput by only sending one when strictly necessary:
      * - when we need to repeat the same key
+     * - when the next event isn't a typed key
      * - when there is no more key to report
-     *
-     * In case of error, put the key event back in the buffer, and retry on next tick.
      */
-    virtual void sendCallback(void) {
-        ble_error_t ret;
-        uint8_t c;
-        static uint8_t previousKey = 0;
+    void updateReport(void)
+    {
+        key_event_t event;
+        uint8_t modifier;
 
-        if (keyBuffer.isSomethingPending() && !keyBuffer.isKeyUpPending()) {
-            bool hasData = keyBuffer.getPending(c);
+        if (remainingDelay) {
+            uint32_t elapsed = reportTickerInterval / 1000;
+
+            if (remainingDelay > elapsed) {
+                remainingDelay -= elapsed;
+                return;
+            }
+            remainingDelay = 0;
+        }
+
+        if (typedKey) {
+            uint8_t previousKey = typedKey;
+
+            typedKey = 0;
+            typedModifiers = 0;
 
             /*
-             * If something is pending and is not a keyUp, getPending *must* return something. The
-             * following is only a sanity check.
+             * A different key can replace the previous one in the same report. Nothing needs to
+             * be sent if the key is also held.
              */
-            MBED_ASSERT(hasData);
+            if (updateReportData() && (!nextEvent(event, false) || typedUsage(event, modifier) == 0
+                                       || typedUsage(event, modifier) == previousKey))
+                return;
+        }
 
-            if (!hasData)
+        while (nextEvent(event, true)) {
+            if (applyEvent(event))
                 return;
+        }
+    }
 
-            if (previousKey == c) {
-                /*
-                 * When the same key needs to be sent twice, we need to interleave a keyUp report,
-                 * or else the OS won't be able to differentiate them.
-                 * Push the key back into the buffer, and continue to keyUpCode.
-                 */
-                keyBuffer.setPending(c);
-            } else {
-                ret = keyDownCode(c, keymap[c].modifier);
-                if (ret) {
-                    keyBuffer.setPending(c);
-                    failedReports++;
-                } else {
-                    previousKey = c;
-                }
+    /**
+     * Decode the next event, from the macro being played or from the buffer
+     *
+     * @param remove    Consume the event
+     *
+     * @returns false if there is no event
+     */
+    bool nextEvent(key_event_t &event, bool remove)
+    {
+        if (macroCursor) {
+            unsigned length = decodeKeyEvent(macroCursor, event);
 
-                return;
+            if (length) {
+                if (remove)
+                    macroCursor += length;
+                return true;
             }
+
+            macroCursor = NULL;
         }
 
-        ret = keyUpCode();
-        if (ret) {
-            keyBuffer.setKeyUpPending();
-            failedReports++;
-        } else {
-            keyBuffer.clearKeyUpPending();
-            previousKey = 0;
+        return remove ? keyBuffer.pop(event) : keyBuffer.peek(event);
+    }
 
-            /* Idle when there is nothing more to send */
-            if (!keyBuffer.isSomethingPending())
-                stopReportTicker();
+    /**
+     * Apply a key event to the report
+     *
+     * @returns true if the report was modified or a delay was started
+     */
+    bool applyEvent(const key_event_t &event)
+    {
+        uint8_t modifier;
+        uint8_t usage;
+
+        switch (event.type) {
+        case KEY_EVENT_CHAR:
+        case KEY_EVENT_TAP:
+        case KEY_EVENT_HOLD:
+            usage = typedUsage(event, modifier);
+            if (!isReportable(usage) || isPressed(usage))
+                return false;
+
+            typedKey = usage;
+            typedModifiers = modifier;
+            remainingDelay = event.duration * KEY_EVENT_DURATION_UNIT_MS;
+            updateReportData();
+            return true;
+
+        case KEY_EVENT_DOWN:
+            return pressUsage(event.data) && updateReportData();
+
+        case KEY_EVENT_UP:
+            return releaseUsage(event.data) && updateReportData();
+
+        case KEY_EVENT_MODIFIERS:
+            modifiers = event.data;
+            return updateReportData();
+
+        case KEY_EVENT_PAUSE:
+            remainingDelay = event.duration * KEY_EVENT_DURATION_UNIT_MS;
+            return true;
+
+        case KEY_EVENT_MACRO:
+            /* The following events come from the macro, until its end. Macros don't nest. */
+            if (!macroCursor) {
+                macroCursor = pendingMacro;
+                pendingMacro = NULL;
+            }
+            return false;
+
+        case KEY_EVENT_MARKER:
+            /* Only typeAsync() queues markers. Stray 0xfe bytes of a macro are ignored. */
+            if (macroCursor || event.data >= KEYBOARD_MAX_ASYNC_TEXTS)
+                return false;
+
+            /* All keys of the text are in reports that were queued, or that is about to be */
+            texts[event.data].state = KEYBOARD_TEXT_SENT;
+            texts[event.data].lastReport = reportsQueued + (reportIsPending ? 1 : 0);
+            textTask.post();
+            return false;
+
+        default:
+            return false;
         }
     }
 
     /**
-     * Restart report ticker if it was disabled, after too many consecutive failures.
+     * @returns true if the usage is a key or modifier that fits in the report
+     */
+    static bool isReportable(uint8_t usage)
+    {
+        if (usage >= KEY_USAGE_MODIFIER_MIN)
+            return usage <= KEY_USAGE_MODIFIER_MAX;
+        return usage != 0 && usage <= KEY_REPORT_USAGE_MAX;
+    }
+
+    /**
+     * Add a key to the held keys
      *
-     * This is called by the BLE stack.
+     * @returns true if it wasn't held
+     */
+    bool pressUsage(uint8_t usage)
+    {
+        uint8_t *bits = &heldKeys[usage / 8];
+        uint8_t mask = 1 << (usage % 8);
+
+        if (!isReportable(usage))
+            return false;
+
+        if (usage >= KEY_USAGE_MODIFIER_MIN) {
+            bits = &modifiers;
+            mask = 1 << (usage - KEY_USAGE_MODIFIER_MIN);
+        }
+
+        if (*bits & mask)
+            return false;
+
+        *bits |= mask;
+
+        if (repeatDelay && usage < KEY_USAGE_MODIFIER_MIN)
+            startRepeat(usage);
+
+        return true;
+    }
+
+    /**
+     * Remove a key from the held keys
      *
-     * @param count	Number of reports (notifications) sent
+     * @returns true if it was held
      */
-    virtual void onDataSent(unsigned count)
+    bool releaseUsage(uint8_t usage)
+    {
+        uint8_t *bits = &heldKeys[usage / 8];
+        uint8_t mask = 1 << (usage % 8);
+
+        if (!isReportable(usage))
+            return false;
+
+        if (usage >= KEY_USAGE_MODIFIER_MIN) {
+            bits = &modifiers;
+            mask = 1 << (usage - KEY_USAGE_MODIFIER_MIN);
+        }
+
+        if (!(*bits & mask))
+            return false;
+
+        *bits &= ~mask;
+
+        if (usage == repeatKey)
+            stopRepeat();
+
+        return true;
+    }
+
+    void startRepeat(uint8_t usage)
+    {
+        repeatKey = usage;
+        repeatReleased = false;
+
+        TaskScheduler::instance().schedule(repeatTask, repeatDelay * 1000, repeatInterval * 1000,
+                                           repeatInterval * 125);
+    }
+
+    void stopRepeat(void)
     {
-        if (!reportTickerIsActive && keyBuffer.isSomethingPending())
+        TaskScheduler::instance().cancel(repeatTask);
+        repeatKey = 0;
+        repeatReleased = false;
+    }
+
+    /**
+     * Called by repeatTask: release the repeated key in the next report
+     */
+    void onRepeat(void)
+    {
+        /* The previous repeat hasn't been sent yet */
+        if (!repeatKey || repeatReleased || !connected)
+            return;
+
+        repeatReleased = true;
+
+        /* Leaving the key out may not change the report, when too many keys are held */
+        if (!updateReportData()) {
+            repeatReleased = false;
+            return;
+        }
+
+        if (!reportTickerIsActive)
             startReportTicker();
     }
 
-    unsigned long failedReports;
+    /**
+     * Rebuild the report from the held keys and the typed key
+     *
+     * @returns true if the report changed, in which case it is pending
+     */
+    bool updateReportData(void)
+    {
+        uint8_t report[KEYBOARD_INPUT_REPORT_SIZE];
+        uint8_t typed = typedKey;
 
-protected:
-    virtual int _getc() {
-        return 0;
+        memset(report, 0, sizeof(report));
+        report[0] = modifiers | typedModifiers;
+
+        if (typed >= KEY_USAGE_MODIFIER_MIN && typed <= KEY_USAGE_MODIFIER_MAX) {
+            report[0] |= 1 << (typed - KEY_USAGE_MODIFIER_MIN);
+            typed = 0;
+        }
+
+#if KEYBOARD_NKRO
+        uint8_t *keys = &report[KEY_REPORT_KEYS_OFFSET];
+
+        memcpy(keys, heldKeys, KEYBOARD_NKRO_USAGES / 8);
+        if (repeatReleased)
+            keys[repeatKey / 8] &= ~(1 << (repeatKey % 8));
+        if (typed)
+            keys[typed / 8] |= 1 << (typed % 8);
+#else
+        uint8_t *keys = &report[KEY_REPORT_KEYS_OFFSET];
+        unsigned count = 0;
+
+        if (typed)
+            keys[count++] = typed;
+
+        for (unsigned usage = 0; usage < KEY_USAGE_MODIFIER_MIN; usage++) {
+            /* Skip whole bytes of released keys */
+            if (!heldKeys[usage / 8]) {
+                usage |= 7;
+                continue;
+            }
+
+            if (!(heldKeys[usage / 8] & (1 << (usage % 8))) || usage == typed
+                    || (repeatReleased && usage == repeatKey))
+                continue;
+
+            if (count == KEY_REPORT_SLOTS) {
+                memset(keys, KEY_USAGE_ROLLOVER, KEY_REPORT_SLOTS);
+                break;
+            }
+
+            keys[count++] = usage;
+        }
+#endif
+
+        if (!memcmp(report, inputReportData, sizeof(report)))
+            return false;
+
+        memcpy(inputReportData, report, sizeof(report));
+        reportIsPending = true;
+        return true;
+    }
+
+    /**
+     * Called by press(), release() and releaseAll() after changing the held keys
+     */
+    void onHeldKeysChange(void)
+    {
+        if (updateReportData() && connected && !reportTickerIsActive)
+            startReportTicker();
     }
 
 protected:
     KeyBuffer keyBuffer;
 
+    /// Modifiers held by press(), KEY_EVENT_MODIFIERS and KEY_EVENT_DOWN events
+    uint8_t modifiers;
+
+    /// Bitmap of the other keys held by press() and KEY_EVENT_DOWN events
+    uint8_t heldKeys[KEY_USAGE_MODIFIER_MIN / 8];
+
+    /// Key pressed by the last KEY_EVENT_CHAR, TAP or HOLD, which still needs to be released
+    uint8_t typedKey;
+    uint8_t typedModifiers;
+
+    /// Time left before consuming the next event, in ms
+    uint16_t remainingDelay;
+
+    /// "keys pressed" report, last built by updateReportData()
+    uint8_t inputReportData[KEYBOARD_INPUT_REPORT_SIZE];
+
+    /// inputReportData was modified and hasn't been sent successfully yet
+    bool reportIsPending;
+
+    unsigned offlineTTL;
+    unsigned offlineMaxBytes;
+
+    /// Positions in keyBuffer recorded by onOfflineTick
+    ScheduledTask offlineTask;
+    volatile unsigned staleMark;
+    volatile unsigned previousMark;
+    volatile unsigned latestMark;
+
+    /// Texts queued with typeAsync(). Their slot is the operand of their KEY_EVENT_MARKER.
+    keyboard_text_t texts[KEYBOARD_MAX_ASYNC_TEXTS];
+    int nextTextHandle;
+    /// Calls the callbacks of texts, from the main loop
+    ScheduledTask textTask;
+
+    unsigned lowWatermark;
+    unsigned highWatermark;
+    keyboard_watermark_callback_t lowWatermarkCallback;
+    keyboard_watermark_callback_t highWatermarkCallback;
+    bool aboveHighWatermark;
+
+    /// Macro passed to playMacro(), waiting for its KEY_EVENT_MACRO to be consumed
+    const uint8_t *volatile pendingMacro;
+    /// Next record of the macro being played
+    const uint8_t *macroCursor;
+
+    /// Typematic settings, in ms. repeatDelay is 0 when the device doesn't repeat keys.
+    unsigned repeatDelay;
+    unsigned repeatInterval;
+    /// Key repeated by repeatTask, 0 if none
+    uint8_t repeatKey;
+    /// repeatKey is left out of the report, until that report is sent
+    bool repeatReleased;
+    ScheduledTask repeatTask;
+
     //GattCharacteristic boot_keyboard_input_report;
     //GattCharacteristic boot_keyboard_output_report;
 };
 
+#endif /* !HID_KEYBOARD_SERVICE_H_ */
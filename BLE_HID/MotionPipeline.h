@@ -0,0 +1,216 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HID_MOTION_PIPELINE_H_
+#define HID_MOTION_PIPELINE_H_
+
+#include "mbed.h"
+
+#define MOTION_AXES 3
+
+/**
+ * Parameters of the motion pipeline. Gains are fixed-point numbers with 8 fractional bits (Q8):
+ * 256 means 1.0.
+ */
+typedef struct {
+    /// Weight of a new sample in the low-pass filter, Q8. 256 disables filtering.
+    uint16_t lowPassAlpha;
+    /// Filtered values within [-deadZone, deadZone] are considered as zero, in sensor units.
+    uint16_t deadZone;
+    /// Acceleration curve: out = v * linearGain + v * |v| * quadraticGain. Both Q8.
+    uint16_t linearGain;
+    /// Computed in 64 bits, so any gain is safe: the output saturates at outputMax.
+    uint16_t quadraticGain;
+    /// Integrate the curve output into a speed (mouse), instead of using it directly (joystick)
+    bool integrate;
+    /**
+     * Drift removal of the integrated speed: at each sample, the speed loses 1/2^leakShift of its
+     * value, or 1/2^restLeakShift when the input is within the dead zone.
+     */
+    uint8_t leakShift;
+    uint8_t restLeakShift;
+    /// The output is divided by 2^outputShift, and clamped to [-outputMax, outputMax]
+    uint8_t outputShift;
+    int8_t outputMax;
+} motion_config_t;
+
+/**
+ * @class MotionPipeline
+ *
+ * Turn raw sensor samples (e.g. accelerometer) into speeds for MouseService or JoystickService,
+ * without any floating-point operation:
+ *
+ *   sample -> offset -> low-pass -> dead zone -> acceleration curve -> [integration] -> output
+ *
+ * Samples are pushed at the sensor rate, and the output is read at the report rate.
+ *
+ * @code
+ * static const motion_config_t config = { 64, 8, 256, 2, true, 10, 4, 6, 32 };
+ * MotionPipeline pipeline(config);
+ *
+ * void on_sample(const int16_t sample[3])
+ * {
+ *     pipeline.push(sample);
+ * }
+ *
+ * void on_report(void)
+ * {
+ *     int8_t out[3];
+ *     pipeline.read(out);
+ *     mouse.setSpeed(out[0], out[1], 0);
+ * }
+ * @endcode
+ */
+class MotionPipeline {
+public:
+    MotionPipeline(const motion_config_t &_config) :
+        config(_config)
+    {
+        reset();
+    }
+
+    void reset(void)
+    {
+        for (unsigned i = 0; i < MOTION_AXES; i++) {
+            offset[i] = 0;
+            filtered[i] = 0;
+            speed[i] = 0;
+            output[i] = 0;
+        }
+    }
+
+    /**
+     * Use the current filtered values as origin. Call this while the device is at rest.
+     */
+    void calibrate(void)
+    {
+        for (unsigned i = 0; i < MOTION_AXES; i++) {
+            offset[i] += shiftTowardZero(filtered[i], 8);
+            filtered[i] = 0;
+            speed[i] = 0;
+        }
+    }
+
+    /**
+     * Feed a new sample, one value per axis, in sensor units.
+     */
+    void push(const int16_t sample[MOTION_AXES])
+    {
+        for (unsigned i = 0; i < MOTION_AXES; i++)
+            output[i] = processAxis(i, sample[i]);
+    }
+
+    /**
+     * Get the latest output
+     */
+    void read(int8_t out[MOTION_AXES]) const
+    {
+        for (unsigned i = 0; i < MOTION_AXES; i++)
+            out[i] = output[i];
+    }
+
+protected:
+    /**
+     * Arithmetic shift right, rounding toward zero. Plain shifts round toward minus infinity,
+     * which would leave negative values stuck at -1.
+     */
+    static int32_t shiftTowardZero(int32_t v, unsigned shift)
+    {
+        return v >= 0 ? v >> shift : -((-v) >> shift);
+    }
+
+    /**
+     * Arithmetic shift right, rounding away from zero. Steps of the low-pass filter use it, so that
+     * the filter reaches its input exactly, from above as well as from below.
+     */
+    static int32_t shiftAwayFromZero(int32_t v, unsigned shift)
+    {
+        int32_t round = (1 << shift) - 1;
+
+        return v >= 0 ? (v + round) >> shift : -((-v + round) >> shift);
+    }
+
+    static int32_t clamp(int32_t v, int32_t max)
+    {
+        if (v > max)
+            return max;
+        if (v < -max)
+            return -max;
+        return v;
+    }
+
+    static int32_t clamp64(int64_t v, int32_t max)
+    {
+        if (v > max)
+            return max;
+        if (v < -max)
+            return -max;
+        return v;
+    }
+
+    int8_t processAxis(unsigned i, int16_t sample)
+    {
+        int32_t x = sample - offset[i];
+
+        /* Low-pass, with 8 fractional bits kept in the state */
+        filtered[i] += shiftAwayFromZero((x * 256 - filtered[i]) * config.lowPassAlpha, 8);
+
+        int32_t v = shiftTowardZero(filtered[i], 8);
+        bool atRest = false;
+
+        if (v > config.deadZone) {
+            v -= config.deadZone;
+        } else if (v < -config.deadZone) {
+            v += config.deadZone;
+        } else {
+            v = 0;
+            atRest = true;
+        }
+
+        int32_t max = (int32_t)config.outputMax << (8 + config.outputShift);
+
+        /*
+         * Acceleration curve, Q8. v * |v| * quadraticGain doesn't fit in 32 bits. The shift is
+         * applied to the magnitude, so that both directions round the same way.
+         */
+        int64_t magnitude = v >= 0 ? v : -v;
+        int64_t quadratic = (magnitude * magnitude * config.quadraticGain) >> 8;
+        if (v < 0)
+            quadratic = -quadratic;
+        int32_t curve = clamp64(quadratic + (int64_t)v * config.linearGain, max);
+
+        if (!config.integrate)
+            return shiftTowardZero(curve, 8 + config.outputShift);
+
+        speed[i] = clamp(speed[i] + curve, max);
+        speed[i] -= shiftTowardZero(speed[i], atRest ? config.restLeakShift : config.leakShift);
+
+        return shiftTowardZero(speed[i], 8 + config.outputShift);
+    }
+
+protected:
+    motion_config_t config;
+
+    int16_t offset[MOTION_AXES];
+    /// Low-pass filter state, Q8
+    int32_t filtered[MOTION_AXES];
+    /// Integrated speed, Q8
+    int32_t speed[MOTION_AXES];
+
+    volatile int8_t output[MOTION_AXES];
+};
+
+#endif /* !HID_MOTION_PIPELINE_H_ */
@@ -0,0 +1,254 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HID_MOTION_RESAMPLER_H_
+#define HID_MOTION_RESAMPLER_H_
+
+#include "mbed.h"
+
+#define RESAMPLER_AXES 3
+
+/**
+ * Longest interval between two samples that is integrated. Beyond this, the input is considered
+ * stalled, and the last sample isn't extended any further.
+ */
+#ifndef RESAMPLER_MAX_GAP_US
+#define RESAMPLER_MAX_GAP_US 1000000
+#endif
+
+enum MotionResamplerMode
+{
+    /**
+     * Samples are speeds, in units per period. Reports carry the distance covered since the
+     * previous one (mouse).
+     */
+    RESAMPLER_RELATIVE,
+    /**
+     * Samples are positions. Reports carry the average position since the previous one
+     * (joystick).
+     */
+    RESAMPLER_ABSOLUTE,
+};
+
+/**
+ * @class MotionResampler
+ *
+ * Convert samples taken at the sensor's pace into values for reports sent at the service's pace.
+ *
+ * Sensor samples and reports are driven by independent clocks, and neither is in phase with the
+ * connection events. Simply sending the latest sample in each report duplicates or skips samples,
+ * which makes the pointer judder. Instead, samples are timestamped, and the resampler integrates
+ * the piecewise-linear signal they describe over the actual interval between two reports. The
+ * sub-unit remainder of relative moves is carried over to the next report.
+ *
+ * Samples are pushed from the main loop, and values are taken from the report ticker. While
+ * nothing is taken, relative moves saturate at 127 units of backlog, and absolute positions are
+ * averaged over the last RESAMPLER_MAX_GAP_US at most.
+ */
+class MotionResampler
+{
+public:
+    /**
+     * @param _mode     Type of values
+     * @param periodMs  Unit of time of relative speeds. Use the reportTickerDelay of the service,
+     *                  so that a speed of 1 means one unit per report at the nominal rate.
+     */
+    MotionResampler(MotionResamplerMode _mode, uint16_t periodMs) :
+        mode(_mode),
+        period(periodMs * 1000)
+    {
+        for (unsigned i = 0; i < RESAMPLER_AXES; i++)
+            value[i] = 0;
+
+        reset(us_ticker_read());
+    }
+
+    /**
+     * Drop what has been integrated so far, as if the last sample had been taken now. Used when
+     * reports resume after a pause (e.g. a reconnection).
+     */
+    void reset(uint32_t timestamp)
+    {
+        for (unsigned i = 0; i < RESAMPLER_AXES; i++) {
+            area[i] = 0;
+            average[i] = value[i];
+        }
+
+        sampleTime = timestamp;
+        integratedUntil = timestamp;
+        takenAt = timestamp;
+    }
+
+    /**
+     * Add a sample
+     *
+     * @param sample    One value per axis
+     * @param timestamp Time of the sample, in us (e.g. us_ticker_read())
+     */
+    void push(const int8_t sample[RESAMPLER_AXES], uint32_t timestamp)
+    {
+        __disable_irq();
+
+        int32_t elapsed = timestamp - sampleTime;
+        int32_t span = timestamp - integratedUntil;
+
+        if (elapsed > RESAMPLER_MAX_GAP_US) {
+            /* The input was stalled: hold the previous value for a bounded time only */
+            integrate(sampleTime + RESAMPLER_MAX_GAP_US);
+            integratedUntil = timestamp;
+        } else if (span > 0) {
+            /* Trapezoid between the previous sample, interpolated at integratedUntil, and this one */
+            int32_t offset = elapsed - span;
+
+            for (unsigned i = 0; i < RESAMPLER_AXES; i++) {
+                int32_t start = value[i] + (sample[i] - value[i]) * offset / elapsed;
+                area[i] += (start + sample[i]) * span / 2;
+            }
+
+            integratedUntil = timestamp;
+        }
+
+        for (unsigned i = 0; i < RESAMPLER_AXES; i++)
+            value[i] = sample[i];
+        sampleTime = timestamp;
+
+        /* Reports may not be taken for a long time (disconnected, suspended) */
+        bound();
+
+        __enable_irq();
+    }
+
+    /**
+     * Compute the values of a report
+     *
+     * @param out       One value per axis
+     * @param timestamp Time of the report, in us
+     */
+    void take(int8_t out[RESAMPLER_AXES], uint32_t timestamp)
+    {
+        int32_t elapsed = timestamp - takenAt;
+
+        /* After the last sample, hold its value */
+        if ((int32_t)(timestamp - sampleTime) <= RESAMPLER_MAX_GAP_US)
+            integrate(timestamp);
+        else
+            integrate(sampleTime + RESAMPLER_MAX_GAP_US);
+        integratedUntil = timestamp;
+        takenAt = timestamp;
+
+        for (unsigned i = 0; i < RESAMPLER_AXES; i++) {
+            if (mode == RESAMPLER_ABSOLUTE) {
+                if (elapsed > 0)
+                    average[i] = clamp(area[i] / elapsed);
+                area[i] = 0;
+                out[i] = average[i];
+            } else {
+                int32_t units = clamp(area[i] / (int32_t)period);
+
+                area[i] -= units * (int32_t)period;
+
+                /* Don't let the remainder build up when reports are slower than the input */
+                clampBacklog(i);
+
+                out[i] = units;
+            }
+        }
+    }
+
+    /**
+     * @return true if next reports will all be zero, until a new sample is pushed
+     */
+    bool idle(void) const
+    {
+        for (unsigned i = 0; i < RESAMPLER_AXES; i++) {
+            if (value[i] != 0)
+                return false;
+            if (mode == RESAMPLER_ABSOLUTE && (area[i] != 0 || average[i] != 0))
+                return false;
+            if (mode == RESAMPLER_RELATIVE && (area[i] >= (int32_t)period || area[i] <= -(int32_t)period))
+                return false;
+        }
+
+        return true;
+    }
+
+protected:
+    static int8_t clamp(int32_t v)
+    {
+        if (v > 127)
+            return 127;
+        if (v < -127)
+            return -127;
+        return v;
+    }
+
+    void clampBacklog(unsigned i)
+    {
+        int32_t backlog = 127 * (int32_t)period;
+
+        if (area[i] > backlog)
+            area[i] = backlog;
+        if (area[i] < -backlog)
+            area[i] = -backlog;
+    }
+
+    /**
+     * Keep the integrals from overflowing when samples keep coming but nothing is taken
+     */
+    void bound(void)
+    {
+        if (mode == RESAMPLER_RELATIVE) {
+            for (unsigned i = 0; i < RESAMPLER_AXES; i++)
+                clampBacklog(i);
+        } else if ((int32_t)(integratedUntil - takenAt) > RESAMPLER_MAX_GAP_US) {
+            /* Only average the last RESAMPLER_MAX_GAP_US */
+            for (unsigned i = 0; i < RESAMPLER_AXES; i++)
+                area[i] = 0;
+            takenAt = integratedUntil;
+        }
+    }
+
+    /**
+     * Extend the last sample until a given time
+     */
+    void integrate(uint32_t until)
+    {
+        int32_t span = until - integratedUntil;
+
+        if (span <= 0)
+            return;
+
+        for (unsigned i = 0; i < RESAMPLER_AXES; i++)
+            area[i] += value[i] * span;
+    }
+
+protected:
+    MotionResamplerMode mode;
+    uint32_t period;
+
+    /// Last sample
+    int8_t value[RESAMPLER_AXES];
+    uint32_t sampleTime;
+
+    /// Integral of the signal since the last report, in units * us
+    int32_t area[RESAMPLER_AXES];
+    uint32_t integratedUntil;
+
+    int8_t average[RESAMPLER_AXES];
+    uint32_t takenAt;
+};
+
+#endif /* !HID_MOTION_RESAMPLER_H_ */
@@ -14,15 +14,14 @@
  * limitations under the License.
  */
 
+#ifndef HID_MOUSE_SERVICE_H_
+#define HID_MOUSE_SERVICE_H_
+
 #include "mbed.h"
 
-#include "HIDServiceBase.h"
-
-enum ButtonState
-{
-    BUTTON_UP,
-    BUTTON_DOWN
-};
+#include "HIDService.h"
+#include "MotionResampler.h"
+#include "PointerState.h"
 
 enum MouseButton
 {
@@ -32,40 +31,29 @@ enum MouseButton
 };
 
 /**
- * Report descriptor for a standard 3 buttons + wheel mouse with relative X/Y
- * moves
+ * What to do with moves made while disconnected
  */
-report_map_t MOUSE_REPORT_MAP = {
-    USAGE_PAGE(1),      0x01,         // Generic Desktop
-    USAGE(1),           0x02,         // Mouse
-    COLLECTION(1),      0x01,         // Application
-    USAGE(1),           0x01,         //  Pointer
-    COLLECTION(1),      0x00,         //  Physical
-    USAGE_PAGE(1),      0x09,         //   Buttons
-    USAGE_MINIMUM(1),   0x01,
-    USAGE_MAXIMUM(1),   0x03,
-    LOGICAL_MINIMUM(1), 0x00,
-    LOGICAL_MAXIMUM(1), 0x01,
-    REPORT_COUNT(1),    0x03,         //   3 bits (Buttons)
-    REPORT_SIZE(1),     0x01,
-    INPUT(1),           0x02,         //   Data, Variable, Absolute
-    REPORT_COUNT(1),    0x01,         //   5 bits (Padding)
-    REPORT_SIZE(1),     0x05,
-    INPUT(1),           0x01,         //   Constant
-    USAGE_PAGE(1),      0x01,         //   Generic Desktop
-    USAGE(1),           0x30,         //   X
-    USAGE(1),           0x31,         //   Y
-    USAGE(1),           0x38,         //   Wheel
-    LOGICAL_MINIMUM(1), 0x81,         //   -127
-    LOGICAL_MAXIMUM(1), 0x7f,         //   127
-    REPORT_SIZE(1),     0x08,         //   Three bytes
-    REPORT_COUNT(1),    0x03,
-    INPUT(1),           0x06,         //   Data, Variable, Relative
-    END_COLLECTION(0),
-    END_COLLECTION(0),
+enum MouseOfflinePolicy
+{
+    /// Forget about them. Only the current speed is reported on reconnection.
+    MOUSE_OFFLINE_DROP,
+    /// Integrate them, and send the net move on reconnection
+    MOUSE_OFFLINE_COLLAPSE,
 };
 
-uint8_t report[] = { 0, 0, 0, 0 };
+/**
+ * Bound of the net move sent on reconnection, on each axis. The default spans four reports.
+ */
+#ifndef MOUSE_OFFLINE_MAX_MOTION
+#define MOUSE_OFFLINE_MAX_MOTION 508
+#endif
+
+/**
+ * Report descriptor for a standard 3 buttons + wheel mouse with relative X/Y
+ * moves
+ */
+extern report_map_t MOUSE_REPORT_MAP;
+extern const uint16_t MOUSE_REPORT_MAP_LENGTH;
 
 /**
  * @class MouseService
@@ -77,7 +65,7 @@ uint8_t report[] = { 0, 0, 0, 0 };
  * BLE ble;
  * MouseService mouse(ble);
  *
- * Timeout timeout;
+ * ScheduledTask stopTask;
  *
  * void stop_mouse_move(void)
  * {
@@ -93,43 +81,86 @@ uint8_t report[] = { 0, 0, 0, 0 };
  *      mouse.setButton(MOUSE_BUTTON_LEFT, MOUSE_DOWN);
  *      mouse.setSpeed(1, 0, 0);
  *
- *      timeout.attach(stop_mouse_move, 0.2);
+ *      stopTask.attach(stop_mouse_move);
+ *      TaskScheduler::instance().schedule(stopTask, 200000);
  * }
  * @endcode
  */
-class MouseService: public HIDServiceBase
+class MouseService: public HIDService<MouseService>
 {
 public:
     MouseService(BLE &_ble) :
-        HIDServiceBase(_ble,
-                       MOUSE_REPORT_MAP, sizeof(MOUSE_REPORT_MAP),
-                       inputReport          = report,
-                       outputReport         = NULL,
-                       featureReport        = NULL,
-                       inputReportLength    = sizeof(inputReport),
-                       outputReportLength   = 0,
-                       featureReportLength  = 0,
-                       reportTickerDelay    = 20),
-        buttonsState (0),
+        HIDService<MouseService>(_ble,
+                                 MOUSE_REPORT_MAP, MOUSE_REPORT_MAP_LENGTH,
+                                 inputReport          = emptyReport,
+                                 outputReport         = NULL,
+                                 featureReport        = NULL,
+                                 inputReportLength    = sizeof(report),
+                                 outputReportLength   = 0,
+                                 featureReportLength  = 0,
+                                 reportTickerDelay    = 20),
+        offlinePolicy (MOUSE_OFFLINE_DROP),
+        resampler (NULL),
         failedReports (0)
     {
-        speed[0] = 0;
-        speed[1] = 0;
-        speed[2] = 0;
+        offlineMotion[0] = 0;
+        offlineMotion[1] = 0;
+        offlineMotion[2] = 0;
 
-        startReportTicker();
+        memset(report, 0, sizeof(report));
     }
 
     virtual void onConnection(const Gap::ConnectionCallbackParams_t *params)
     {
         HIDServiceBase::onConnection(params);
+
+        if (offlinePolicy == MOUSE_OFFLINE_COLLAPSE)
+            accumulateOfflineMotion();
+        offlineTimer.stop();
+
+        if (resampler)
+            resampler->reset(us_ticker_read());
+
         startReportTicker();
     }
 
     virtual void onDisconnection(const Gap::DisconnectionCallbackParams_t *params)
     {
-        stopReportTicker();
         HIDServiceBase::onDisconnection(params);
+
+        offlineMotion[0] = 0;
+        offlineMotion[1] = 0;
+        offlineMotion[2] = 0;
+
+        offlineTimer.reset();
+        offlineTimer.start();
+    }
+
+    virtual void onExitSuspend(void)
+    {
+        if (resampler)
+            resampler->reset(us_ticker_read());
+    }
+
+    /**
+     * Choose what to do with moves made while disconnected. In any case, a report releasing all
+     * buttons is sent on reconnection.
+     */
+    void setOfflinePolicy(MouseOfflinePolicy policy)
+    {
+        offlinePolicy = policy;
+    }
+
+    /**
+     * Resample speeds to the actual report times. Without a resampler, each report carries the
+     * latest speed, regardless of when it was set.
+     *
+     * @param _resampler A RESAMPLER_RELATIVE resampler, whose period is reportTickerDelay. NULL
+     *                   to disable resampling.
+     */
+    void setResampler(MotionResampler *_resampler)
+    {
+        resampler = _resampler;
     }
 
     /**
@@ -150,11 +181,17 @@ public:
      */
     int setSpeed(int8_t x, int8_t y, int8_t wheel)
     {
-        speed[0] = x;
-        speed[1] = y;
-        speed[2] = wheel;
+        const int8_t speed[3] = { x, y, wheel };
 
-        startReportTicker();
+        if (!connected && offlinePolicy == MOUSE_OFFLINE_COLLAPSE)
+            accumulateOfflineMotion();
+
+        state.setAxes(speed, 3);
+
+        if (resampler)
+            resampler->push(speed, us_ticker_read());
+
+        wakeReportTicker();
 
         return 0;
     }
@@ -164,14 +201,11 @@ public:
      *
      * @returns A status code
      */
-    int setButton(MouseButton button, ButtonState state)
+    int setButton(MouseButton button, ButtonState buttonState)
     {
-        if (state == BUTTON_UP)
-            buttonsState &= ~(button);
-        else
-            buttonsState |= button;
+        state.setButtons(button, buttonState == BUTTON_DOWN);
 
-        startReportTicker();
+        wakeReportTicker();
 
         return 0;
     }
@@ -180,40 +214,119 @@ public:
      * Called by the report ticker
      */
     virtual void sendCallback(void) {
-        uint8_t buttons = buttonsState & 0x7;
+        pointer_state_t snapshot;
+        int8_t current[3];
+        int8_t motion[3];
+        int8_t offlineStep[3];
 
         if (!connected)
             return;
 
+        if (sendReleaseAll())
+            return;
+
+        state.read(snapshot);
+        uint8_t buttons = snapshot.buttons & 0x7;
+
+        if (resampler) {
+            resampler->take(current, us_ticker_read());
+        } else {
+            current[0] = snapshot.axis[0];
+            current[1] = snapshot.axis[1];
+            current[2] = snapshot.axis[2];
+        }
+
+        /* Spread the net offline move over several reports, on top of the current speed */
+        for (unsigned i = 0; i < 3; i++) {
+            int step = offlineMotion[i];
+            if (step > 127)
+                step = 127;
+            if (step < -127)
+                step = -127;
+
+            int value = current[i] + step;
+            if (value > 127)
+                value = 127;
+            if (value < -127)
+                value = -127;
+
+            offlineStep[i] = value - current[i];
+            motion[i] = value;
+        }
+
         bool can_sleep = (report[0] == 0
                        && report[1] == 0
                        && report[2] == 0
                        && report[3] == 0
                        && report[0] == buttons
-                       && report[1] == speed[0]
-                       && report[2] == speed[1]
-                       && report[3] == speed[2]);
+                       && report[1] == (uint8_t)motion[0]
+                       && report[2] == (uint8_t)motion[1]
+                       && report[3] == (uint8_t)motion[2]
+                       && (!resampler || resampler->idle()));
 
         if (can_sleep) {
-            /* TODO: find out why there always is two more calls to sendCallback after this
-             * stopReportTicker(). */
             stopReportTicker();
             return;
         }
 
         report[0] = buttons;
-        report[1] = speed[0];
-        report[2] = speed[1];
-        report[3] = speed[2];
+        report[1] = motion[0];
+        report[2] = motion[1];
+        report[3] = motion[2];
 
-        if (send(report))
+        if (sendReport(report)) {
             failedReports++;
+            return;
+        }
+
+        offlineMotion[0] -= offlineStep[0];
+        offlineMotion[1] -= offlineStep[1];
+        offlineMotion[2] -= offlineStep[2];
     }
 
 protected:
-    uint8_t buttonsState;
-    uint8_t speed[3];
+    /**
+     * Integrate the current speed over the time elapsed since the last call, as if reports had
+     * been sent at the nominal rate.
+     */
+    void accumulateOfflineMotion(void)
+    {
+        int32_t reports = offlineTimer.read_ms() / reportTickerDelay;
+        pointer_state_t snapshot;
+
+        offlineTimer.reset();
+        state.read(snapshot);
+
+        if (reports > MOUSE_OFFLINE_MAX_MOTION)
+            reports = MOUSE_OFFLINE_MAX_MOTION;
+
+        for (unsigned i = 0; i < 3; i++) {
+            int32_t m = offlineMotion[i] + snapshot.axis[i] * reports;
+
+            if (m > MOUSE_OFFLINE_MAX_MOTION)
+                m = MOUSE_OFFLINE_MAX_MOTION;
+            if (m < -MOUSE_OFFLINE_MAX_MOTION)
+                m = -MOUSE_OFFLINE_MAX_MOTION;
+
+            offlineMotion[i] = m;
+        }
+    }
+
+protected:
+    /// Buttons and speed (X, Y, wheel)
+    PointerState state;
+
+    MouseOfflinePolicy offlinePolicy;
+    Timer offlineTimer;
+    int16_t offlineMotion[3];
+
+    MotionResampler *resampler;
+
+    /// Buttons, X, Y, wheel
+    uint8_t report[4];
 
 public:
     uint32_t failedReports;
 };
+
+#endif /* !HID_MOUSE_SERVICE_H_ */
@@ -0,0 +1,130 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HID_POINTER_STATE_H_
+#define HID_POINTER_STATE_H_
+
+#include "mbed.h"
+
+/**
+ * State of a button, as passed to the setButton() method of pointing devices
+ */
+enum ButtonState
+{
+    BUTTON_UP,
+    BUTTON_DOWN
+};
+
+/// Axes of a pointer state: X, Y, and two more (wheel, or Z and Rx)
+#define POINTER_AXES 4
+
+/**
+ * Buttons and axes of a pointing device, as set by the application
+ */
+typedef struct {
+    uint8_t buttons;
+    int8_t axis[POINTER_AXES];
+} pointer_state_t;
+
+/**
+ * @class PointerState
+ *
+ * State of a mouse or joystick, shared between the application, which may update it from
+ * interrupt handlers, and the report task.
+ *
+ * Updates are protected by a sequence lock. Writers increment the sequence number before and after
+ * modifying the state, so it is odd while an update is in progress. The report task copies the
+ * state and checks that the sequence number is even and didn't change meanwhile, or starts over:
+ * a report never mixes the X of one update with the Y of the next one, and the reader never
+ * disables interrupts.
+ *
+ * Writers are serialized by disabling interrupts for the few instructions of an update, so that
+ * a button handler can't preempt a speed update halfway through. Readers must not run in an
+ * interrupt that could preempt a writer, or they would spin forever: the report task runs from
+ * the main loop (see TaskScheduler::dispatch()).
+ */
+class PointerState
+{
+public:
+    PointerState() :
+        sequence(0)
+    {
+        memset(&state, 0, sizeof(state));
+    }
+
+    /**
+     * Set the first count axes, atomically
+     */
+    void setAxes(const int8_t *axes, unsigned count)
+    {
+        beginWrite();
+        for (unsigned i = 0; i < count && i < POINTER_AXES; i++)
+            state.axis[i] = axes[i];
+        endWrite();
+    }
+
+    /**
+     * Press or release buttons
+     *
+     * @param mask  Buttons to change
+     * @param down  New state of these buttons
+     */
+    void setButtons(uint8_t mask, bool down)
+    {
+        beginWrite();
+        if (down)
+            state.buttons |= mask;
+        else
+            state.buttons &= ~mask;
+        endWrite();
+    }
+
+    /**
+     * Take a consistent copy of the state
+     */
+    void read(pointer_state_t &snapshot) const
+    {
+        uint32_t before;
+
+        do {
+            before = sequence;
+            __DMB();
+            snapshot = state;
+            __DMB();
+        } while ((before & 1) || before != sequence);
+    }
+
+protected:
+    void beginWrite(void)
+    {
+        __disable_irq();
+        sequence++;
+        __DMB();
+    }
+
+    void endWrite(void)
+    {
+        __DMB();
+        sequence++;
+        __enable_irq();
+    }
+
+protected:
+    volatile uint32_t sequence;
+    pointer_state_t state;
+};
+
+#endif /* !HID_POINTER_STATE_H_ */
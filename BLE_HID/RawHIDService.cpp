@@ -0,0 +1,43 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "RawHIDService.h"
+
+report_map_t RAWHID_REPORT_MAP = {
+    USAGE_PAGE(2),      0x00, 0xff,   // Vendor Defined 0xff00
+    USAGE(1),           0x01,
+    COLLECTION(1),      0x01,         // Application
+    LOGICAL_MINIMUM(1), 0x00,
+    LOGICAL_MAXIMUM(2), 0xff, 0x00,
+    REPORT_SIZE(1),     0x08,
+    USAGE(1),           0x02,         //  Packets to the host
+    REPORT_COUNT(1),    RAWHID_REPORT_SIZE,
+    INPUT(1),           0x02,
+    USAGE(1),           0x03,         //  Packets and acknowledgements from the host
+    REPORT_COUNT(1),    RAWHID_REPORT_SIZE,
+    OUTPUT(1),          0x02,
+    USAGE(1),           0x04,         //  Protocol version, window, payload size
+    REPORT_COUNT(1),    0x03,
+    FEATURE(1),         0x02,
+    END_COLLECTION(0),
+};
+
+const uint16_t RAWHID_REPORT_MAP_LENGTH = sizeof(RAWHID_REPORT_MAP);
+
+const uint8_t rawFeatureReportData[RAWHID_FEATURE_REPORT_SIZE] = {
+    RAWHID_PROTOCOL_VERSION, RAWHID_WINDOW, RAWHID_PAYLOAD_SIZE
+};
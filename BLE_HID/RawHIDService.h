@@ -0,0 +1,503 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HID_RAW_HID_SERVICE_H_
+#define HID_RAW_HID_SERVICE_H_
+
+#include <errno.h>
+
+#include "mbed.h"
+
+#include "HIDService.h"
+
+/**
+ * Size of input and output reports, fixed by the report map. Each report must fit in a single
+ * notification: the default works with any ATT MTU. Up to MAX_HID_REPORT_SIZE, for throughput, on
+ * stacks that negotiate a larger MTU; transfers then wait for the MTU exchange (see setAttMtu).
+ */
+#ifndef RAWHID_REPORT_SIZE
+#define RAWHID_REPORT_SIZE      20
+#endif
+
+/** Number of input reports sent ahead of the host's acknowledgement */
+#ifndef RAWHID_WINDOW
+#define RAWHID_WINDOW           4
+#endif
+
+/** Without acknowledgement for that many report periods, unacknowledged packets are sent again */
+#ifndef RAWHID_ACK_TIMEOUT_TICKS
+#define RAWHID_ACK_TIMEOUT_TICKS 50
+#endif
+
+#define RAWHID_PROTOCOL_VERSION 1
+
+/// Each packet starts with a sequence number and a control byte
+#define RAWHID_HEADER_SIZE      2
+#define RAWHID_PAYLOAD_SIZE     (RAWHID_REPORT_SIZE - RAWHID_HEADER_SIZE)
+
+/// Control byte: length of the payload, and flags
+#define RAWHID_LENGTH_MASK      0x3f
+#define RAWHID_ACK              0x40
+#define RAWHID_END              0x80
+
+/**
+ * Report descriptor for a vendor-defined device with opaque input, output and feature reports
+ */
+extern report_map_t RAWHID_REPORT_MAP;
+extern const uint16_t RAWHID_REPORT_MAP_LENGTH;
+
+/// Protocol version, window, payload size
+#define RAWHID_FEATURE_REPORT_SIZE 3
+extern const uint8_t rawFeatureReportData[RAWHID_FEATURE_REPORT_SIZE];
+
+/**
+ * Called from the main loop when a transfer to the host completes (status 0), or is aborted
+ * (negative errno)
+ */
+typedef void (*rawhid_sent_callback_t)(int status);
+
+/**
+ * Called from the main loop when a transfer from the host is complete. The data lives in the
+ * receive buffer, and is overwritten by the next transfer once the callback returns. Transfers
+ * arriving before that are dropped.
+ */
+typedef void (*rawhid_received_callback_t)(const uint8_t *data, size_t length);
+
+/**
+ * @class RawHIDService
+ * @brief Vendor-defined data channel over HID-over-Gatt
+ *
+ * Move blobs of arbitrary size to and from the host, over the same bonded link as other HID
+ * services, without a separate GATT service. Hosts access it through their raw HID interface
+ * (hidraw, HID API, ...).
+ *
+ * Blobs are split into packets of RAWHID_PAYLOAD_SIZE bytes. Each packet starts with a sequence
+ * number and a control byte: payload length, RAWHID_END on the last packet of a blob, and
+ * RAWHID_ACK for acknowledgements.
+ *
+ * - Device to host: packets are sent as input reports. Up to RAWHID_WINDOW of them are in flight;
+ *   the host acknowledges them by writing an output report with RAWHID_ACK and the sequence number
+ *   of the last packet received in order. When it acknowledges the same packet again, or when
+ *   acknowledgements stop coming, packets are sent again from the first unacknowledged one.
+ * - Host to device: packets are written as output reports. GATT writes are already acknowledged,
+ *   so packets are simply checked for order and appended to the receive buffer.
+ *
+ * The feature report tells the host the protocol version, window and payload size.
+ *
+ * Both callbacks are called from a task of the TaskScheduler, so they may start new transfers.
+ *
+ * @code
+ * BLE ble;
+ * RawHIDService raw(ble);
+ * uint8_t config[1024];
+ *
+ * void on_config(const uint8_t *data, size_t length)
+ * {
+ *     // Answer with the diagnostic log
+ *     raw.write(log, log_length, NULL);
+ * }
+ *
+ * raw.setReceiveBuffer(config, sizeof(config), on_config);
+ * @endcode
+ */
+class RawHIDService: public HIDService<RawHIDService,
+                                       HID_WITH_OUTPUT_REPORT | HID_WITH_FEATURE_REPORT>
+{
+public:
+    RawHIDService(BLE &_ble) :
+        HIDService<RawHIDService, HID_WITH_OUTPUT_REPORT | HID_WITH_FEATURE_REPORT>(_ble,
+                RAWHID_REPORT_MAP, RAWHID_REPORT_MAP_LENGTH,
+                inputReport          = emptyReport,
+                outputReport         = emptyReport,
+                featureReport        = rawFeatureReportData,
+                inputReportLength    = sizeof(rawInputReportData),
+                outputReportLength   = RAWHID_REPORT_SIZE,
+                featureReportLength  = sizeof(rawFeatureReportData),
+                reportTickerDelay    = 8),
+        txData(NULL),
+        txLength(0),
+        txPackets(0),
+        txBase(0),
+        txNext(0),
+        txBaseSeq(0),
+        txIdle(0),
+        txRewound(false),
+        txCallback(NULL),
+        txDone(false),
+        txDoneCallback(NULL),
+        txDoneStatus(0),
+        ackSeq(0),
+        ackPending(false),
+        rxBuffer(NULL),
+        rxSize(0),
+        rxLength(0),
+        rxSeq(0),
+        rxCallback(NULL),
+        rxReady(false),
+        rxReadyLength(0),
+        retransmissions(0),
+        rxErrors(0),
+        failedReports(0)
+    {
+        callbackTask.attach(this, &RawHIDService::runCallbacks);
+    }
+
+    virtual void onConnection(const Gap::ConnectionCallbackParams_t *params)
+    {
+        HIDServiceBase::onConnection(params);
+
+        /* Sequence numbers start over with each connection, and so does a pending transfer */
+        txBase = 0;
+        txNext = 0;
+        txBaseSeq = 0;
+        txIdle = 0;
+        txRewound = false;
+
+        /* Output reports are written from the BLE stack's context */
+        __disable_irq();
+        ackPending = false;
+        rxLength = 0;
+        rxSeq = 0;
+        __enable_irq();
+
+        if (txData)
+            startReportTicker();
+    }
+
+    /**
+     * Send a blob to the host
+     *
+     * @param data      Data to send. It must stay valid until the callback is called.
+     * @param length    Size of data, in bytes
+     * @param callback  Called once the host acknowledged the whole blob. May be NULL.
+     *
+     * @return 0 on success, or EBUSY if a transfer is already in progress
+     *
+     * @note If reports don't fit in the ATT MTU of the current connection, the transfer waits for
+     * an MTU exchange.
+     */
+    int write(const uint8_t *data, size_t length, rawhid_sent_callback_t callback)
+    {
+        if (txData || txDone)
+            return EBUSY;
+
+        txLength = length;
+        txPackets = length ? (length + RAWHID_PAYLOAD_SIZE - 1) / RAWHID_PAYLOAD_SIZE : 1;
+        txBase = 0;
+        txNext = 0;
+        txIdle = 0;
+        txRewound = false;
+        txCallback = callback;
+        txData = data;
+
+        if (connected)
+            startReportTicker();
+
+        return 0;
+    }
+
+    /**
+     * Abort the current transfer to the host. Its callback is called with ECANCELED.
+     */
+    void cancelWrite(void)
+    {
+        if (!txData)
+            return;
+
+        completeWrite(-ECANCELED);
+    }
+
+    bool isWriting(void) const
+    {
+        return txData != NULL;
+    }
+
+    /**
+     * Set the buffer receiving blobs from the host
+     *
+     * @param buffer    Receive buffer. Blobs larger than this are dropped.
+     * @param size      Size of the buffer
+     * @param callback  Called for each complete blob
+     */
+    void setReceiveBuffer(uint8_t *buffer, size_t size, rawhid_received_callback_t callback)
+    {
+        __disable_irq();
+        rxBuffer = buffer;
+        rxSize = size;
+        rxLength = 0;
+        rxCallback = callback;
+        __enable_irq();
+    }
+
+    /**
+     * Called by the report ticker: send packets until the window is full
+     */
+    virtual void sendCallback(void) {
+        if (!connected)
+            return;
+
+        /* Nothing to send, or waiting for a larger MTU */
+        if (!txData || RAWHID_REPORT_SIZE > getMaxReportLength()) {
+            stopReportTicker();
+            return;
+        }
+
+        if (txNext - txBase >= RAWHID_WINDOW || txNext == txPackets) {
+            /* Waiting for acknowledgements */
+            if (++txIdle >= RAWHID_ACK_TIMEOUT_TICKS) {
+                txIdle = 0;
+                txNext = txBase;
+                retransmissions++;
+            }
+            return;
+        }
+
+        while (txNext - txBase < RAWHID_WINDOW && txNext < txPackets) {
+            size_t offset = txNext * RAWHID_PAYLOAD_SIZE;
+            size_t length = txLength - offset;
+            uint8_t control;
+
+            if (length > RAWHID_PAYLOAD_SIZE)
+                length = RAWHID_PAYLOAD_SIZE;
+
+            control = length;
+            if (txNext + 1 == txPackets)
+                control |= RAWHID_END;
+
+            memset(rawInputReportData, 0, sizeof(rawInputReportData));
+            rawInputReportData[0] = txBaseSeq + (txNext - txBase);
+            rawInputReportData[1] = control;
+            if (length)
+                memcpy(&rawInputReportData[RAWHID_HEADER_SIZE], txData + offset, length);
+
+            /* When the stack is out of buffers, the ticker waits for onDataSent */
+            if (sendReport(rawInputReportData)) {
+                failedReports++;
+                return;
+            }
+
+            txNext++;
+        }
+    }
+
+protected:
+    virtual void onAttMtuChanged(uint16_t mtu)
+    {
+        if (txData && connected)
+            startReportTicker();
+    }
+
+    virtual void onOutputReport(const uint8_t *data, uint16_t length)
+    {
+        if (length < RAWHID_HEADER_SIZE)
+            return;
+
+        uint8_t seq = data[0];
+        uint8_t control = data[1];
+
+        if (control & RAWHID_ACK) {
+            /*
+             * The window is shared with sendCallback, so it is only moved from the main loop.
+             * Acknowledgements are cumulative: the latest one is enough.
+             */
+            ackSeq = seq;
+            ackPending = true;
+            callbackTask.post();
+        } else {
+            /* The receive state is only touched here, and with interrupts disabled elsewhere */
+            onPacket(seq, control, &data[RAWHID_HEADER_SIZE], length - RAWHID_HEADER_SIZE);
+        }
+    }
+
+    /**
+     * The host received all packets up to seq. Called from the main loop.
+     */
+    void onAck(uint8_t seq)
+    {
+        if (!txData)
+            return;
+
+        /* Number of packets acknowledged, relative to the first unacknowledged one */
+        uint8_t acked = seq - txBaseSeq + 1;
+
+        if (acked == 0) {
+            /*
+             * The host got a packet out of order: txBase was lost. Send again from it without
+             * waiting for the timeout, but only once, as each packet in flight repeats the news.
+             */
+            if (!txRewound && txNext != txBase) {
+                txNext = txBase;
+                txIdle = 0;
+                txRewound = true;
+                retransmissions++;
+            }
+            return;
+        }
+
+        if (acked > txNext - txBase)
+            return;
+
+        txBase += acked;
+        txBaseSeq += acked;
+        txIdle = 0;
+        txRewound = false;
+
+        if (txBase == txPackets)
+            completeWrite(0);
+    }
+
+    void onPacket(uint8_t seq, uint8_t control, const uint8_t *payload, uint16_t available)
+    {
+        uint16_t length = control & RAWHID_LENGTH_MASK;
+
+        if (length > available)
+            length = available;
+
+        if (seq != rxSeq) {
+            /*
+             * Lost or duplicated packet: drop the rest of the blob, up to its RAWHID_END. The host
+             * has to start over.
+             */
+            rxErrors++;
+            rxSeq = seq + 1;
+            rxLength = (control & RAWHID_END) ? 0 : rxSize + 1;
+            return;
+        }
+
+        rxSeq++;
+
+        if (!rxBuffer)
+            return;
+
+        if (rxLength > rxSize) {
+            /* Dropping the rest of a broken blob */
+        } else if (rxReady || rxLength + length > rxSize) {
+            /* Too large, or the previous blob hasn't been handed over yet */
+            rxErrors++;
+            rxLength = rxSize + 1;
+        } else {
+            memcpy(&rxBuffer[rxLength], payload, length);
+            rxLength += length;
+        }
+
+        if (control & RAWHID_END) {
+            if (rxLength <= rxSize) {
+                rxReadyLength = rxLength;
+                rxReady = true;
+                callbackTask.post();
+            }
+            rxLength = 0;
+        }
+    }
+
+    /**
+     * End the transfer to the host. Its callback is called from the main loop.
+     */
+    void completeWrite(int status)
+    {
+        txDoneCallback = txCallback;
+        txDoneStatus = status;
+        txDone = true;
+
+        txData = NULL;
+        txCallback = NULL;
+        txBaseSeq += txNext - txBase;
+        txBase = 0;
+        txNext = 0;
+
+        callbackTask.post();
+    }
+
+    /**
+     * Called by callbackTask: apply the acknowledgement recorded by onOutputReport, which runs in
+     * the context of the BLE stack, and run the callbacks of completed transfers
+     */
+    void runCallbacks(void)
+    {
+        if (ackPending) {
+            __disable_irq();
+            uint8_t seq = ackSeq;
+            ackPending = false;
+            __enable_irq();
+
+            onAck(seq);
+        }
+
+        if (txDone) {
+            rawhid_sent_callback_t callback = txDoneCallback;
+
+            /* Let the callback start another transfer */
+            txDone = false;
+            if (callback)
+                callback(txDoneStatus);
+        }
+
+        if (rxReady) {
+            /* The buffer is only reused once the callback returns */
+            if (rxCallback)
+                rxCallback(rxBuffer, rxReadyLength);
+            rxReady = false;
+        }
+    }
+
+protected:
+    /// Transfer to the host. Packets [txBase, txNext) are in flight.
+    const uint8_t *txData;
+    size_t txLength;
+    size_t txPackets;
+    size_t txBase;
+    size_t txNext;
+    /// Sequence number of packet txBase
+    uint8_t txBaseSeq;
+    /// Report periods spent waiting for an acknowledgement
+    unsigned txIdle;
+    /// Packets were sent again after a duplicate acknowledgement, and none was acknowledged since
+    bool txRewound;
+    rawhid_sent_callback_t txCallback;
+
+    /// Completed transfer to the host, whose callback is due
+    volatile bool txDone;
+    rawhid_sent_callback_t txDoneCallback;
+    int txDoneStatus;
+
+    /// Latest acknowledgement from the host, not applied yet
+    uint8_t ackSeq;
+    volatile bool ackPending;
+
+    /// Transfer from the host
+    uint8_t *rxBuffer;
+    size_t rxSize;
+    size_t rxLength;
+    /// Next expected sequence number
+    uint8_t rxSeq;
+    rawhid_received_callback_t rxCallback;
+
+    /// A blob of rxReadyLength bytes is in the buffer, and its callback is due
+    volatile bool rxReady;
+    size_t rxReadyLength;
+
+    /// Runs the callbacks from the main loop
+    ScheduledTask callbackTask;
+
+    uint8_t rawInputReportData[RAWHID_REPORT_SIZE];
+
+public:
+    uint32_t retransmissions;
+    uint32_t rxErrors;
+    uint32_t failedReports;
+};
+
+#endif /* !HID_RAW_HID_SERVICE_H_ */
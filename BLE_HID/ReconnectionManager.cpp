@@ -0,0 +1,143 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "ReconnectionManager.h"
+
+ReconnectionManager::ReconnectionManager(BLE &_ble, const advertising_schedule_t *_schedule) :
+    ble(_ble),
+    phase(PHASE_IDLE),
+    connected(false),
+    hasPeer(false)
+{
+    static const advertising_schedule_t defaultSchedule = {
+        HID_ADV_DIRECTED_DURATION_MS,
+        HID_ADV_FAST_INTERVAL_MS,
+        HID_ADV_FAST_DURATION_MS,
+        HID_ADV_SLOW_INTERVAL_MS,
+    };
+
+    schedule = _schedule ? *_schedule : defaultSchedule;
+
+    phaseTask.attach(this, &ReconnectionManager::nextPhase);
+    linkTask.attach(this, &ReconnectionManager::onLinkChange);
+
+    ble.gap().onConnection(this, &ReconnectionManager::onConnection);
+    ble.gap().onDisconnection(this, &ReconnectionManager::onDisconnection);
+}
+
+void ReconnectionManager::start(void)
+{
+    phase = PHASE_DIRECTED;
+    startPhase();
+}
+
+void ReconnectionManager::stop(void)
+{
+    TaskScheduler::instance().cancel(phaseTask);
+    phase = PHASE_IDLE;
+    ble.gap().stopAdvertising();
+}
+
+void ReconnectionManager::startPhase(void)
+{
+    ble_error_t err;
+
+    ble.gap().stopAdvertising();
+
+    switch (phase) {
+    case PHASE_DIRECTED:
+        if (!hasPeer || !schedule.directedDuration) {
+            nextPhase();
+            return;
+        }
+
+        /* Not all stacks support directed advertising. Fall back to fast advertising. */
+        ble.gap().setAdvertisingType(GapAdvertisingParams::ADV_CONNECTABLE_DIRECTED);
+        err = ble.gap().startAdvertising();
+        if (err) {
+            nextPhase();
+            return;
+        }
+
+        TaskScheduler::instance().schedule(phaseTask, schedule.directedDuration * 1000);
+        break;
+
+    case PHASE_FAST:
+        if (!schedule.fastDuration) {
+            nextPhase();
+            return;
+        }
+
+        ble.gap().setAdvertisingType(GapAdvertisingParams::ADV_CONNECTABLE_UNDIRECTED);
+        ble.gap().setAdvertisingInterval(schedule.fastInterval);
+        ble.gap().startAdvertising();
+
+        TaskScheduler::instance().schedule(phaseTask, schedule.fastDuration * 1000);
+        break;
+
+    case PHASE_SLOW:
+        ble.gap().setAdvertisingType(GapAdvertisingParams::ADV_CONNECTABLE_UNDIRECTED);
+        ble.gap().setAdvertisingInterval(schedule.slowInterval);
+        ble.gap().startAdvertising();
+        break;
+
+    default:
+        break;
+    }
+}
+
+void ReconnectionManager::nextPhase(void)
+{
+    switch (phase) {
+    case PHASE_DIRECTED:
+        phase = PHASE_FAST;
+        break;
+    case PHASE_FAST:
+        phase = PHASE_SLOW;
+        break;
+    default:
+        return;
+    }
+
+    startPhase();
+}
+
+void ReconnectionManager::onConnection(const Gap::ConnectionCallbackParams_t *params)
+{
+    /* Advertising is reconfigured from the main loop, not from the stack's context */
+    connected = true;
+    linkTask.post();
+}
+
+void ReconnectionManager::onDisconnection(const Gap::DisconnectionCallbackParams_t *params)
+{
+    connected = false;
+    linkTask.post();
+}
+
+void ReconnectionManager::onLinkChange(void)
+{
+    /* Events may have piled up since linkTask was posted: only the latest state matters */
+    hasPeer = true;
+
+    if (connected) {
+        TaskScheduler::instance().cancel(phaseTask);
+        phase = PHASE_IDLE;
+    } else {
+        start();
+    }
+}
@@ -0,0 +1,152 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HID_RECONNECTION_MANAGER_H_
+#define HID_RECONNECTION_MANAGER_H_
+
+#include "mbed.h"
+
+#include "ble/BLE.h"
+#include "TaskScheduler.h"
+
+/*
+ * Default advertising schedule, following the recommendations of HOGP (section 5.1.2):
+ * - High duty cycle directed advertising to the last host, which the controller stops after
+ *   1.28s.
+ * - 30 seconds of fast undirected advertising, with an interval of 20ms to 30ms.
+ * - Reduced power advertising afterwards, with an interval of 1s to 2.5s.
+ */
+#ifndef HID_ADV_DIRECTED_DURATION_MS
+#define HID_ADV_DIRECTED_DURATION_MS    1280
+#endif
+
+#ifndef HID_ADV_FAST_INTERVAL_MS
+#define HID_ADV_FAST_INTERVAL_MS        30
+#endif
+
+#ifndef HID_ADV_FAST_DURATION_MS
+#define HID_ADV_FAST_DURATION_MS        30000
+#endif
+
+#ifndef HID_ADV_SLOW_INTERVAL_MS
+#define HID_ADV_SLOW_INTERVAL_MS        1000
+#endif
+
+typedef struct {
+    /// Duration of the directed advertising phase. 0 disables it.
+    uint16_t directedDuration;
+    /// Interval and duration of the fast advertising phase. A duration of 0 disables it.
+    uint16_t fastInterval;
+    uint16_t fastDuration;
+    /// Interval of the slow advertising phase, which lasts until a host connects.
+    uint16_t slowInterval;
+} advertising_schedule_t;
+
+/**
+ * @class ReconnectionManager
+ *
+ * Drive advertising after startup and after each disconnection, in phases of decreasing duty
+ * cycle. Hosts that are already bonded reconnect as fast as possible, and devices that wait
+ * for a long time don't drain their battery.
+ *
+ * Directed advertising is only attempted after a first connection. BLE_API doesn't let us choose
+ * its target, so it is up to the stack to direct it to the last host. When the stack refuses to
+ * start it, the manager goes straight to the fast phase.
+ *
+ * @code
+ * BLE ble;
+ * ReconnectionManager reconnection(ble);
+ *
+ * int main()
+ * {
+ *     ...
+ *     // Start advertising. After a disconnection, advertising restarts automatically.
+ *     reconnection.start();
+ * }
+ * @endcode
+ */
+class ReconnectionManager {
+public:
+    enum Phase {
+        PHASE_IDLE,
+        PHASE_DIRECTED,
+        PHASE_FAST,
+        PHASE_SLOW,
+    };
+
+    /**
+     * Constructor
+     *
+     * @param _ble      BLE object
+     * @param schedule  Duration and interval of each phase, in ms. NULL selects the HOGP
+     *                  recommendations.
+     */
+    ReconnectionManager(BLE &_ble, const advertising_schedule_t *schedule = NULL);
+
+    /**
+     * Start advertising, from the first phase
+     */
+    void start(void);
+
+    /**
+     * Stop advertising
+     */
+    void stop(void);
+
+    Phase getPhase(void)
+    {
+        return phase;
+    }
+
+protected:
+    /**
+     * Gap callbacks, which may run in interrupt context. They only record the state of the link
+     * and post linkTask.
+     */
+    void onConnection(const Gap::ConnectionCallbackParams_t *params);
+    void onDisconnection(const Gap::DisconnectionCallbackParams_t *params);
+
+    /**
+     * Called by linkTask: stop the phases on connection, and start over on disconnection
+     */
+    void onLinkChange(void);
+
+    /**
+     * Configure and start advertising for the current phase
+     */
+    void startPhase(void);
+
+    /**
+     * Called when the current phase times out
+     */
+    void nextPhase(void);
+
+protected:
+    BLE &ble;
+    advertising_schedule_t schedule;
+
+    volatile Phase phase;
+    ScheduledTask phaseTask;
+
+    /// Latest state of the link, recorded by the Gap callbacks
+    volatile bool connected;
+    ScheduledTask linkTask;
+
+    /// A host connected to us before
+    bool hasPeer;
+};
+
+#endif /* !HID_RECONNECTION_MANAGER_H_ */
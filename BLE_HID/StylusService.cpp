@@ -0,0 +1,61 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "StylusService.h"
+
+report_map_t STYLUS_REPORT_MAP = {
+    USAGE_PAGE(1),      0x0d,         // Digitizers
+    USAGE(1),           0x02,         // Pen
+    COLLECTION(1),      0x01,         // Application
+    USAGE(1),           0x20,         //  Stylus
+    COLLECTION(1),      0x00,         //  Physical
+    USAGE(1),           0x42,         //   Tip Switch
+    USAGE(1),           0x44,         //   Barrel Switch
+    USAGE(1),           0x32,         //   In Range
+    LOGICAL_MINIMUM(1), 0x00,
+    LOGICAL_MAXIMUM(1), 0x01,
+    REPORT_SIZE(1),     0x01,
+    REPORT_COUNT(1),    0x03,
+    INPUT(1),           0x02,         //   Data, Variable, Absolute
+    REPORT_COUNT(1),    0x05,         //   5 bits (Padding)
+    INPUT(1),           0x03,         //   Constant
+    USAGE_PAGE(1),      0x01,         //   Generic Desktop
+    USAGE(1),           0x30,         //   X
+    USAGE(1),           0x31,         //   Y
+    LOGICAL_MAXIMUM(2), 0xff, 0x7f,   //   STYLUS_LOGICAL_MAX
+    REPORT_SIZE(1),     0x10,
+    REPORT_COUNT(1),    0x02,
+    INPUT(1),           0x02,
+    USAGE_PAGE(1),      0x0d,         //   Digitizers
+    USAGE(1),           0x30,         //   Tip Pressure
+    LOGICAL_MAXIMUM(2), 0xff, 0x0f,   //   STYLUS_PRESSURE_MAX
+    REPORT_COUNT(1),    0x01,
+    INPUT(1),           0x02,
+    USAGE(1),           0x3d,         //   X Tilt
+    USAGE(1),           0x3e,         //   Y Tilt
+    LOGICAL_MINIMUM(1), 0xa6,         //   -90
+    LOGICAL_MAXIMUM(1), 0x5a,         //   90
+    UNIT(1),            0x14,         //   Degrees
+    REPORT_SIZE(1),     0x08,
+    REPORT_COUNT(1),    0x02,
+    INPUT(1),           0x02,
+    UNIT(1),            0x00,
+    END_COLLECTION(0),
+    END_COLLECTION(0),
+};
+
+const uint16_t STYLUS_REPORT_MAP_LENGTH = sizeof(STYLUS_REPORT_MAP);
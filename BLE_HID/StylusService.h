@@ -0,0 +1,291 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HID_STYLUS_SERVICE_H_
+#define HID_STYLUS_SERVICE_H_
+
+#include "mbed.h"
+
+#include "HIDService.h"
+
+enum StylusSwitch
+{
+    STYLUS_TIP      = 0x1,
+    STYLUS_BARREL   = 0x2,
+    STYLUS_IN_RANGE = 0x4,
+};
+
+/// Coordinates are in [0, STYLUS_LOGICAL_MAX]
+#define STYLUS_LOGICAL_MAX      0x7fff
+/// Pressure is in [0, STYLUS_PRESSURE_MAX]
+#define STYLUS_PRESSURE_MAX     0x0fff
+/// Tilt is in [-STYLUS_TILT_MAX, STYLUS_TILT_MAX] degrees
+#define STYLUS_TILT_MAX         90
+
+/**
+ * Longest extrapolation, in ms. Samples older than this aren't extrapolated at all, since the pen
+ * has most likely stopped or changed direction.
+ */
+#ifndef STYLUS_MAX_PREDICTION_MS
+#define STYLUS_MAX_PREDICTION_MS    50
+#endif
+
+/**
+ * Report descriptor for a pen with tip and barrel switches, in range, absolute X/Y, tip pressure
+ * and X/Y tilt.
+ */
+extern report_map_t STYLUS_REPORT_MAP;
+extern const uint16_t STYLUS_REPORT_MAP_LENGTH;
+
+/**
+ * @class StylusService
+ * @brief HID-over-Gatt pen service
+ *
+ * Send the position, pressure and tilt of a stylus at a steady pace.
+ *
+ * The service reports every 8ms while the pen is in range, which makes the host request the
+ * shortest connection interval. Each report is 9 bytes long and fits in a single notification.
+ * Samples are coalesced: when several of them arrive between two reports, only the latest one is
+ * sent. Optionally, the position is extrapolated from the last two samples, to compensate for
+ * the latency of the sensor and of the link.
+ *
+ * @code
+ * BLE ble;
+ * StylusService pen(ble);
+ *
+ * void on_pen_sample(uint16_t x, uint16_t y, uint16_t pressure)
+ * {
+ *     pen.setSwitches(STYLUS_IN_RANGE | (pressure ? STYLUS_TIP : 0));
+ *     pen.setSample(x, y, pressure, 0, 0);
+ * }
+ * @endcode
+ */
+class StylusService: public HIDService<StylusService>
+{
+public:
+    StylusService(BLE &_ble) :
+        HIDService<StylusService>(_ble,
+                                  STYLUS_REPORT_MAP, STYLUS_REPORT_MAP_LENGTH,
+                                  inputReport          = emptyReport,
+                                  outputReport         = NULL,
+                                  featureReport        = NULL,
+                                  inputReportLength    = sizeof(stylusInputReportData),
+                                  outputReportLength   = 0,
+                                  featureReportLength  = 0,
+                                  reportTickerDelay    = 8),
+        switches(0),
+        x(0),
+        y(0),
+        pressure(0),
+        previousX(0),
+        previousY(0),
+        sampleTime(0),
+        previousSampleTime(0),
+        hasPrevious(false),
+        predictionUs(0),
+        reportedOutOfRange(true),
+        failedReports(0)
+    {
+        tilt[0] = 0;
+        tilt[1] = 0;
+    }
+
+    virtual void onConnection(const Gap::ConnectionCallbackParams_t *params)
+    {
+        HIDServiceBase::onConnection(params);
+
+        reportedOutOfRange = false;
+        startReportTicker();
+    }
+
+    /**
+     * Set the state of the switches
+     *
+     * @param _switches Logical OR of StylusSwitch
+     */
+    void setSwitches(uint8_t _switches)
+    {
+        switches = _switches & (STYLUS_TIP | STYLUS_BARREL | STYLUS_IN_RANGE);
+
+        /* Don't extrapolate from samples taken before the pen left */
+        if (!(switches & STYLUS_IN_RANGE)) {
+            __disable_irq();
+            hasPrevious = false;
+            sampleTime = 0;
+            __enable_irq();
+        }
+
+        if (switches & STYLUS_IN_RANGE || !reportedOutOfRange)
+            wakeReportTicker();
+    }
+
+    /**
+     * Add a sample. It will be sent with the next report, unless another one replaces it.
+     *
+     * @param _x        Horizontal position, in [0, STYLUS_LOGICAL_MAX]
+     * @param _y        Vertical position, in [0, STYLUS_LOGICAL_MAX]
+     * @param _pressure Tip pressure, in [0, STYLUS_PRESSURE_MAX]
+     * @param tiltX     Tilt of the pen towards the right, in degrees
+     * @param tiltY     Tilt of the pen towards the user, in degrees
+     */
+    void setSample(uint16_t _x, uint16_t _y, uint16_t _pressure, int8_t tiltX, int8_t tiltY)
+    {
+        uint32_t now = us_ticker_read();
+
+        __disable_irq();
+
+        previousX = x;
+        previousY = y;
+        previousSampleTime = sampleTime;
+        hasPrevious = sampleTime != 0;
+
+        x = _x > STYLUS_LOGICAL_MAX ? STYLUS_LOGICAL_MAX : _x;
+        y = _y > STYLUS_LOGICAL_MAX ? STYLUS_LOGICAL_MAX : _y;
+        pressure = _pressure > STYLUS_PRESSURE_MAX ? STYLUS_PRESSURE_MAX : _pressure;
+        tilt[0] = clampTilt(tiltX);
+        tilt[1] = clampTilt(tiltY);
+        sampleTime = now | 1;   // 0 means "no sample"
+
+        __enable_irq();
+    }
+
+    /**
+     * Extrapolate the position to compensate for latency
+     *
+     * @param ms    How far ahead of the report time to predict the position. 0 disables
+     *              prediction: reports carry the latest sample.
+     */
+    void setPrediction(uint16_t ms)
+    {
+        predictionUs = ms * 1000;
+    }
+
+    /**
+     * Called by the report ticker
+     */
+    virtual void sendCallback(void) {
+        if (!connected)
+            return;
+
+        if (sendReleaseAll())
+            return;
+
+        /*
+         * The setters may be called from interrupts. They update the state with interrupts
+         * disabled, so do the same to take a consistent copy of it.
+         */
+        __disable_irq();
+
+        uint8_t reportSwitches = switches;
+        uint16_t reportX = x;
+        uint16_t reportY = y;
+        uint16_t reportPressure = pressure;
+        int8_t reportTilt[2] = { tilt[0], tilt[1] };
+        uint16_t fromX = previousX;
+        uint16_t fromY = previousY;
+        uint32_t to = sampleTime;
+        uint32_t from = previousSampleTime;
+        bool canPredict = hasPrevious;
+
+        __enable_irq();
+
+        if (!(reportSwitches & STYLUS_IN_RANGE) && reportedOutOfRange) {
+            stopReportTicker();
+            return;
+        }
+
+        if (predictionUs && canPredict) {
+            uint32_t now = us_ticker_read();
+            int32_t interval = to - from;
+            int32_t ahead = (now - to) + predictionUs;
+
+            if (interval > 0 && ahead <= STYLUS_MAX_PREDICTION_MS * 1000) {
+                reportX = extrapolate(fromX, reportX, interval, ahead);
+                reportY = extrapolate(fromY, reportY, interval, ahead);
+            }
+        }
+
+        stylusInputReportData[0] = reportSwitches;
+        stylusInputReportData[1] = reportX & 0xff;
+        stylusInputReportData[2] = reportX >> 8;
+        stylusInputReportData[3] = reportY & 0xff;
+        stylusInputReportData[4] = reportY >> 8;
+        stylusInputReportData[5] = reportPressure & 0xff;
+        stylusInputReportData[6] = reportPressure >> 8;
+        stylusInputReportData[7] = reportTilt[0];
+        stylusInputReportData[8] = reportTilt[1];
+
+        if (sendReport(stylusInputReportData)) {
+            failedReports++;
+            return;
+        }
+
+        reportedOutOfRange = !(reportSwitches & STYLUS_IN_RANGE);
+    }
+
+protected:
+    static int8_t clampTilt(int8_t tilt)
+    {
+        if (tilt > STYLUS_TILT_MAX)
+            return STYLUS_TILT_MAX;
+        if (tilt < -STYLUS_TILT_MAX)
+            return -STYLUS_TILT_MAX;
+        return tilt;
+    }
+
+    /**
+     * Linear extrapolation of a coordinate, from two samples taken interval us apart, to ahead us
+     * after the second one.
+     */
+    static uint16_t extrapolate(uint16_t from, uint16_t to, int32_t interval, int32_t ahead)
+    {
+        int32_t delta = (int32_t)to - from;
+        int32_t value = to + delta * ahead / interval;
+
+        if (value < 0)
+            return 0;
+        if (value > STYLUS_LOGICAL_MAX)
+            return STYLUS_LOGICAL_MAX;
+        return value;
+    }
+
+protected:
+    volatile uint8_t switches;
+
+    uint16_t x;
+    uint16_t y;
+    uint16_t pressure;
+    int8_t tilt[2];
+
+    uint16_t previousX;
+    uint16_t previousY;
+    uint32_t sampleTime;
+    uint32_t previousSampleTime;
+    volatile bool hasPrevious;
+
+    uint32_t predictionUs;
+
+    /// The last report told the host that the pen left
+    bool reportedOutOfRange;
+
+    /// Switches, X, Y, pressure, X tilt, Y tilt
+    uint8_t stylusInputReportData[9];
+
+public:
+    uint32_t failedReports;
+};
+
+#endif /* !HID_STYLUS_SERVICE_H_ */
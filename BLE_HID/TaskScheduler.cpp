@@ -0,0 +1,208 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "TaskScheduler.h"
+
+/*
+ * Times wrap around every 71 minutes: compare them through their signed difference, which is
+ * correct as long as they are less than 35 minutes apart.
+ */
+static inline bool isBefore(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) < 0;
+}
+
+TaskScheduler &TaskScheduler::instance(void)
+{
+    static TaskScheduler scheduler;
+
+    return scheduler;
+}
+
+TaskScheduler::TaskScheduler() :
+    head(NULL),
+    armed(false),
+    armedWakeup(0)
+{
+}
+
+void TaskScheduler::schedule(ScheduledTask &task, uint32_t delay, uint32_t period,
+                             uint32_t tolerance)
+{
+    uint32_t now = us_ticker_read();
+
+    __disable_irq();
+
+    if (task.scheduled)
+        remove(&task);
+
+    task.deadline = now + delay;
+    task.period = period;
+    task.tolerance = tolerance;
+    insert(&task);
+
+    __enable_irq();
+
+    arm();
+}
+
+void TaskScheduler::post(ScheduledTask &task)
+{
+    uint32_t now = us_ticker_read();
+
+    __disable_irq();
+
+    if (task.scheduled)
+        remove(&task);
+
+    task.deadline = now;
+    task.period = 0;
+    task.tolerance = 0;
+    insert(&task);
+
+    __enable_irq();
+}
+
+void TaskScheduler::cancel(ScheduledTask &task)
+{
+    __disable_irq();
+
+    if (!task.scheduled) {
+        __enable_irq();
+        return;
+    }
+
+    remove(&task);
+
+    __enable_irq();
+
+    arm();
+}
+
+void TaskScheduler::insert(ScheduledTask *task)
+{
+    ScheduledTask **p = &head;
+
+    while (*p && !isBefore(task->deadline, (*p)->deadline))
+        p = &(*p)->next;
+
+    task->next = *p;
+    *p = task;
+    task->scheduled = true;
+}
+
+void TaskScheduler::remove(ScheduledTask *task)
+{
+    ScheduledTask **p = &head;
+
+    while (*p && *p != task)
+        p = &(*p)->next;
+
+    if (*p)
+        *p = task->next;
+
+    task->next = NULL;
+    task->scheduled = false;
+}
+
+void TaskScheduler::arm(void)
+{
+    __disable_irq();
+
+    if (!head) {
+        /* Tickless: nothing to wake up for */
+        timeout.detach();
+        armed = false;
+        __enable_irq();
+        return;
+    }
+
+    /* Wake up when the least patient task can't wait any longer */
+    uint32_t wakeup = head->deadline + head->tolerance;
+
+    for (ScheduledTask *task = head->next; task; task = task->next) {
+        /* Later tasks can't bring the wakeup forward */
+        if (!isBefore(task->deadline, wakeup))
+            break;
+
+        if (isBefore(task->deadline + task->tolerance, wakeup))
+            wakeup = task->deadline + task->tolerance;
+    }
+
+    /* dispatch() runs on every wakeup of the main loop: don't reprogram the timer for nothing */
+    if (armed && wakeup == armedWakeup) {
+        __enable_irq();
+        return;
+    }
+
+    int32_t delay = wakeup - us_ticker_read();
+    if (delay < SCHEDULER_MIN_DELAY_US)
+        delay = SCHEDULER_MIN_DELAY_US;
+
+    timeout.attach_us(this, &TaskScheduler::onTimeout, delay);
+    armed = true;
+    armedWakeup = wakeup;
+
+    __enable_irq();
+}
+
+void TaskScheduler::onTimeout(void)
+{
+    /* The interrupt wakes waitForEvent() up, and the main loop calls dispatch() */
+    armed = false;
+}
+
+void TaskScheduler::dispatch(void)
+{
+    /* Only run what is due now, so that slow callbacks can't keep us here forever */
+    uint32_t now = us_ticker_read();
+
+    for (;;) {
+        __disable_irq();
+
+        /* Run everything that is due, including tasks whose tolerance isn't exhausted yet */
+        ScheduledTask *task = head;
+        if (!task || isBefore(now, task->deadline)) {
+            __enable_irq();
+            break;
+        }
+
+        remove(task);
+
+        /*
+         * Reschedule periodic tasks before running them, so that they can cancel themselves. A
+         * task that fell behind by more than a period skips the missed runs.
+         */
+        if (task->period) {
+            task->deadline += task->period;
+            if (!isBefore(now, task->deadline))
+                task->deadline = now + task->period;
+            insert(task);
+        }
+
+        __enable_irq();
+
+        task->callback.call();
+    }
+
+    arm();
+}
+
+void ScheduledTask::post(void)
+{
+    TaskScheduler::instance().post(*this);
+}
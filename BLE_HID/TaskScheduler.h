@@ -0,0 +1,202 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HID_TASK_SCHEDULER_H_
+#define HID_TASK_SCHEDULER_H_
+
+#include "mbed.h"
+
+/**
+ * Shortest delay programmed into the hardware timer, in us. Tasks that are already late run after
+ * this delay rather than from within schedule().
+ */
+#ifndef SCHEDULER_MIN_DELAY_US
+#define SCHEDULER_MIN_DELAY_US  50
+#endif
+
+/**
+ * @class ScheduledTask
+ *
+ * A piece of work run by the TaskScheduler: a callback, with its next deadline and optional
+ * period. Tasks are owned by their user (usually as a member of a service), and linked into the
+ * scheduler while they are scheduled, so the scheduler never allocates.
+ */
+class ScheduledTask {
+public:
+    ScheduledTask() :
+        deadline(0),
+        period(0),
+        tolerance(0),
+        scheduled(false),
+        next(NULL)
+    {
+    }
+
+    void attach(void (*function)(void))
+    {
+        callback.attach(function);
+    }
+
+    template<typename T>
+    void attach(T *object, void (T::*member)(void))
+    {
+        callback.attach(object, member);
+    }
+
+    bool isScheduled(void) const
+    {
+        return scheduled;
+    }
+
+    /**
+     * Run the task as soon as possible, from the main loop. Safe to call from interrupt handlers.
+     * See TaskScheduler::post().
+     */
+    void post(void);
+
+protected:
+    friend class TaskScheduler;
+
+    FunctionPointer callback;
+
+    /// Time of the next run, in us_ticker_read() time
+    uint32_t deadline;
+    /// 0 for one-shot tasks
+    uint32_t period;
+    /// How late the task may run, so that it can share a wakeup with another one
+    uint32_t tolerance;
+
+    bool scheduled;
+    ScheduledTask *next;
+};
+
+/**
+ * @class TaskScheduler
+ *
+ * Run the periodic and one-shot tasks of all services and drivers from a single hardware timer.
+ *
+ * Each task accepts to run up to its tolerance after its deadline. The timer is programmed for the
+ * earliest time at which some task can't wait any longer, and all tasks whose deadline has passed
+ * at that time run together: several services reporting at similar rates then share a wakeup,
+ * instead of each waking the CPU with its own Ticker. When no task is scheduled, the timer is
+ * stopped altogether.
+ *
+ * Periodic tasks keep their phase: the next deadline is computed from the previous one, not from
+ * the time the task actually ran.
+ *
+ * Callbacks don't run in interrupt context: the timer interrupt only wakes the main loop up, which
+ * runs due tasks with dispatch(). Reports are therefore built and sent from the same context as
+ * the rest of the application, and interrupt handlers stay short. Interrupt handlers that need
+ * more work done post() a task instead of doing it themselves. Callbacks may schedule, post and
+ * cancel tasks, including their own.
+ *
+ * @code
+ * ScheduledTask heartbeat;
+ * ScheduledTask buttonPressed;
+ *
+ * int main()
+ * {
+ *     heartbeat.attach(blink);
+ *     // Every second, give or take 100ms
+ *     TaskScheduler::instance().schedule(heartbeat, 1000000, 1000000, 100000);
+ *
+ *     // Handle the button in the main loop
+ *     buttonPressed.attach(on_button);
+ *     button.fall(&buttonPressed, &ScheduledTask::post);
+ *     ...
+ *
+ *     while (true) {
+ *         ble.waitForEvent();
+ *         TaskScheduler::instance().dispatch();
+ *     }
+ * }
+ * @endcode
+ */
+class TaskScheduler {
+public:
+    /**
+     * The scheduler shared by all tasks
+     */
+    static TaskScheduler &instance(void);
+
+    /**
+     * Schedule a task, or reschedule it if it is already scheduled
+     *
+     * @param task      Task to run. It must stay alive until it is cancelled, or has run for the
+     *                  last time.
+     * @param delay     Delay before the first run, in us
+     * @param period    Interval between runs, in us. 0 runs the task once.
+     * @param tolerance How late the task may run, in us
+     */
+    void schedule(ScheduledTask &task, uint32_t delay, uint32_t period = 0,
+                  uint32_t tolerance = 0);
+
+    /**
+     * Run a task once, on the next call to dispatch(). Tasks are run in the order they were
+     * posted. Posting a task that hasn't run yet doesn't queue it twice, and turns a periodic task
+     * into a one-shot one.
+     *
+     * Unlike schedule(), this doesn't touch the timer, and is cheap enough to be called from any
+     * interrupt handler: the interrupt itself wakes up the main loop.
+     */
+    void post(ScheduledTask &task);
+
+    /**
+     * Remove a task from the schedule. Does nothing if it isn't scheduled.
+     */
+    void cancel(ScheduledTask &task);
+
+    /**
+     * Run the tasks that are due, and program the timer for the next ones. Call this from the
+     * main loop, after each waitForEvent().
+     */
+    void dispatch(void);
+
+protected:
+    TaskScheduler();
+
+    /**
+     * Link a task into the list, sorted by deadline. Interrupts must be disabled.
+     */
+    void insert(ScheduledTask *task);
+
+    /**
+     * Unlink a task. Interrupts must be disabled.
+     */
+    void remove(ScheduledTask *task);
+
+    /**
+     * Program the timer for the next wakeup, or stop it if nothing is scheduled
+     */
+    void arm(void);
+
+    /**
+     * Called by the timer. Tasks are run by dispatch(), once the main loop is awake.
+     */
+    void onTimeout(void);
+
+protected:
+    Timeout timeout;
+
+    /// Scheduled tasks, earliest deadline first
+    ScheduledTask *head;
+
+    /// The timer is running, and will fire at armedWakeup
+    volatile bool armed;
+    uint32_t armedWakeup;
+};
+
+#endif /* !HID_TASK_SCHEDULER_H_ */
@@ -81,7 +81,9 @@
 /* Where report IDs are used the first byte of 'data' will be the */
 /* report ID and 'length' will include this report ID byte. */
 
+#ifndef MAX_HID_REPORT_SIZE
 #define MAX_HID_REPORT_SIZE (64)
+#endif
 
 typedef struct {
     uint32_t length;
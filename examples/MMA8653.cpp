@@ -0,0 +1,131 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "MMA8653.h"
+
+#include "examples_common.h"
+
+MMA8653::MMA8653(PinName sda, PinName scl, PinName _int1) :
+    i2c(sda, scl),
+    int1(_int1),
+    dataReady(false),
+    overruns(0)
+{
+}
+
+int MMA8653::writeRegister(uint8_t reg, uint8_t data)
+{
+    uint8_t command[2];
+
+    command[0] = reg;
+    command[1] = data;
+
+    return i2c.write(MMA8653_ADDR, (const char*)command, 2);
+}
+
+int MMA8653::readRegisters(uint8_t reg, uint8_t *buffer, int length)
+{
+    int err = i2c.write(MMA8653_ADDR, (const char *)&reg, 1, true);
+
+    if (err)
+        return err;
+
+    return i2c.read(MMA8653_ADDR, (char *)buffer, length);
+}
+
+int MMA8653::init(MMA8653DataRate rate)
+{
+    uint8_t whoami;
+    int err;
+
+    err = readRegisters(MMA8653_WHOAMI, &whoami, 1);
+    if (err)
+        return err;
+
+    HID_DEBUG("Accel is %x\r\n", whoami);
+    MBED_ASSERT(whoami == MMA8653_WHOAMI_VALUE);
+
+    /* Registers can only be modified in standby mode */
+    err = writeRegister(MMA8653_CTRL_REG1, 0x00);
+    if (err)
+        return err;
+
+    /* +/- 2g */
+    err = writeRegister(MMA8653_XYZ_DATA_CFG, 0x00);
+    if (err)
+        return err;
+
+    /* INT1 is push-pull, active low */
+    err = writeRegister(MMA8653_CTRL_REG3, 0x00);
+    if (err)
+        return err;
+
+    /* Data-ready interrupt, on INT1 */
+    err = writeRegister(MMA8653_CTRL_REG4, MMA8653_INT_DRDY);
+    if (err)
+        return err;
+
+    err = writeRegister(MMA8653_CTRL_REG5, MMA8653_INT_DRDY);
+    if (err)
+        return err;
+
+    int1.fall(this, &MMA8653::onDataReady);
+
+    return setRate(rate);
+}
+
+int MMA8653::setRate(MMA8653DataRate rate)
+{
+    /* Back to standby, then active with the new rate and 10 bits of data */
+    int err = writeRegister(MMA8653_CTRL_REG1, 0x00);
+    if (err)
+        return err;
+
+    return writeRegister(MMA8653_CTRL_REG1, (rate << 3) | 0x01);
+}
+
+void MMA8653::onDataReady(void)
+{
+    dataReady = true;
+}
+
+void MMA8653::process(void)
+{
+    /*
+     * INT1 stays asserted until the sample is read, so also check its level: if an edge was missed
+     * while we were reading, there won't be another one.
+     */
+    while (dataReady || !int1.read()) {
+        uint8_t data[6];
+        accel_sample_t sample;
+
+        dataReady = false;
+
+        if (readRegisters(MMA8653_OUT_X_MSB, data, sizeof(data))) {
+            HID_DEBUG("accel read failed\r\n");
+            return;
+        }
+
+        /* Left-justified 10-bit values */
+        for (unsigned i = 0; i < 3; i++)
+            sample.axis[i] = (int16_t)((data[2 * i] << 8) | data[2 * i + 1]) >> 6;
+
+        if (queue.full())
+            overruns++;
+
+        queue.push(sample);
+    }
+}
@@ -0,0 +1,134 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HID_EXAMPLES_MMA8653_H_
+#define HID_EXAMPLES_MMA8653_H_
+
+#include "mbed.h"
+#include "CircularBuffer.h"
+
+#define MMA8653_ADDR            0x3a
+#define MMA8653_STATUS          0x00
+#define MMA8653_OUT_X_MSB       0x01
+#define MMA8653_WHOAMI          0x0d
+#define MMA8653_XYZ_DATA_CFG    0x0e
+#define MMA8653_CTRL_REG1       0x2a
+#define MMA8653_CTRL_REG3       0x2c
+#define MMA8653_CTRL_REG4       0x2d
+#define MMA8653_CTRL_REG5       0x2e
+
+#define MMA8653_WHOAMI_VALUE    0x5a
+
+/** CTRL_REG4/CTRL_REG5: data-ready interrupt, enabled and routed to INT1 */
+#define MMA8653_INT_DRDY        0x01
+
+/** Number of samples buffered between the driver and its consumer */
+#ifndef MMA8653_QUEUE_SIZE
+#define MMA8653_QUEUE_SIZE      8
+#endif
+
+/**
+ * Output data rates, as encoded in CTRL_REG1
+ */
+enum MMA8653DataRate {
+    MMA8653_RATE_800HZ  = 0,
+    MMA8653_RATE_400HZ  = 1,
+    MMA8653_RATE_200HZ  = 2,
+    MMA8653_RATE_100HZ  = 3,
+    MMA8653_RATE_50HZ   = 4,
+    MMA8653_RATE_12HZ5  = 5,
+    MMA8653_RATE_6HZ25  = 6,
+    MMA8653_RATE_1HZ56  = 7,
+};
+
+/** One sample, in 1/256g units (+/-2g range, 10 bits) */
+typedef struct {
+    int16_t axis[3];
+} accel_sample_t;
+
+/**
+ * @class MMA8653
+ *
+ * Interrupt-driven driver for the MMA8653 accelerometer.
+ *
+ * The sensor raises its data-ready interrupt (INT1) whenever a new sample is available. The
+ * interrupt handler only records that fact: the I2C transfer, which is blocking on this platform,
+ * happens in process(), to be called from the main loop. Since the interrupt wakes up the main
+ * loop from waitForEvent(), samples are still read as soon as they are available, and the sensor
+ * rate is independent from the report rate. Samples are queued until the application consumes
+ * them with read().
+ *
+ * The MMA8653 has no FIFO, so each data-ready event carries exactly one sample, read with a single
+ * 6-byte burst.
+ */
+class MMA8653 {
+public:
+    MMA8653(PinName sda, PinName scl, PinName int1);
+
+    /**
+     * Configure the sensor and start sampling
+     *
+     * @return 0 on success, or the failing I2C error
+     */
+    int init(MMA8653DataRate rate = MMA8653_RATE_50HZ);
+
+    /**
+     * Change the output data rate
+     *
+     * @return 0 on success, or the failing I2C error
+     */
+    int setRate(MMA8653DataRate rate);
+
+    /**
+     * Fetch pending samples from the sensor. Call this from the main loop, after waitForEvent().
+     */
+    void process(void);
+
+    /**
+     * Get the oldest queued sample
+     *
+     * @return false if there is none
+     */
+    bool read(accel_sample_t &sample)
+    {
+        return queue.pop(sample);
+    }
+
+    /**
+     * Number of samples dropped because the queue was full
+     */
+    unsigned getOverruns(void) const
+    {
+        return overruns;
+    }
+
+protected:
+    int writeRegister(uint8_t reg, uint8_t data);
+    int readRegisters(uint8_t reg, uint8_t *buffer, int length);
+
+    void onDataReady(void);
+
+protected:
+    I2C i2c;
+    InterruptIn int1;
+
+    volatile bool dataReady;
+    unsigned overruns;
+
+    CircularBuffer<accel_sample_t, MMA8653_QUEUE_SIZE> queue;
+};
+
+#endif /* !HID_EXAMPLES_MMA8653_H_ */
@@ -17,6 +17,8 @@
 #include "ble/services/BatteryService.h"
 #include "ble/services/DeviceInformationService.h"
 
+#include "ReconnectionManager.h"
+
 #include "examples_common.h"
 
 static void passkeyDisplayCallback(Gap::Handle_t handle, const SecurityManager::Passkey_t passkey)
@@ -68,9 +70,23 @@ void initializeHOGP(BLE &ble)
             GapAdvertisingData::LE_GENERAL_DISCOVERABLE);
     ble.gap().accumulateAdvertisingPayload(GapAdvertisingData::COMPLETE_LIST_16BIT_SERVICE_IDS,
             (uint8_t *)uuid16_list, sizeof(uuid16_list));
+}
+
+KeyValueStore *getBondStore(void)
+{
+#ifdef TARGET_NRF51822
+    static NRF51FlashKeyValueStore store;
+
+    return store.isValid() ? &store : NULL;
+#else
+    return NULL;
+#endif
+}
+
+void startAdvertisingHOGP(BLE &ble)
+{
+    // Advertising type and intervals follow 5.1.2: HID over GATT Specification (pg. 25)
+    static ReconnectionManager reconnectionManager(ble);
 
-    // see 5.1.2: HID over GATT Specification (pg. 25)
-    ble.gap().setAdvertisingType(GapAdvertisingParams::ADV_CONNECTABLE_UNDIRECTED);
-    // 30ms to 50ms is recommended (5.1.2)
-    ble.gap().setAdvertisingInterval(50);
+    reconnectionManager.start();
 }
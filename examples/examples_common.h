@@ -66,4 +66,16 @@ void initializeSecurity(BLE &ble);
  */
 void initializeHOGP(BLE &ble);
 
+/**
+ * Store remembering which hosts subscribed to reports, for HIDServiceBase::setBondStore(). NULL on
+ * platforms without a flash backend.
+ */
+KeyValueStore *getBondStore(void);
+
+/**
+ * Start advertising. Advertising restarts automatically after each disconnection, with a duty
+ * cycle decreasing over time.
+ */
+void startAdvertisingHOGP(BLE &ble);
+
 #endif /* !BLE_HID_COMMON_H_ */
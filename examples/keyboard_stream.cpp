@@ -31,6 +31,10 @@
  * will take about 500ms to transmit, principally because of the limited notification rate in BLE.
  * KeyboardService uses a circular buffer to store the strings to send, and calls to putc will fail
  * once this buffer is full. This will result in partial strings being sent to the client.
+ *
+ * This example uses typeAsync instead, which only queues complete strings, and tells us when the
+ * host received them. The second button plays a macro stored in flash, which isn't limited by the
+ * size of the buffer.
  */
 
 DigitalOut waiting_led(LED1);
@@ -49,8 +53,6 @@ static void onDisconnect(const Gap::DisconnectionCallbackParams_t *params)
 {
     HID_DEBUG("disconnected\r\n");
     connected_led = 0;
-
-    ble.gap().startAdvertising(); // restart advertising
 }
 
 static void onConnect(const Gap::ConnectionCallbackParams_t *params)
@@ -66,6 +68,10 @@ static void waiting() {
         connected_led = !connected_led;
 }
 
+static void on_string_sent(int handle, int status) {
+    HID_DEBUG("string %d %s\r\n", handle, status ? "lost" : "delivered");
+}
+
 void send_string(const char * c) {
     if (!kbdServicePtr)
         return;
@@ -73,9 +79,12 @@ void send_string(const char * c) {
     if (!kbdServicePtr->isConnected()) {
         HID_DEBUG("we haven't connected yet...");
     } else {
-        int len = strlen(c);
-        kbdServicePtr->printf(c);
-        HID_DEBUG("sending %d chars\r\n", len);
+        int handle;
+
+        if (kbdServicePtr->typeAsync(c, on_string_sent, &handle))
+            HID_DEBUG("busy, try again later\r\n");
+        else
+            HID_DEBUG("sending string %d (%d chars)\r\n", handle, (int)strlen(c));
     }
 }
 
@@ -83,20 +92,45 @@ void send_stuff() {
     send_string("hello world!\n");
 }
 
+/* Type a line, then select it with Shift+Home and replace it */
+static const uint8_t more_stuff_macro[] = {
+    'A', 'l', 'l', ' ', 'w', 'o', 'r', 'k', ' ', 'a', 'n', 'd', ' ', 'n', 'o', ' ',
+    'p', 'l', 'a', 'y',
+    KEY_MACRO_PAUSE(1000),
+    KEY_MACRO_DOWN(0xe1), KEY_MACRO_TAP(0x4a), KEY_MACRO_UP(0xe1),
+    KEY_MACRO_PAUSE(500),
+    'm', 'a', 'k', 'e', 's', ' ', 'J', 'a', 'c', 'k', ' ', 'a', ' ', 'd', 'u', 'l', 'l',
+    ' ', 'b', 'o', 'y', '\n',
+    KEY_MACRO_END
+};
+
 void send_more_stuff() {
-    send_string("All work and no play makes Jack a dull boy\n");
+    if (!kbdServicePtr)
+        return;
+
+    if (!kbdServicePtr->isConnected())
+        HID_DEBUG("we haven't connected yet...");
+    else if (kbdServicePtr->playMacro(more_stuff_macro))
+        HID_DEBUG("busy, try again later\r\n");
 }
 
 int main()
 {
-    Ticker heartbeat;
+    ScheduledTask heartbeat;
+    ScheduledTask button1Task;
+    ScheduledTask button2Task;
 
-    button1.rise(send_stuff);
-    button2.rise(send_more_stuff);
+    /* Buttons are handled in the main loop, their interrupts only post a task */
+    button1Task.attach(send_stuff);
+    button2Task.attach(send_more_stuff);
+    button1.rise(&button1Task, &ScheduledTask::post);
+    button2.rise(&button2Task, &ScheduledTask::post);
 
     HID_DEBUG("initialising ticker\r\n");
 
-    heartbeat.attach(waiting, 1);
+    /* The LEDs don't need to be on time: let the heartbeat share wakeups with reports */
+    heartbeat.attach(waiting);
+    TaskScheduler::instance().schedule(heartbeat, 1000000, 1000000, 200000);
 
     HID_DEBUG("initialising ble\r\n");
     ble.init();
@@ -109,6 +143,7 @@ int main()
     HID_DEBUG("adding hid service\r\n");
     KeyboardService kbdService(ble);
     kbdServicePtr = &kbdService;
+    kbdService.setBondStore(getBondStore());
 
     HID_DEBUG("adding device info and battery service\r\n");
     initializeHOGP(ble);
@@ -123,9 +158,10 @@ int main()
     ble.gap().setDeviceName((const uint8_t *)DEVICE_NAME);
 
     HID_DEBUG("advertising\r\n");
-    ble.gap().startAdvertising();
+    startAdvertisingHOGP(ble);
 
     while (true) {
         ble.waitForEvent();
+        TaskScheduler::instance().dispatch();
     }
 }
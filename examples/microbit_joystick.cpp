@@ -28,29 +28,27 @@
 #define HID_BUTTON_2 MOUSE_BUTTON_RIGHT
 #endif
 
+#include "MMA8653.h"
+#include "MotionPipeline.h"
 #include "examples_common.h"
 
 /*
  * This demo drives the joystick/mouse HID service with the micro:bit's accelerometer, an MMA8653.
- * The accelerometer is polled every 40ms or so, and the HIDService sends speed reports.
+ * The accelerometer signals each new sample (every 20ms) with an interrupt, the main loop reads it,
+ * and the HIDService sends speed reports.
  *
  * How it works: when immobile, the accelerometer reports an acceleration of 1g = 9.8m/s^2.
  * When horizontal, ax = ay = 0, and az = g. Otherwise, g will be projected on each axis. This demo
  * uses that projection on ax and ay, to control the speed of the joystick.
  *
+ * Samples go through a MotionPipeline, which filters them and applies an acceleration curve with
+ * integer arithmetic only.
+ *
  * Linear moves will be negligible compared to g reports, and are almost impossible to detect
  * without adding at least a gyro in the mix.
  */
 
-#define MMA8653_ADDR            0x3a
-#define MMA8653_OUT_X_MSB       0x01
-#define MMA8653_WHOAMI          0x0d
-#define MMA8653_XYZ_DATA_CFG    0x0e
-#define MMA8653_CTRL_REG1       0x2a
-#define MMA8653_CTRL_REG4       0x2d
-#define MMA8653_CTRL_REG5       0x2e
-
-I2C i2c(p30, p0);
+MMA8653 accel(p30, p0, p28);
 
 BLE ble;
 
@@ -94,156 +92,74 @@ void button2_up()
 }
 
 
-/* ---- MMA8653 handling ---- */
-int write_accel(uint8_t reg, uint8_t data)
-{
-    uint8_t command[2];
-
-    command[0] = reg;
-    command[1] = data;
-
-    return i2c.write(MMA8653_ADDR, (const char*)command, 2, true);
-}
-
-int read_accel(uint8_t reg, uint8_t *buffer, int length)
-{
-    int err = i2c.write(MMA8653_ADDR, (const char *)&reg, 1, true);
-
-    if (err) {
-        HID_DEBUG("init write failed\r\n");
-        return err;
-    }
-    return i2c.read(MMA8653_ADDR, (char *)buffer, length);
-}
-
-void init_accel(void)
-{
-    uint8_t whoami;
-    int err;
-
-    /* Put device in standby mode */
-    err = write_accel(MMA8653_CTRL_REG1, 0x00);
-    if (err)
-        HID_DEBUG("CTRL_REG1 1 failed\r\n");
-
-    /* Interrupt DRDY */
-    err = write_accel(MMA8653_CTRL_REG4, 0x00);
-    if (err)
-        HID_DEBUG("CTRL_REG4 failed\r\n");
-
-    /* same, CFG */
-    err = write_accel(MMA8653_CTRL_REG5, 0x00);
-    if (err)
-        HID_DEBUG("CTRL_REG5 failed\r\n");
-
-    /* +/- 2g */
-    err = write_accel(MMA8653_XYZ_DATA_CFG, 0x00);
-    if (err)
-        HID_DEBUG("CTRL_DATA_CFG failed\r\n");
-
-    /*
-     * Data rate = 50Hz
-     * 10 bits of data
-     */
-    err = write_accel(MMA8653_CTRL_REG1, 0x21);
-    if (err)
-        HID_DEBUG("CTRL_REG1 2 failed\r\n");
-
-    read_accel(MMA8653_WHOAMI, &whoami, 1);
-    HID_DEBUG("Accel is %x\r\n", whoami);
-    MBED_ASSERT(whoami == 0x5a);
-}
-
-/** Integer square root of an uint16 */
-static uint8_t sqrti(uint16_t v)
-{
-    static const uint16_t sqr_table[] = {
-        1, 4, 9, 16, 25, 36, 49, 64, 81, 100, 121, 144, 169, 196, 225, 256, 289,
-        324, 361, 400, 441, 484, 529, 576, 625, 676, 729, 784, 841, 900, 961
-    };
-    static const unsigned sqr_table_size = sizeof(sqr_table) / sizeof(sqr_table[0]);
-    uint8_t i;
-
-    for (i = 0; i < sqr_table_size; i++)
-    {
-        if (sqr_table[i] > v)
-            return i;
-    }
-
-    return sqr_table[sqr_table_size - 1];
-}
+/**
+ * Tuning of the motion pipeline, for samples in 1/256g units:
+ * - low-pass with a time constant of about 4 samples (80ms)
+ * - tilts below 20/256g are ignored
+ * - speed increases with the square of the tilt, so that small tilts allow precise moves
+ * - the speed slowly decays while tilted, and quickly once the board is back to horizontal
+ * - HID report values must be in [-127; 127], but above 32 is generally too high anyway.
+ */
+static const motion_config_t motion_config = {
+    64,         // lowPassAlpha
+    20,         // deadZone
+    2,          // linearGain
+    2,          // quadraticGain
+    true,       // integrate
+    10,         // leakShift
+    3,          // restLeakShift
+    2,          // outputShift
+    32,         // outputMax
+};
+
+MotionPipeline motion(motion_config);
+
+/* Spread samples over reports according to their actual timing */
+#ifdef USE_JOYSTICK
+MotionResampler resampler(RESAMPLER_ABSOLUTE, 20);
+#else
+MotionResampler resampler(RESAMPLER_RELATIVE, 20);
+#endif
 
 /**
- * Invert sign and attempt to smoothen the acceleration value.
- * Disclaimer: the process used to write the following functions was exteremly chaotic.
- * No calculation whatsoever was involved.
+ * Feed the samples received since the last call into the motion pipeline, and update the speed
+ * reported by the HID service.
  */
-static int8_t soften_accel(int16_t v)
+void process_accel(void)
 {
-    int sign = -1;
-
-    if (v < 0) {
-        sign = 1;
-        v = -v;
+    static bool suspended = false;
+    accel_sample_t sample;
+    int16_t axes[MOTION_AXES];
+    int8_t speed[MOTION_AXES];
+    bool updated = false;
+
+    /* Nobody looks at the pointer while the host sleeps, sample at the lowest rate */
+    if (hidServicePtr && hidServicePtr->isSuspended() != suspended) {
+        suspended = !suspended;
+        accel.setRate(suspended ? MMA8653_RATE_1HZ56 : MMA8653_RATE_50HZ);
     }
 
-    return sign * sqrti(v / 5);
-}
+    accel.process();
 
-void poll_accel(void)
-{
-    static const int maxv = 128;
-    int8_t data[6];
-
-    static int vx = 0;
-    static int vy = 0;
-
-    int ax = 0;
-    int ay = 0;
-
-    read_accel(MMA8653_OUT_X_MSB, (uint8_t *)data, 6);
-
-    ax = data[0];
-    ay = data[2];
-
-    ax = soften_accel(ax);
-    ay = soften_accel(ay);
-
-    vx = ax + vx;
-    vy = ay + vy;
-
-    /* Clamp down on speed */
-    if (vx > maxv)
-        vx = maxv;
-    if (vx < -maxv)
-        vx = -maxv;
-    if (vy > maxv)
-        vy = maxv;
-    if (vy < -maxv)
-        vy = -maxv;
-
-    if (hidServicePtr) {
-        /*
-         * Reduce speed a little bit. HID report values must be in [-127; 127], but above 32 is
-         * generally too high anyway.
-         */
-        hidServicePtr->setSpeed(vx / 4, vy / 4, 0);
+    while (accel.read(sample)) {
+        /* Accelerometer axes point the opposite way of HID ones */
+        for (unsigned i = 0; i < MOTION_AXES; i++)
+            axes[i] = -sample.axis[i];
+
+        motion.push(axes);
+        updated = true;
     }
 
-    /**
-     * Decrease over time. We need this to remove integration drifts due to noise, but it could well
-     * be improved, as this prevents from having steady low speeds.
-     */
-    vx *= 0.999;
-    vy *= 0.999;
+    if (updated && hidServicePtr) {
+        motion.read(speed);
+        hidServicePtr->setSpeed(speed[0], speed[1], 0);
+    }
 }
 
 void onDisconnect(const Gap::DisconnectionCallbackParams_t *params)
 {
     HID_DEBUG("disconnected\r\n");
     connected_led = 0;
-
-    ble.gap().startAdvertising(); // restart advertising
 }
 
 void onConnect(const Gap::ConnectionCallbackParams_t *params)
@@ -261,21 +177,30 @@ void waiting() {
 
 int main()
 {
-    Ticker accel_poll_ticker;
-    Ticker heartbeat;
-
-    init_accel();
-
-    accel_poll_ticker.attach(poll_accel, 0.02);
-
-    button1.rise(button1_up);
-    button1.fall(button1_down);
-    button2.rise(button2_up);
-    button2.fall(button2_down);
+    ScheduledTask heartbeat;
+    ScheduledTask button1UpTask;
+    ScheduledTask button1DownTask;
+    ScheduledTask button2UpTask;
+    ScheduledTask button2DownTask;
+
+    if (accel.init(MMA8653_RATE_50HZ))
+        HID_DEBUG("accel init failed\r\n");
+
+    /* Buttons are handled in the main loop, their interrupts only post a task */
+    button1UpTask.attach(button1_up);
+    button1DownTask.attach(button1_down);
+    button2UpTask.attach(button2_up);
+    button2DownTask.attach(button2_down);
+    button1.rise(&button1UpTask, &ScheduledTask::post);
+    button1.fall(&button1DownTask, &ScheduledTask::post);
+    button2.rise(&button2UpTask, &ScheduledTask::post);
+    button2.fall(&button2DownTask, &ScheduledTask::post);
 
     HID_DEBUG("initialising ticker\r\n");
 
-    heartbeat.attach(waiting, 1);
+    /* The LEDs don't need to be on time: let the heartbeat share wakeups with reports */
+    heartbeat.attach(waiting);
+    TaskScheduler::instance().schedule(heartbeat, 1000000, 1000000, 200000);
 
     HID_DEBUG("initialising ble\r\n");
 
@@ -291,15 +216,21 @@ int main()
 #ifdef USE_JOYSTICK
     JoystickService joystickService(ble);
     hidServicePtr = &joystickService;
+    joystickService.setResampler(&resampler);
 
     ble.gap().accumulateAdvertisingPayload(GapAdvertisingData::JOYSTICK);
 #else
     MouseService mouseService(ble);
     hidServicePtr = &mouseService;
+    mouseService.setResampler(&resampler);
 
     ble.gap().accumulateAdvertisingPayload(GapAdvertisingData::MOUSE);
 #endif
 
+    /* Build reports right before connection events, from the latest samples */
+    hidServicePtr->setRadioAlignment(true);
+    hidServicePtr->setBondStore(getBondStore());
+
     HID_DEBUG("setting up gap\r\n");
     ble.gap().accumulateAdvertisingPayload(GapAdvertisingData::COMPLETE_LOCAL_NAME,
                                            (const uint8_t *)DEVICE_NAME, sizeof(DEVICE_NAME));
@@ -312,9 +243,11 @@ int main()
     initializeHOGP(ble);
 
     HID_DEBUG("advertising\r\n");
-    ble.gap().startAdvertising();
+    startAdvertisingHOGP(ble);
 
     while (true) {
         ble.waitForEvent();
+        TaskScheduler::instance().dispatch();
+        process_accel();
     }
 }
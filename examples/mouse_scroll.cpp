@@ -59,8 +59,6 @@ static void onDisconnect(const Gap::DisconnectionCallbackParams_t *params)
 {
     HID_DEBUG("disconnected\r\n");
     connected_led = 0;
-
-    ble.gap().startAdvertising(); // restart advertising
 }
 
 static void onConnect(const Gap::ConnectionCallbackParams_t *params)
@@ -78,16 +76,27 @@ static void waiting() {
 
 int main()
 {
-    Ticker heartbeat;
-
-    button1.rise(button1_up);
-    button1.fall(button1_down);
-    button2.rise(button2_up);
-    button2.fall(button2_down);
+    ScheduledTask heartbeat;
+    ScheduledTask button1UpTask;
+    ScheduledTask button1DownTask;
+    ScheduledTask button2UpTask;
+    ScheduledTask button2DownTask;
+
+    /* Buttons are handled in the main loop, their interrupts only post a task */
+    button1UpTask.attach(button1_up);
+    button1DownTask.attach(button1_down);
+    button2UpTask.attach(button2_up);
+    button2DownTask.attach(button2_down);
+    button1.rise(&button1UpTask, &ScheduledTask::post);
+    button1.fall(&button1DownTask, &ScheduledTask::post);
+    button2.rise(&button2UpTask, &ScheduledTask::post);
+    button2.fall(&button2DownTask, &ScheduledTask::post);
 
     HID_DEBUG("initialising ticker\r\n");
 
-    heartbeat.attach(waiting, 1);
+    /* The LEDs don't need to be on time: let the heartbeat share wakeups with reports */
+    heartbeat.attach(waiting);
+    TaskScheduler::instance().schedule(heartbeat, 1000000, 1000000, 200000);
 
     HID_DEBUG("initialising ble\r\n");
     ble.init();
@@ -101,6 +110,7 @@ int main()
 
     MouseService mouseService(ble);
     mouseServicePtr = &mouseService;
+    mouseService.setBondStore(getBondStore());
 
     HID_DEBUG("adding dev info and battery service\r\n");
     initializeHOGP(ble);
@@ -115,9 +125,10 @@ int main()
     ble.gap().setDeviceName((const uint8_t *)DEVICE_NAME);
 
     HID_DEBUG("advertising\r\n");
-    ble.gap().startAdvertising();
+    startAdvertisingHOGP(ble);
 
     while (true) {
         ble.waitForEvent();
+        TaskScheduler::instance().dispatch();
     }
 }
@@ -0,0 +1,207 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "ble/BLE.h"
+#include "TaskScheduler.h"
+#include "host.h"
+
+/* Defined by host_ble.cpp, NULL if the test has no BLE object */
+extern BLE *host_ble;
+
+static uint32_t now;
+
+/// Armed timeouts
+static Timeout *timeouts;
+
+uint32_t host_wakeups;
+uint32_t host_timer_wakeups;
+
+unsigned host_checks;
+unsigned host_failures;
+
+static uint32_t randomState = 1;
+
+int (*host_gpio_read)(PinName pin);
+void (*host_gpio_write)(PinName pin, int value);
+void (*host_gpio_dir)(PinName pin, PinDirection direction);
+
+static inline bool isBefore(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) < 0;
+}
+
+uint32_t us_ticker_read(void)
+{
+    return now;
+}
+
+void wait_us(int us)
+{
+    now += us;
+}
+
+Timeout::Timeout() :
+    next(NULL),
+    armed(false),
+    deadline(0)
+{
+}
+
+Timeout::~Timeout()
+{
+    detach();
+}
+
+void Timeout::arm(uint32_t us)
+{
+    detach();
+
+    deadline = now + us;
+    armed = true;
+    next = timeouts;
+    timeouts = this;
+}
+
+void Timeout::detach(void)
+{
+    Timeout **p = &timeouts;
+
+    while (*p && *p != this)
+        p = &(*p)->next;
+
+    if (*p)
+        *p = next;
+
+    next = NULL;
+    armed = false;
+}
+
+void Timeout::fire(void)
+{
+    detach();
+    callback.call();
+}
+
+void host_run(uint32_t us)
+{
+    uint32_t end = now + us;
+
+    TaskScheduler::instance().dispatch();
+
+    for (;;) {
+        Timeout *timeout = NULL;
+        uint32_t wakeup = end;
+
+        for (Timeout *t = timeouts; t; t = t->next) {
+            if (!isBefore(wakeup, t->getDeadline()) && (!timeout
+                    || isBefore(t->getDeadline(), timeout->getDeadline()))) {
+                timeout = t;
+                wakeup = t->getDeadline();
+            }
+        }
+
+        /* Timeouts go first when they coincide with a link event */
+        uint32_t linkEvent;
+        bool link = host_ble && host_ble->hostNextEvent(linkEvent) && !isBefore(end, linkEvent)
+                 && (!timeout || isBefore(linkEvent, wakeup));
+
+        if (!timeout && !link)
+            break;
+
+        if (link)
+            wakeup = linkEvent;
+
+        /* Time doesn't go back if the callbacks were slow */
+        if (isBefore(now, wakeup))
+            now = wakeup;
+
+        host_wakeups++;
+
+        if (link) {
+            host_ble->hostFireEvent();
+        } else {
+            host_timer_wakeups++;
+            timeout->fire();
+        }
+
+        TaskScheduler::instance().dispatch();
+    }
+
+    if (isBefore(now, end))
+        now = end;
+}
+
+bool host_run_until(bool (*condition)(void), uint32_t timeout_us)
+{
+    uint32_t start = now;
+
+    while (!condition()) {
+        if ((uint32_t)(now - start) >= timeout_us)
+            return false;
+        host_run(100);
+    }
+
+    return true;
+}
+
+uint32_t host_random(void)
+{
+    /* xorshift32 */
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+
+    return randomState;
+}
+
+void host_seed(uint32_t seed)
+{
+    randomState = seed ? seed : 1;
+}
+
+void host_check(bool ok, const char *file, int line, const char *expr)
+{
+    host_checks++;
+
+    if (ok)
+        return;
+
+    host_failures++;
+    printf("%s:%d: check failed: %s\n", file, line, expr);
+}
+
+void host_check_equal(long expected, long actual, const char *file, int line, const char *expr)
+{
+    host_checks++;
+
+    if (expected == actual)
+        return;
+
+    host_failures++;
+    printf("%s:%d: check failed: %s is %ld, expected %ld\n", file, line, expr, actual, expected);
+}
+
+int host_summary(const char *name)
+{
+    if (host_failures) {
+        printf("%s: %u of %u checks failed\n", name, host_failures, host_checks);
+        return 1;
+    }
+
+    printf("%s: %u checks passed\n", name, host_checks);
+    return 0;
+}
@@ -0,0 +1,76 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HOST_H_
+#define HOST_H_
+
+/*
+ * Simulation of the main loop of an application, and checks for the host tests.
+ *
+ * The simulated main loop sleeps until the next event (a Timeout or, with a simulated BLE link,
+ * a radio notification or a connection event), handles it, and then calls
+ * TaskScheduler::dispatch(), exactly as the main loop of the examples does after waitForEvent().
+ */
+
+#include "mbed.h"
+
+/**
+ * Run the main loop for a while. Tasks posted outside of it run first.
+ *
+ * @param us    Simulated time, in us
+ */
+void host_run(uint32_t us);
+
+/**
+ * Run the main loop until a condition is true
+ *
+ * @return false if the condition is still false after timeout_us
+ */
+bool host_run_until(bool (*condition)(void), uint32_t timeout_us);
+
+/// Times the main loop woke up, and times it was woken up by a Timeout
+extern uint32_t host_wakeups;
+extern uint32_t host_timer_wakeups;
+
+/**
+ * Deterministic pseudo-random numbers, so that failures can be reproduced
+ */
+uint32_t host_random(void);
+void host_seed(uint32_t seed);
+
+/*
+ * Checks. A failed check is reported, and the test goes on.
+ */
+extern unsigned host_checks;
+extern unsigned host_failures;
+
+#define CHECK(expr) \
+    host_check((expr), __FILE__, __LINE__, #expr)
+
+#define CHECK_EQUAL(expected, actual) \
+    host_check_equal((long)(expected), (long)(actual), __FILE__, __LINE__, #actual)
+
+void host_check(bool ok, const char *file, int line, const char *expr);
+void host_check_equal(long expected, long actual, const char *file, int line, const char *expr);
+
+/**
+ * Print the result of the test
+ *
+ * @return the exit status of the test program
+ */
+int host_summary(const char *name);
+
+#endif /* !HOST_H_ */
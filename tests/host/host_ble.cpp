@@ -0,0 +1,267 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "ble/BLE.h"
+#include "host.h"
+
+/// The BLE object of the test, whose link is run by host_run()
+BLE *host_ble;
+
+/* Handle 0 is invalid */
+GattAttribute::Handle_t GattAttribute::nextHandle = 1;
+
+static const Gap::Handle_t HOST_CONNECTION_HANDLE = 0x10;
+
+Gap::Gap() :
+    radioNotificationEnabled(false),
+    connectionInterval(6),
+    slaveLatency(0),
+    advertising(false),
+    advertisingType(GapAdvertisingParams::ADV_CONNECTABLE_UNDIRECTED),
+    advertisingInterval(0)
+{
+    memset(&preferredParams, 0, sizeof(preferredParams));
+}
+
+ble_error_t Gap::updateConnectionParams(Handle_t handle, const ConnectionParams_t *params)
+{
+    connectionInterval = params->maxConnectionInterval;
+    slaveLatency = params->slaveLatency;
+
+    return BLE_ERROR_NONE;
+}
+
+GattServer::GattServer() :
+    connected(false),
+    txBuffers(HOST_TX_BUFFERS),
+    queued(0),
+    receivedCount(0)
+{
+    memset(values, 0, sizeof(values));
+    memset(lengths, 0, sizeof(lengths));
+    memset(properties, 0, sizeof(properties));
+}
+
+ble_error_t GattServer::addService(GattService &service)
+{
+    for (unsigned i = 0; i < service.count; i++) {
+        GattAttribute::Handle_t handle = service.characteristics[i]->getValueHandle();
+
+        MBED_ASSERT(handle + 1 < HOST_MAX_HANDLES);
+        properties[handle] = service.characteristics[i]->getProperties();
+    }
+
+    return BLE_ERROR_NONE;
+}
+
+ble_error_t GattServer::write(GattAttribute::Handle_t handle, const uint8_t *value,
+                              uint16_t length, bool localOnly)
+{
+    if (handle >= HOST_MAX_HANDLES || length > HOST_ATTRIBUTE_SIZE)
+        return BLE_ERROR_INVALID_PARAM;
+
+    memcpy(values[handle], value, length);
+    lengths[handle] = length;
+
+    bool notify = properties[handle] & GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY;
+
+    if (localOnly || !connected || !notify)
+        return BLE_ERROR_NONE;
+
+    if (!isSubscribed(handle))
+        return BLE_ERROR_INVALID_STATE;
+
+    if (queued >= txBuffers)
+        return BLE_STACK_BUSY;
+
+    host_notification_t &notification = queue[queued++];
+
+    notification.handle = handle;
+    notification.length = length;
+    memcpy(notification.data, value, length);
+    notification.queuedAt = us_ticker_read();
+    notification.sentAt = 0;
+
+    return BLE_ERROR_NONE;
+}
+
+ble_error_t GattServer::read(GattAttribute::Handle_t handle, uint8_t *value, uint16_t *length)
+{
+    if (handle >= HOST_MAX_HANDLES)
+        return BLE_ERROR_INVALID_PARAM;
+
+    if (*length > lengths[handle])
+        *length = lengths[handle];
+    memcpy(value, values[handle], *length);
+
+    return BLE_ERROR_NONE;
+}
+
+void GattServer::resetLink(void)
+{
+    queued = 0;
+
+    /* The peer isn't bonded: it has to subscribe again */
+    for (unsigned handle = 0; handle + 1 < HOST_MAX_HANDLES; handle++) {
+        if (properties[handle] & GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY)
+            memset(values[handle + 1], 0, 2);
+    }
+}
+
+BLE::BLE() :
+    nextConnectionEvent(0),
+    radioLead(1740),
+    notificationsPerEvent(4),
+    dropRate(0),
+    notificationCallback(NULL),
+    connectionEvents(0),
+    radioNotified(false)
+{
+    host_ble = this;
+}
+
+void BLE::hostConnect(float intervalMs, unsigned perEvent, uint8_t peerAddressByte)
+{
+    Gap::ConnectionParams_t params;
+    Gap::ConnectionCallbackParams_t connection;
+
+    _gap.connectionInterval = (uint16_t)(intervalMs / 1.25f);
+    _gap.slaveLatency = 0;
+    _gap.advertising = false;
+    notificationsPerEvent = perEvent;
+
+    params.minConnectionInterval = _gap.connectionInterval;
+    params.maxConnectionInterval = _gap.connectionInterval;
+    params.slaveLatency = 0;
+    params.connectionSupervisionTimeout = 3200;
+
+    memset(&connection, 0, sizeof(connection));
+    connection.handle = HOST_CONNECTION_HANDLE;
+    connection.role = Gap::PERIPHERAL;
+    connection.peerAddrType = Gap::ADDR_TYPE_RANDOM_STATIC;
+    memset(connection.peerAddr, peerAddressByte, sizeof(connection.peerAddr));
+    connection.connectionParams = &params;
+
+    _gattServer.connected = true;
+    nextConnectionEvent = us_ticker_read() + _gap.connectionInterval * 1250;
+    radioNotified = false;
+
+    _gap.connectionCallChain.call(&connection);
+}
+
+void BLE::hostDisconnect(Gap::DisconnectionReason_t reason)
+{
+    Gap::DisconnectionCallbackParams_t disconnection;
+
+    if (!_gattServer.connected)
+        return;
+
+    _gattServer.connected = false;
+    _gattServer.resetLink();
+
+    disconnection.handle = HOST_CONNECTION_HANDLE;
+    disconnection.reason = reason;
+
+    _gap.disconnectionCallChain.call(&disconnection);
+}
+
+void BLE::hostWrite(GattAttribute::Handle_t handle, const uint8_t *data, uint16_t length)
+{
+    GattWriteCallbackParams params;
+
+    MBED_ASSERT(handle < HOST_MAX_HANDLES && length <= HOST_ATTRIBUTE_SIZE);
+
+    memcpy(_gattServer.values[handle], data, length);
+    _gattServer.lengths[handle] = length;
+
+    params.connHandle = HOST_CONNECTION_HANDLE;
+    params.handle = handle;
+    params.writeOp = 0;
+    params.offset = 0;
+    params.len = length;
+    params.data = _gattServer.values[handle];
+
+    _gattServer.dataWrittenCallChain.call(&params);
+}
+
+void BLE::hostSubscribe(GattAttribute::Handle_t valueHandle, bool enable)
+{
+    const uint8_t cccd[2] = { (uint8_t)(enable ? 0x01 : 0x00), 0x00 };
+
+    hostWrite(valueHandle + 1, cccd, sizeof(cccd));
+}
+
+bool BLE::hostNextEvent(uint32_t &time) const
+{
+    if (!_gattServer.connected)
+        return false;
+
+    if (_gap.radioNotificationEnabled && !radioNotified)
+        time = nextConnectionEvent - radioLead;
+    else
+        time = nextConnectionEvent;
+
+    return true;
+}
+
+void BLE::hostFireEvent(void)
+{
+    if (_gap.radioNotificationEnabled && !radioNotified) {
+        radioNotified = true;
+        _gap.radioNotificationCallback.call(true);
+        return;
+    }
+
+    connectionEvent();
+}
+
+void BLE::connectionEvent(void)
+{
+    GattServer &server = _gattServer;
+    unsigned sent = 0;
+
+    connectionEvents++;
+
+    while (server.queued && sent < notificationsPerEvent) {
+        host_notification_t notification = server.queue[0];
+
+        memmove(&server.queue[0], &server.queue[1], --server.queued * sizeof(server.queue[0]));
+        sent++;
+
+        notification.sentAt = us_ticker_read();
+
+        if (dropRate && host_random() % 100 < dropRate)
+            continue;
+
+        if (server.receivedCount < HOST_MAX_NOTIFICATIONS)
+            server.received[server.receivedCount] = notification;
+        server.receivedCount++;
+
+        /* The peer may write back, e.g. to acknowledge */
+        if (notificationCallback)
+            notificationCallback(&notification);
+    }
+
+    if (_gap.radioNotificationEnabled)
+        _gap.radioNotificationCallback.call(false);
+
+    nextConnectionEvent += _gap.connectionInterval * 1250;
+    radioNotified = false;
+
+    if (sent)
+        server.dataSentCallChain.call(sent);
+}
@@ -0,0 +1,558 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HOST_BLE_H_
+#define HOST_BLE_H_
+
+/*
+ * The subset of BLE_API used by BLE_HID, on top of a simulated stack and peer (see host_ble.cpp).
+ *
+ * The stack behaves like Nordic's: notifications are refused with BLE_ERROR_INVALID_STATE until
+ * the peer enables them, and with BLE_STACK_BUSY when its buffers are full. Queued notifications
+ * go on air at the next connection events, a few per event, after which onDataSent is called.
+ * Radio notifications fire shortly before each connection event.
+ */
+
+#include "mbed.h"
+
+enum ble_error_t {
+    BLE_ERROR_NONE = 0,
+    BLE_ERROR_BUFFER_OVERFLOW = 1,
+    BLE_ERROR_NOT_IMPLEMENTED = 2,
+    BLE_ERROR_PARAM_OUT_OF_RANGE = 3,
+    BLE_ERROR_INVALID_PARAM = 4,
+    BLE_STACK_BUSY = 5,
+    BLE_ERROR_INVALID_STATE = 6,
+    BLE_ERROR_NO_MEM = 7,
+    BLE_ERROR_OPERATION_NOT_PERMITTED = 8,
+    BLE_ERROR_INITIALIZATION_INCOMPLETE = 9,
+    BLE_ERROR_ALREADY_INITIALIZED = 10,
+    BLE_ERROR_UNSPECIFIED = 11,
+};
+
+/** Callbacks registered by the services, called in order */
+template <typename ContextType, unsigned capacity = 8>
+class HostCallChain {
+public:
+    HostCallChain() :
+        count(0)
+    {
+    }
+
+    void add(void (*function)(ContextType))
+    {
+        MBED_ASSERT(count < capacity);
+        chain[count++].attach(function);
+    }
+
+    template<typename T>
+    void add(T *object, void (T::*member)(ContextType))
+    {
+        MBED_ASSERT(count < capacity);
+        chain[count++].attach(object, member);
+    }
+
+    void call(ContextType context)
+    {
+        for (unsigned i = 0; i < count; i++)
+            chain[i].call(context);
+    }
+
+protected:
+    FunctionPointerWithContext<ContextType> chain[capacity];
+    unsigned count;
+};
+
+class UUID {
+public:
+    UUID(uint16_t _shortUUID = 0) :
+        shortUUID(_shortUUID)
+    {
+    }
+
+    uint16_t getShortUUID(void) const
+    {
+        return shortUUID;
+    }
+
+protected:
+    uint16_t shortUUID;
+};
+
+class GattAttribute {
+public:
+    typedef uint16_t Handle_t;
+
+    /** Handles are allocated at construction, in order */
+    GattAttribute(const UUID &uuid, uint8_t *valuePtr = NULL, uint16_t len = 0,
+                  uint16_t maxLen = 0, bool hasVariableLen = true) :
+        handle(nextHandle++)
+    {
+    }
+
+    Handle_t getHandle(void) const
+    {
+        return handle;
+    }
+
+    static Handle_t nextHandle;
+
+protected:
+    Handle_t handle;
+};
+
+struct GattWriteCallbackParams {
+    uint16_t connHandle;
+    GattAttribute::Handle_t handle;
+    int writeOp;
+    uint16_t offset;
+    uint16_t len;
+    const uint8_t *data;
+};
+
+class SecurityManager {
+public:
+    enum SecurityMode_t {
+        SECURITY_MODE_NO_ACCESS,
+        SECURITY_MODE_ENCRYPTION_OPEN_LINK,
+        SECURITY_MODE_ENCRYPTION_NO_MITM,
+        SECURITY_MODE_ENCRYPTION_WITH_MITM,
+    };
+
+    enum LinkSecurityStatus_t {
+        NOT_ENCRYPTED,
+        ENCRYPTION_IN_PROGRESS,
+        ENCRYPTED,
+    };
+
+    SecurityManager() :
+        linkSecurity(ENCRYPTED)
+    {
+    }
+
+    ble_error_t getLinkSecurity(uint16_t connectionHandle, LinkSecurityStatus_t *status)
+    {
+        *status = linkSecurity;
+        return BLE_ERROR_NONE;
+    }
+
+    /* Simulation */
+    LinkSecurityStatus_t linkSecurity;
+};
+
+class GattCharacteristic {
+public:
+    enum {
+        UUID_HID_INFORMATION_CHAR = 0x2A4A,
+        UUID_REPORT_MAP_CHAR = 0x2A4B,
+        UUID_HID_CONTROL_POINT_CHAR = 0x2A4C,
+        UUID_REPORT_CHAR = 0x2A4D,
+        UUID_PROTOCOL_MODE_CHAR = 0x2A4E,
+    };
+
+    enum {
+        BLE_GATT_CHAR_PROPERTIES_READ = 0x02,
+        BLE_GATT_CHAR_PROPERTIES_WRITE_WITHOUT_RESPONSE = 0x04,
+        BLE_GATT_CHAR_PROPERTIES_WRITE = 0x08,
+        BLE_GATT_CHAR_PROPERTIES_NOTIFY = 0x10,
+    };
+
+    /** The value handle is followed by the handle of the CCCD */
+    GattCharacteristic(const UUID &uuid, uint8_t *valuePtr = NULL, uint16_t len = 0,
+                       uint16_t maxLen = 0, uint8_t props = 0,
+                       GattAttribute *descriptors[] = NULL, unsigned numDescriptors = 0,
+                       bool hasVariableLen = true) :
+        valueAttribute(uuid, valuePtr, len, maxLen, hasVariableLen),
+        properties(props)
+    {
+        GattAttribute::nextHandle++;
+    }
+
+    void requireSecurity(SecurityManager::SecurityMode_t mode)
+    {
+    }
+
+    GattAttribute::Handle_t getValueHandle(void) const
+    {
+        return valueAttribute.getHandle();
+    }
+
+    GattAttribute &getValueAttribute(void)
+    {
+        return valueAttribute;
+    }
+
+    uint8_t getProperties(void) const
+    {
+        return properties;
+    }
+
+protected:
+    GattAttribute valueAttribute;
+    uint8_t properties;
+};
+
+template <typename T>
+class ReadOnlyGattCharacteristic : public GattCharacteristic {
+public:
+    ReadOnlyGattCharacteristic(const UUID &uuid, T *valuePtr, uint8_t additionalProperties = 0,
+                               GattAttribute *descriptors[] = NULL,
+                               unsigned numDescriptors = 0) :
+        GattCharacteristic(uuid, (uint8_t *)valuePtr, sizeof(T), sizeof(T),
+                           BLE_GATT_CHAR_PROPERTIES_READ | additionalProperties,
+                           descriptors, numDescriptors, false)
+    {
+    }
+};
+
+class GattService {
+public:
+    enum {
+        UUID_HUMAN_INTERFACE_DEVICE_SERVICE = 0x1812,
+    };
+
+    GattService(const UUID &uuid, GattCharacteristic *characteristics[],
+                unsigned numCharacteristics) :
+        characteristics(characteristics),
+        count(numCharacteristics)
+    {
+    }
+
+    GattCharacteristic **characteristics;
+    unsigned count;
+};
+
+class GapAdvertisingParams {
+public:
+    enum AdvertisingType_t {
+        ADV_CONNECTABLE_UNDIRECTED,
+        ADV_CONNECTABLE_DIRECTED,
+        ADV_SCANNABLE_UNDIRECTED,
+        ADV_NON_CONNECTABLE_UNDIRECTED,
+    };
+};
+
+class Gap {
+public:
+    typedef uint16_t Handle_t;
+
+    enum { ADDR_LEN = 6 };
+    typedef uint8_t Address_t[ADDR_LEN];
+
+    enum AddressType_t {
+        ADDR_TYPE_PUBLIC,
+        ADDR_TYPE_RANDOM_STATIC,
+    };
+
+    enum Role_t {
+        PERIPHERAL,
+        CENTRAL,
+    };
+
+    enum DisconnectionReason_t {
+        CONNECTION_TIMEOUT = 0x08,
+        REMOTE_USER_TERMINATED_CONNECTION = 0x13,
+        LOCAL_HOST_TERMINATED_CONNECTION = 0x16,
+    };
+
+    struct ConnectionParams_t {
+        uint16_t minConnectionInterval;
+        uint16_t maxConnectionInterval;
+        uint16_t slaveLatency;
+        uint16_t connectionSupervisionTimeout;
+    };
+
+    struct ConnectionCallbackParams_t {
+        Handle_t handle;
+        Role_t role;
+        AddressType_t peerAddrType;
+        Address_t peerAddr;
+        AddressType_t ownAddrType;
+        Address_t ownAddr;
+        const ConnectionParams_t *connectionParams;
+    };
+
+    struct DisconnectionCallbackParams_t {
+        Handle_t handle;
+        DisconnectionReason_t reason;
+    };
+
+    static uint16_t MSEC_TO_GAP_DURATION_UNITS(uint32_t durationInMillis)
+    {
+        return (durationInMillis * 1000) / 1250;
+    }
+
+    Gap();
+
+    template<typename T>
+    void onConnection(T *object, void (T::*member)(const ConnectionCallbackParams_t *))
+    {
+        connectionCallChain.add(object, member);
+    }
+
+    template<typename T>
+    void onDisconnection(T *object, void (T::*member)(const DisconnectionCallbackParams_t *))
+    {
+        disconnectionCallChain.add(object, member);
+    }
+
+    /** BLE_API holds a single radio notification callback */
+    template<typename T>
+    void onRadioNotification(T *object, void (T::*member)(bool))
+    {
+        radioNotificationCallback.attach(object, member);
+    }
+
+    ble_error_t initRadioNotification(void)
+    {
+        radioNotificationEnabled = true;
+        return BLE_ERROR_NONE;
+    }
+
+    ble_error_t setPreferredConnectionParams(const ConnectionParams_t *params)
+    {
+        preferredParams = *params;
+        return BLE_ERROR_NONE;
+    }
+
+    ble_error_t getPreferredConnectionParams(ConnectionParams_t *params)
+    {
+        *params = preferredParams;
+        return BLE_ERROR_NONE;
+    }
+
+    /** Applied by the simulated central right away */
+    ble_error_t updateConnectionParams(Handle_t handle, const ConnectionParams_t *params);
+
+    void setAdvertisingType(GapAdvertisingParams::AdvertisingType_t type)
+    {
+        advertisingType = type;
+    }
+
+    void setAdvertisingInterval(uint16_t interval)
+    {
+        advertisingInterval = interval;
+    }
+
+    ble_error_t startAdvertising(void)
+    {
+        advertising = true;
+        return BLE_ERROR_NONE;
+    }
+
+    ble_error_t stopAdvertising(void)
+    {
+        advertising = false;
+        return BLE_ERROR_NONE;
+    }
+
+    /* Simulation */
+    HostCallChain<const ConnectionCallbackParams_t *> connectionCallChain;
+    HostCallChain<const DisconnectionCallbackParams_t *> disconnectionCallChain;
+    FunctionPointerWithContext<bool> radioNotificationCallback;
+    bool radioNotificationEnabled;
+
+    ConnectionParams_t preferredParams;
+    /// Interval of the current connection, in units of 1.25ms
+    uint16_t connectionInterval;
+    uint16_t slaveLatency;
+
+    bool advertising;
+    GapAdvertisingParams::AdvertisingType_t advertisingType;
+    uint16_t advertisingInterval;
+};
+
+/** Largest attribute value kept by the simulated GATT server */
+#define HOST_ATTRIBUTE_SIZE     64
+
+/** Number of attributes of the simulated GATT server */
+#define HOST_MAX_HANDLES        64
+
+/** Notification buffers of the simulated stack (the S110 SoftDevice has 7) */
+#define HOST_TX_BUFFERS         7
+
+/** Record of the notifications received by the simulated peer */
+#define HOST_MAX_NOTIFICATIONS  4096
+
+typedef struct {
+    GattAttribute::Handle_t handle;
+    uint16_t length;
+    uint8_t data[HOST_ATTRIBUTE_SIZE];
+    /// Time at which the stack accepted the notification, and at which it went on air
+    uint32_t queuedAt;
+    uint32_t sentAt;
+} host_notification_t;
+
+class GattServer {
+public:
+    GattServer();
+
+    ble_error_t addService(GattService &service);
+
+    /**
+     * Set a value. Unless localOnly, notify it if the characteristic has a CCCD: the peer must
+     * have enabled notifications, and a buffer must be free.
+     */
+    ble_error_t write(GattAttribute::Handle_t handle, const uint8_t *value, uint16_t length,
+                      bool localOnly = false);
+
+    ble_error_t write(Gap::Handle_t connectionHandle, GattAttribute::Handle_t handle,
+                      const uint8_t *value, uint16_t length, bool localOnly = false)
+    {
+        return write(handle, value, length, localOnly);
+    }
+
+    ble_error_t read(GattAttribute::Handle_t handle, uint8_t *value, uint16_t *length);
+
+    ble_error_t areUpdatesEnabled(const GattCharacteristic &characteristic, bool *enabled)
+    {
+        *enabled = isSubscribed(characteristic.getValueHandle());
+        return BLE_ERROR_NONE;
+    }
+
+    template<typename T>
+    void onDataSent(T *object, void (T::*member)(unsigned))
+    {
+        dataSentCallChain.add(object, member);
+    }
+
+    template<typename T>
+    void onDataWritten(T *object, void (T::*member)(const GattWriteCallbackParams *))
+    {
+        dataWrittenCallChain.add(object, member);
+    }
+
+    /* Simulation */
+    bool isSubscribed(GattAttribute::Handle_t valueHandle) const
+    {
+        return valueHandle + 1 < HOST_MAX_HANDLES && values[valueHandle + 1][0] & 0x01;
+    }
+
+    /** Drop the notifications that didn't go on air, and the subscriptions */
+    void resetLink(void);
+
+    HostCallChain<unsigned> dataSentCallChain;
+    HostCallChain<const GattWriteCallbackParams *> dataWrittenCallChain;
+
+    uint8_t values[HOST_MAX_HANDLES][HOST_ATTRIBUTE_SIZE];
+    uint16_t lengths[HOST_MAX_HANDLES];
+    uint8_t properties[HOST_MAX_HANDLES];
+
+    bool connected;
+    unsigned txBuffers;
+    /// Notifications accepted by the stack and not sent yet, oldest first
+    host_notification_t queue[HOST_TX_BUFFERS];
+    unsigned queued;
+
+    /// Notifications received by the peer. Only the first HOST_MAX_NOTIFICATIONS are kept.
+    host_notification_t received[HOST_MAX_NOTIFICATIONS];
+    unsigned receivedCount;
+};
+
+/**
+ * Called by the simulated peer for each notification it receives, on air
+ */
+typedef void (*host_notification_callback_t)(const host_notification_t *notification);
+
+class BLE {
+public:
+    BLE();
+
+    ble_error_t init(void)
+    {
+        return BLE_ERROR_NONE;
+    }
+
+    Gap &gap(void)
+    {
+        return _gap;
+    }
+
+    GattServer &gattServer(void)
+    {
+        return _gattServer;
+    }
+
+    SecurityManager &securityManager(void)
+    {
+        return _securityManager;
+    }
+
+    void waitForEvent(void)
+    {
+    }
+
+    /*
+     * Simulated peer. Connection events are scheduled on the simulated clock, and run by
+     * host_run().
+     */
+
+    /**
+     * Connect to the device, as a central would
+     *
+     * @param intervalMs    Connection interval, in ms
+     * @param perEvent      Notifications sent on each connection event
+     */
+    void hostConnect(float intervalMs = 7.5, unsigned perEvent = 4,
+                     uint8_t peerAddressByte = 0x42);
+
+    void hostDisconnect(Gap::DisconnectionReason_t reason
+                        = Gap::REMOTE_USER_TERMINATED_CONNECTION);
+
+    /** Write an attribute, from the peer. The data is passed to onDataWritten synchronously. */
+    void hostWrite(GattAttribute::Handle_t handle, const uint8_t *data, uint16_t length);
+
+    /** Enable or disable notifications of a characteristic, from the peer */
+    void hostSubscribe(GattAttribute::Handle_t valueHandle, bool enable = true);
+
+    /**
+     * Time of the next radio notification or connection event, for host_run()
+     *
+     * @return false if there is none
+     */
+    bool hostNextEvent(uint32_t &time) const;
+
+    /** Run the event returned by hostNextEvent() */
+    void hostFireEvent(void);
+
+    bool hostIsConnected(void) const
+    {
+        return _gattServer.connected;
+    }
+
+    /// Time of the next connection event, valid while connected
+    uint32_t nextConnectionEvent;
+    /// Radio notifications fire this long before connection events, in us
+    uint32_t radioLead;
+    unsigned notificationsPerEvent;
+    /// Probability, in percent, that the peer's HID driver discards a notification it received
+    unsigned dropRate;
+    host_notification_callback_t notificationCallback;
+
+    uint32_t connectionEvents;
+
+protected:
+    void connectionEvent(void);
+
+    /// The radio notification of the next connection event has fired
+    bool radioNotified;
+
+    Gap _gap;
+    GattServer _gattServer;
+    SecurityManager _securityManager;
+};
+
+#endif /* !HOST_BLE_H_ */
@@ -0,0 +1,374 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HOST_MBED_H_
+#define HOST_MBED_H_
+
+/*
+ * The subset of the mbed SDK used by BLE_HID, for host tests. Time is simulated: it only moves
+ * when a test calls host_run() (see host.h) or wait_us(), and timeouts fire on the way.
+ */
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MBED_ASSERT(expr) assert(expr)
+
+/*
+ * Tests run the library on a single thread, except for the PointerState stress test, whose
+ * writers serialize themselves. There are no interrupts to mask, but barriers must be real.
+ */
+static inline void __disable_irq(void) {}
+static inline void __enable_irq(void) {}
+static inline void __DMB(void) { __sync_synchronize(); }
+
+uint32_t us_ticker_read(void);
+
+/** Busy waits advance the simulated time, without running timeouts */
+void wait_us(int us);
+
+static inline void wait_ms(int ms)
+{
+    wait_us(ms * 1000);
+}
+
+static inline void wait(float s)
+{
+    wait_us((int)(s * 1000000));
+}
+
+/**
+ * Calls a function or a member function, as mbed's FunctionPointer
+ */
+class FunctionPointer {
+public:
+    FunctionPointer(void (*function)(void) = NULL)
+    {
+        attach(function);
+    }
+
+    template<typename T>
+    FunctionPointer(T *object, void (T::*member)(void))
+    {
+        attach(object, member);
+    }
+
+    void attach(void (*function)(void))
+    {
+        _function = function;
+        _object = NULL;
+        _membercaller = NULL;
+    }
+
+    template<typename T>
+    void attach(T *object, void (T::*member)(void))
+    {
+        MBED_ASSERT(sizeof(member) <= sizeof(_member));
+
+        _function = NULL;
+        _object = object;
+        memcpy(_member, (char *)&member, sizeof(member));
+        _membercaller = &FunctionPointer::membercaller<T>;
+    }
+
+    void call(void)
+    {
+        if (_function)
+            _function();
+        else if (_object && _membercaller)
+            _membercaller(_object, _member);
+    }
+
+    void operator()(void)
+    {
+        call();
+    }
+
+private:
+    template<typename T>
+    static void membercaller(void *object, char *member)
+    {
+        void (T::*m)(void);
+
+        memcpy((char *)&m, member, sizeof(m));
+        (static_cast<T *>(object)->*m)();
+    }
+
+    void (*_function)(void);
+    void *_object;
+    char _member[16];
+    void (*_membercaller)(void *, char *);
+};
+
+/**
+ * Same, with an argument
+ */
+template <typename ContextType>
+class FunctionPointerWithContext {
+public:
+    typedef void (*pvoidfcontext_t)(ContextType context);
+
+    FunctionPointerWithContext(void (*function)(ContextType context) = NULL)
+    {
+        attach(function);
+    }
+
+    template<typename T>
+    FunctionPointerWithContext(T *object, void (T::*member)(ContextType context))
+    {
+        attach(object, member);
+    }
+
+    void attach(void (*function)(ContextType context))
+    {
+        _function = function;
+        _object = NULL;
+        _membercaller = NULL;
+    }
+
+    template<typename T>
+    void attach(T *object, void (T::*member)(ContextType context))
+    {
+        MBED_ASSERT(sizeof(member) <= sizeof(_member));
+
+        _function = NULL;
+        _object = object;
+        memcpy(_member, (char *)&member, sizeof(member));
+        _membercaller = &FunctionPointerWithContext::membercaller<T>;
+    }
+
+    void call(ContextType context)
+    {
+        if (_function)
+            _function(context);
+        else if (_object && _membercaller)
+            _membercaller(_object, _member, context);
+    }
+
+    bool isAttached(void) const
+    {
+        return _function || _object;
+    }
+
+private:
+    template<typename T>
+    static void membercaller(void *object, char *member, ContextType context)
+    {
+        void (T::*m)(ContextType);
+
+        memcpy((char *)&m, member, sizeof(m));
+        (static_cast<T *>(object)->*m)(context);
+    }
+
+    void (*_function)(ContextType context);
+    void *_object;
+    char _member[16];
+    void (*_membercaller)(void *, char *, ContextType);
+};
+
+/**
+ * One-shot timer on the simulated clock. Fired by host_run(), which counts each one as a wakeup.
+ */
+class Timeout {
+public:
+    Timeout();
+    virtual ~Timeout();
+
+    void attach_us(void (*function)(void), uint32_t us)
+    {
+        callback.attach(function);
+        arm(us);
+    }
+
+    template<typename T>
+    void attach_us(T *object, void (T::*member)(void), uint32_t us)
+    {
+        callback.attach(object, member);
+        arm(us);
+    }
+
+    void detach(void);
+
+    /* Simulation */
+    bool isArmed(void) const
+    {
+        return armed;
+    }
+
+    uint32_t getDeadline(void) const
+    {
+        return deadline;
+    }
+
+    void fire(void);
+
+    Timeout *next;
+
+protected:
+    void arm(uint32_t us);
+
+    FunctionPointer callback;
+    bool armed;
+    uint32_t deadline;
+};
+
+/**
+ * Stopwatch on the simulated clock
+ */
+class Timer {
+public:
+    Timer() :
+        running(false),
+        startTime(0),
+        accumulated(0)
+    {
+    }
+
+    void start(void)
+    {
+        if (running)
+            return;
+        startTime = us_ticker_read();
+        running = true;
+    }
+
+    void stop(void)
+    {
+        accumulated = read_us();
+        running = false;
+    }
+
+    void reset(void)
+    {
+        startTime = us_ticker_read();
+        accumulated = 0;
+    }
+
+    int read_us(void)
+    {
+        return accumulated + (running ? us_ticker_read() - startTime : 0);
+    }
+
+    int read_ms(void)
+    {
+        return read_us() / 1000;
+    }
+
+    float read(void)
+    {
+        return read_us() / 1000000.0f;
+    }
+
+protected:
+    bool running;
+    uint32_t startTime;
+    uint32_t accumulated;
+};
+
+enum PinName {
+    p0, p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15,
+    p16, p17, p18, p19, p20, p21, p22, p23, p24, p25, p26, p27, p28, p29, p30, p31,
+    NC = (int)0xFFFFFFFF
+};
+
+enum PinMode { PullNone, PullUp, PullDown };
+enum PinDirection { PIN_INPUT, PIN_OUTPUT };
+
+/**
+ * GPIO HAL. Pins are wired to the host_gpio_* hooks of the test, if any. Inputs read high.
+ */
+typedef struct {
+    PinName pin;
+} gpio_t;
+
+extern int (*host_gpio_read)(PinName pin);
+extern void (*host_gpio_write)(PinName pin, int value);
+extern void (*host_gpio_dir)(PinName pin, PinDirection direction);
+
+static inline void gpio_init_in(gpio_t *gpio, PinName pin)
+{
+    gpio->pin = pin;
+    if (host_gpio_dir)
+        host_gpio_dir(pin, PIN_INPUT);
+}
+
+static inline void gpio_init_in_ex(gpio_t *gpio, PinName pin, PinMode mode)
+{
+    gpio_init_in(gpio, pin);
+}
+
+static inline void gpio_dir(gpio_t *gpio, PinDirection direction)
+{
+    if (host_gpio_dir)
+        host_gpio_dir(gpio->pin, direction);
+}
+
+static inline void gpio_write(gpio_t *gpio, int value)
+{
+    if (host_gpio_write)
+        host_gpio_write(gpio->pin, value);
+}
+
+static inline int gpio_read(gpio_t *gpio)
+{
+    return host_gpio_read ? host_gpio_read(gpio->pin) : 1;
+}
+
+/**
+ * Character stream, as mbed's Stream: printf() goes through _putc()
+ */
+class Stream {
+public:
+    Stream(const char *name = NULL) {}
+    virtual ~Stream() {}
+
+    int putc(int c)
+    {
+        return _putc(c);
+    }
+
+    int puts(const char *s)
+    {
+        while (*s)
+            _putc(*s++);
+        return 0;
+    }
+
+    int printf(const char *format, ...)
+    {
+        char buffer[256];
+        va_list args;
+
+        va_start(args, format);
+        int length = vsnprintf(buffer, sizeof(buffer), format, args);
+        va_end(args);
+
+        for (int i = 0; i < length && buffer[i]; i++)
+            _putc(buffer[i]);
+
+        return length;
+    }
+
+protected:
+    virtual int _putc(int c) = 0;
+    virtual int _getc() = 0;
+};
+
+#endif /* !HOST_MBED_H_ */
@@ -0,0 +1,277 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * KeyBuffer: encoding of the records, wraparound, and a producer and a consumer running
+ * concurrently, which stand for the main loop and the report ticker.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "host.h"
+#include "KeyBuffer.h"
+
+/**
+ * The n-th event of a sequence that uses every record type and length
+ */
+static key_event_t sequence(unsigned n)
+{
+    key_event_t event;
+
+    event.data = 0;
+    event.duration = 0;
+
+    switch (n % 6) {
+    case 0:
+    case 1:
+        event.type = KEY_EVENT_CHAR;
+        event.data = 1 + n % (KEY_EVENT_ESCAPE - 1);
+        break;
+    case 2:
+        event.type = KEY_EVENT_TAP;
+        event.data = n;
+        break;
+    case 3:
+        event.type = KEY_EVENT_HOLD;
+        event.data = n;
+        event.duration = n >> 8;
+        break;
+    case 4:
+        event.type = KEY_EVENT_PAUSE;
+        event.duration = n;
+        break;
+    default:
+        event.type = KEY_EVENT_MODIFIERS;
+        event.data = n >> 3;
+        break;
+    }
+
+    return event;
+}
+
+static bool push(KeyBuffer &buffer, const key_event_t &event)
+{
+    return buffer.push(event.type, event.data, event.duration);
+}
+
+static bool equal(const key_event_t &a, const key_event_t &b)
+{
+    return a.type == b.type && a.data == b.data && a.duration == b.duration;
+}
+
+static void test_records(void)
+{
+    KeyBuffer buffer;
+    key_event_t event;
+
+    CHECK(buffer.empty());
+    CHECK(!buffer.peek(event));
+    CHECK(!buffer.pop(event));
+    CHECK_EQUAL(KEYBUFFER_SIZE - 1, buffer.available());
+
+    /* One byte per character, two or three per escaped record */
+    CHECK(buffer.push(KEY_EVENT_CHAR, 'a'));
+    CHECK_EQUAL(1, buffer.size());
+    CHECK(buffer.push(KEY_EVENT_TAP, 0x2b));
+    CHECK_EQUAL(3, buffer.size());
+    CHECK(buffer.push(KEY_EVENT_HOLD, 0xe1, 30));
+    CHECK_EQUAL(6, buffer.size());
+    CHECK(buffer.push(KEY_EVENT_PAUSE, 0, 20));
+    CHECK_EQUAL(8, buffer.size());
+    CHECK_EQUAL(KEYBUFFER_SIZE - 1 - 8, buffer.available());
+
+    /* Characters can't be confused with escape bytes */
+    CHECK(!buffer.push(KEY_EVENT_CHAR, KEY_EVENT_ESCAPE));
+    CHECK(!buffer.push(KEY_EVENT_CHAR, 0xff));
+    CHECK_EQUAL(8, buffer.size());
+
+    /* peek() leaves the event in place */
+    CHECK(buffer.peek(event));
+    CHECK(buffer.peek(event));
+    CHECK_EQUAL(KEY_EVENT_CHAR, event.type);
+    CHECK_EQUAL('a', event.data);
+    CHECK_EQUAL(8, buffer.size());
+
+    CHECK(buffer.pop(event));
+    CHECK_EQUAL('a', event.data);
+    CHECK(buffer.pop(event));
+    CHECK_EQUAL(KEY_EVENT_TAP, event.type);
+    CHECK_EQUAL(0x2b, event.data);
+    CHECK(buffer.pop(event));
+    CHECK_EQUAL(KEY_EVENT_HOLD, event.type);
+    CHECK_EQUAL(0xe1, event.data);
+    CHECK_EQUAL(30, event.duration);
+    CHECK(buffer.pop(event));
+    CHECK_EQUAL(KEY_EVENT_PAUSE, event.type);
+    CHECK_EQUAL(0, event.data);
+    CHECK_EQUAL(20, event.duration);
+
+    CHECK(buffer.empty());
+    CHECK(!buffer.pop(event));
+}
+
+static void test_full(void)
+{
+    KeyBuffer buffer;
+    key_event_t event;
+    unsigned pushed = 0;
+
+    while (buffer.push(KEY_EVENT_CHAR, 'x'))
+        pushed++;
+
+    CHECK_EQUAL(KEYBUFFER_SIZE - 1, pushed);
+    CHECK_EQUAL(0, buffer.available());
+
+    /* A record goes in whole or not at all */
+    CHECK(buffer.pop(event));
+    CHECK(!buffer.push(KEY_EVENT_TAP, 0x04));
+    CHECK_EQUAL(KEYBUFFER_SIZE - 2, buffer.size());
+    CHECK(buffer.pop(event));
+
+    /* Positions: begin() reaches the end() taken before a record once the ones before are gone */
+    unsigned marker = buffer.end();
+
+    CHECK(buffer.push(KEY_EVENT_TAP, 0x04));
+    CHECK_EQUAL(0, buffer.available());
+
+    while (buffer.begin() != marker) {
+        CHECK(buffer.pop(event));
+        CHECK_EQUAL(KEY_EVENT_CHAR, event.type);
+    }
+    CHECK(buffer.pop(event));
+    CHECK_EQUAL(KEY_EVENT_TAP, event.type);
+    CHECK(buffer.empty());
+}
+
+static void test_wraparound(void)
+{
+    KeyBuffer buffer;
+    key_event_t event = key_event_t();
+    bool same = true;
+    unsigned pushed = 0;
+    unsigned popped = 0;
+
+    /* Records of one to three bytes split at every position of the ring */
+    while (popped < 10 * KEYBUFFER_SIZE) {
+        while (push(buffer, sequence(pushed)))
+            pushed++;
+
+        for (unsigned i = 0; i < 7 && buffer.pop(event); i++) {
+            if (!equal(event, sequence(popped)))
+                same = false;
+            popped++;
+        }
+    }
+
+    CHECK(same);
+    CHECK(pushed > popped);
+}
+
+static void test_decode(void)
+{
+    /* Records of a macro decode like those of the buffer */
+    static const uint8_t macro[] = {
+        'a', KEY_MACRO_TAP(0x2b), KEY_MACRO_HOLD(0xe1, 300), KEY_MACRO_PAUSE(200),
+        KEY_MACRO_MODIFIERS(0x05), KEY_MACRO_END
+    };
+    KeyBuffer buffer;
+    const uint8_t *p = macro;
+    key_event_t decoded;
+    key_event_t event = key_event_t();
+    unsigned length;
+    unsigned records = 0;
+    bool same = true;
+
+    buffer.push(KEY_EVENT_CHAR, 'a');
+    buffer.push(KEY_EVENT_TAP, 0x2b);
+    buffer.push(KEY_EVENT_HOLD, 0xe1, 30);
+    buffer.push(KEY_EVENT_PAUSE, 0, 20);
+    buffer.push(KEY_EVENT_MODIFIERS, 0x05);
+
+    while ((length = decodeKeyEvent(p, decoded)) != 0) {
+        if (!buffer.pop(event) || !equal(event, decoded))
+            same = false;
+        p += length;
+        records++;
+    }
+
+    CHECK(same);
+    CHECK_EQUAL(5, records);
+    CHECK_EQUAL(sizeof(macro) - 1, (unsigned)(p - macro));
+    CHECK(buffer.empty());
+
+    /* Durations round up */
+    CHECK_EQUAL(1, KEY_MACRO_DURATION(1));
+    CHECK_EQUAL(30, KEY_MACRO_DURATION(300));
+    CHECK_EQUAL(255, KEY_MACRO_DURATION(2550));
+}
+
+static KeyBuffer shared;
+static const unsigned EVENTS = 2000000;
+
+/* Waiting threads yield, so that the test doesn't crawl on a single core */
+static void *producer(void *arg)
+{
+    for (unsigned n = 0; n < EVENTS; ) {
+        if (push(shared, sequence(n)))
+            n++;
+        else
+            sched_yield();
+    }
+
+    return NULL;
+}
+
+static void test_concurrent(void)
+{
+    pthread_t thread;
+    key_event_t event = key_event_t();
+    unsigned errors = 0;
+    unsigned empty = 0;
+
+    pthread_create(&thread, NULL, producer, NULL);
+
+    for (unsigned n = 0; n < EVENTS; ) {
+        if (!shared.pop(event)) {
+            empty++;
+            sched_yield();
+            continue;
+        }
+
+        if (!equal(event, sequence(n)))
+            errors++;
+        n++;
+    }
+
+    pthread_join(thread, NULL);
+
+    printf("concurrent: %u events, %u errors, buffer found empty %u times\n", EVENTS, errors,
+           empty);
+    CHECK_EQUAL(0, errors);
+    CHECK(shared.empty());
+}
+
+int main(void)
+{
+    test_records();
+    test_full();
+    test_wraparound();
+    test_decode();
+    test_concurrent();
+
+    return host_summary("key_buffer");
+}
@@ -0,0 +1,425 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * KeyMatrix: debouncing, ghosting, scan rate, and latency from a press to the report on air.
+ *
+ * The GPIO hooks simulate a matrix without diodes: a column reads low when closed switches connect
+ * it to the selected row, directly or through other rows and columns. Switches bounce for a while
+ * after each change.
+ */
+
+#include "host.h"
+#include "KeyMatrix.h"
+
+#define ROWS    4
+#define COLUMNS 5
+
+static const PinName rowPins[ROWS] = { p0, p1, p2, p3 };
+static const PinName columnPins[COLUMNS] = { p8, p9, p10, p11, p12 };
+
+static const uint8_t usages[ROWS * COLUMNS] = {
+    0x04, 0x05, 0x06, 0x07, 0x08,   // a b c d e
+    0x09, 0x0a, 0x0b, 0x0c, 0x0d,   // f g h i j
+    0x0e, 0x0f, 0x10, 0x11, 0x12,   // k l m n o
+    0xe1, 0x2c, 0x28, KEYMATRIX_NO_KEY, KEYMATRIX_NO_KEY,   // Left Shift, Space, Return
+};
+
+class TestKeyboardService: public KeyboardService {
+public:
+    TestKeyboardService(BLE &_ble) :
+        KeyboardService(_ble)
+    {
+    }
+
+    GattAttribute::Handle_t inputHandle(void) const
+    {
+        return inputReportCharacteristic->getValueHandle();
+    }
+};
+
+static BLE ble;
+static TestKeyboardService kbd(ble);
+static KeyMatrix matrix(kbd, rowPins, ROWS, columnPins, COLUMNS, usages);
+
+/*
+ * Simulated matrix
+ */
+struct switch_t {
+    bool closed;
+    uint32_t changedAt;
+    uint32_t bounceUs;
+};
+
+static switch_t switches[ROWS][COLUMNS];
+static bool rowDriven[ROWS];
+static bool rowLow[ROWS];
+
+/// Period of the contact bounces
+static const uint32_t BOUNCE_PERIOD_US = 250;
+
+static bool isClosed(const switch_t &s)
+{
+    uint32_t elapsed = us_ticker_read() - s.changedAt;
+
+    if (elapsed < s.bounceUs && (elapsed / BOUNCE_PERIOD_US) & 1)
+        return !s.closed;
+
+    return s.closed;
+}
+
+static int pinIndex(PinName pin, const PinName *pins, unsigned count)
+{
+    for (unsigned i = 0; i < count; i++) {
+        if (pins[i] == pin)
+            return i;
+    }
+
+    return -1;
+}
+
+static int gpioRead(PinName pin)
+{
+    int column = pinIndex(pin, columnPins, COLUMNS);
+    bool rowReached[ROWS];
+    bool columnReached[COLUMNS] = { false };
+    bool changed = true;
+
+    if (column < 0)
+        return 1;
+
+    for (unsigned row = 0; row < ROWS; row++)
+        rowReached[row] = rowDriven[row] && rowLow[row];
+
+    /* Spread the low level through closed switches */
+    while (changed) {
+        changed = false;
+
+        for (unsigned row = 0; row < ROWS; row++) {
+            for (unsigned c = 0; c < COLUMNS; c++) {
+                if (rowReached[row] == columnReached[c] || !isClosed(switches[row][c]))
+                    continue;
+
+                rowReached[row] = columnReached[c] = true;
+                changed = true;
+            }
+        }
+    }
+
+    return columnReached[column] ? 0 : 1;
+}
+
+static void gpioWrite(PinName pin, int value)
+{
+    int row = pinIndex(pin, rowPins, ROWS);
+
+    if (row >= 0)
+        rowLow[row] = !value;
+}
+
+static void gpioDir(PinName pin, PinDirection direction)
+{
+    int row = pinIndex(pin, rowPins, ROWS);
+
+    if (row >= 0)
+        rowDriven[row] = direction == PIN_OUTPUT;
+}
+
+static void setSwitch(unsigned row, unsigned column, bool closed, uint32_t bounceUs = 0)
+{
+    switches[row][column].closed = closed;
+    switches[row][column].changedAt = us_ticker_read();
+    switches[row][column].bounceUs = bounceUs;
+}
+
+/*
+ * Reports
+ */
+static bool isInReport(const host_notification_t &notification, uint8_t usage)
+{
+    if (usage >= KEY_USAGE_MODIFIER_MIN)
+        return notification.data[0] & (1 << (usage - KEY_USAGE_MODIFIER_MIN));
+
+#if KEYBOARD_NKRO
+    return notification.data[KEY_REPORT_KEYS_OFFSET + usage / 8] & (1 << (usage % 8));
+#else
+    for (unsigned i = KEY_REPORT_KEYS_OFFSET; i < notification.length; i++) {
+        if (notification.data[i] == usage)
+            return true;
+    }
+
+    return false;
+#endif
+}
+
+/**
+ * Find the first report sent since a given notification that has a key down, or up
+ *
+ * @return the index of the report, or -1
+ */
+static int findReport(unsigned from, uint8_t usage, bool down)
+{
+    GattServer &server = ble.gattServer();
+
+    for (unsigned i = from; i < server.receivedCount && i < HOST_MAX_NOTIFICATIONS; i++) {
+        if (isInReport(server.received[i], usage) == down)
+            return i;
+    }
+
+    return -1;
+}
+
+/**
+ * Wait long enough for any change to be debounced and reported
+ */
+static void settle(void)
+{
+    host_run(100000);
+}
+
+static void test_latency(void)
+{
+    GattServer &server = ble.gattServer();
+    static const unsigned PRESSES = 100;
+    static const uint32_t BOUNCE_US = 2000;
+    uint64_t total = 0;
+    uint32_t worst = 0;
+    unsigned found = 0;
+
+    host_seed(47);
+
+    for (unsigned i = 0; i < PRESSES; i++) {
+        /* Let the matrix go idle, and press at a random phase of its scans */
+        host_run(100000 + host_random() % 20000);
+
+        unsigned from = server.receivedCount;
+        uint32_t pressedAt = us_ticker_read();
+
+        setSwitch(0, 0, true, BOUNCE_US);
+        host_run(80000);
+        setSwitch(0, 0, false, BOUNCE_US);
+
+        int report = findReport(from, 0x04, true);
+
+        if (report < 0)
+            continue;
+
+        uint32_t latency = server.received[report].sentAt - pressedAt;
+
+        total += latency;
+        if (latency > worst)
+            worst = latency;
+        found++;
+    }
+
+    settle();
+    CHECK_EQUAL(PRESSES, found);
+
+    /*
+     * Bounces, then KEYMATRIX_DEBOUNCE_SCANS scans after an idle interval at most, then the next
+     * report tick (24ms), then the next connection event (7.5ms). Scans may be late by a quarter
+     * of their interval, to share wakeups.
+     */
+    uint32_t bound = BOUNCE_US + KEYMATRIX_IDLE_SCAN_INTERVAL_US * 5 / 4
+                   + (KEYMATRIX_DEBOUNCE_SCANS + 1) * KEYMATRIX_SCAN_INTERVAL_US * 5 / 4
+                   + 24000 + 7500;
+
+    printf("latency: press to air %.1fms on average, %.1fms at most (bound %.1fms)\n",
+           found ? (double)total / found / 1000 : 0, worst / 1000.0, bound / 1000.0);
+    CHECK(worst <= bound);
+}
+
+static void test_glitch(void)
+{
+    GattServer &server = ble.gattServer();
+    unsigned from = server.receivedCount;
+
+    /* Wake the matrix up, then close a switch for less than the debounce time */
+    setSwitch(2, 2, true);
+    settle();
+    setSwitch(2, 2, false);
+    settle();
+    from = server.receivedCount;
+
+    setSwitch(1, 3, true);
+    host_run(KEYMATRIX_SCAN_INTERVAL_US * (KEYMATRIX_DEBOUNCE_SCANS - 2));
+    setSwitch(1, 3, false);
+    settle();
+
+    CHECK(!matrix.isPressed(1, 3));
+    CHECK_EQUAL(-1, findReport(from, usages[1 * COLUMNS + 3], true));
+
+    /* Bounces don't release a held key */
+    setSwitch(1, 3, true, 3000);
+    settle();
+    from = server.receivedCount;
+
+    for (unsigned i = 0; i < 3; i++) {
+        setSwitch(1, 3, true, 1000);
+        settle();
+    }
+
+    CHECK(matrix.isPressed(1, 3));
+    CHECK_EQUAL(-1, findReport(from, usages[1 * COLUMNS + 3], false));
+
+    setSwitch(1, 3, false, 3000);
+    settle();
+    CHECK(!matrix.isPressed(1, 3));
+}
+
+static void test_chord(void)
+{
+    GattServer &server = ble.gattServer();
+    unsigned from = server.receivedCount;
+
+    /* Shift and a letter, closed together: they go out in the same report */
+    setSwitch(3, 0, true);
+    setSwitch(2, 4, true);
+    settle();
+
+    int shift = findReport(from, 0xe1, true);
+    int letter = findReport(from, 0x12, true);
+
+    CHECK(shift >= 0);
+    CHECK_EQUAL(shift, letter);
+
+    setSwitch(3, 0, false);
+    setSwitch(2, 4, false);
+    settle();
+    CHECK(!matrix.isPressed(3, 0));
+}
+
+static void test_ghosting(void)
+{
+    GattServer &server = ble.gattServer();
+    unsigned from = server.receivedCount;
+    uint32_t ghostScans = matrix.ghostScans;
+
+    /* Three corners of a rectangle: the fourth one, (1, 1), reads as pressed */
+    setSwitch(0, 0, true);
+    setSwitch(0, 1, true);
+    settle();
+    setSwitch(1, 0, true);
+    settle();
+
+    CHECK(matrix.ghostScans > ghostScans);
+    CHECK(matrix.isPressed(0, 0));
+    CHECK(matrix.isPressed(0, 1));
+    CHECK(!matrix.isPressed(1, 1));
+    CHECK_EQUAL(-1, findReport(from, usages[1 * COLUMNS + 1], true));
+
+    /* The press of (1, 0) couldn't be told apart from a ghost. It goes out once it can. */
+    CHECK(!matrix.isPressed(1, 0));
+    setSwitch(0, 1, false);
+    settle();
+    CHECK(matrix.isPressed(1, 0));
+    CHECK(!matrix.isPressed(1, 1));
+    CHECK(findReport(from, usages[1 * COLUMNS + 0], true) >= 0);
+
+    setSwitch(0, 0, false);
+    setSwitch(1, 0, false);
+    settle();
+
+    /* Without detection, the ghost is reported: the simulated matrix has no diodes */
+    matrix.setGhostDetection(false);
+    from = server.receivedCount;
+
+    setSwitch(0, 0, true);
+    setSwitch(0, 1, true);
+    setSwitch(1, 0, true);
+    settle();
+    CHECK(matrix.isPressed(1, 1));
+    CHECK(findReport(from, usages[1 * COLUMNS + 1], true) >= 0);
+
+    setSwitch(0, 0, false);
+    setSwitch(0, 1, false);
+    setSwitch(1, 0, false);
+    settle();
+    matrix.setGhostDetection(true);
+}
+
+static void test_idle(void)
+{
+    /* All keys up: one scan per KEYMATRIX_IDLE_SCAN_INTERVAL_US, and nothing else on timers */
+    settle();
+
+    uint32_t wakeups = host_timer_wakeups;
+
+    host_run(1000000);
+    wakeups = host_timer_wakeups - wakeups;
+
+    printf("idle: %u timer wakeups per second\n", (unsigned)wakeups);
+    CHECK(wakeups <= 1000000 / KEYMATRIX_IDLE_SCAN_INTERVAL_US + 1);
+
+    /* A held key keeps the fast scan rate */
+    setSwitch(2, 0, true);
+    settle();
+    wakeups = host_timer_wakeups;
+    host_run(100000);
+    wakeups = host_timer_wakeups - wakeups;
+    CHECK(wakeups >= 100000 / KEYMATRIX_SCAN_INTERVAL_US * 3 / 4);
+
+    setSwitch(2, 0, false);
+    settle();
+}
+
+static void test_stop(void)
+{
+    GattServer &server = ble.gattServer();
+
+    setSwitch(3, 1, true);
+    settle();
+    CHECK(matrix.isPressed(3, 1));
+
+    /* Keys down are released */
+    unsigned from = server.receivedCount;
+
+    matrix.stop();
+    settle();
+    CHECK(!matrix.isPressed(3, 1));
+    CHECK(findReport(from, 0x2c, false) >= 0);
+
+    /* And no more scans */
+    uint32_t wakeups = host_timer_wakeups;
+
+    host_run(1000000);
+    CHECK_EQUAL(0, host_timer_wakeups - wakeups);
+
+    setSwitch(3, 1, false);
+}
+
+int main(void)
+{
+    host_gpio_read = gpioRead;
+    host_gpio_write = gpioWrite;
+    host_gpio_dir = gpioDir;
+
+    ble.hostConnect(7.5, 4);
+    host_run(1000);
+    ble.hostSubscribe(kbd.inputHandle());
+    settle();
+
+    matrix.start();
+
+    test_latency();
+    test_glitch();
+    test_chord();
+    test_ghosting();
+    test_idle();
+    test_stop();
+
+    return host_summary("key_matrix");
+}
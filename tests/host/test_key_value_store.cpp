@@ -0,0 +1,285 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * FileKeyValueStore: values, compaction, persistence, and writes interrupted by a power loss.
+ */
+
+#include <unistd.h>
+
+#include "host.h"
+#include "KeyValueStore.h"
+
+static const uint32_t PAGE_SIZE = 256;
+
+static char path[64];
+
+/**
+ * Store that loses power after a given number of flash operations
+ */
+class FailingKeyValueStore : public FileKeyValueStore {
+public:
+    FailingKeyValueStore(const char *_path, unsigned _operations) :
+        FileKeyValueStore(_path, PAGE_SIZE),
+        operations(_operations)
+    {
+    }
+
+protected:
+    virtual bool program(uint32_t address, const uint32_t *data, unsigned words)
+    {
+        if (!operations)
+            return false;
+        operations--;
+        return FileKeyValueStore::program(address, data, words);
+    }
+
+    virtual bool erase(uint32_t address)
+    {
+        if (!operations)
+            return false;
+        operations--;
+        return FileKeyValueStore::erase(address);
+    }
+
+    unsigned operations;
+};
+
+static void test_values(void)
+{
+    FileKeyValueStore store(path, PAGE_SIZE);
+    uint32_t value = 0;
+    uint8_t bytes[8];
+
+    CHECK(!store.load(1, &value, sizeof(value)));
+
+    value = 0x12345678;
+    CHECK(store.store(1, &value, sizeof(value)));
+    value = 0;
+    CHECK(store.load(1, &value, sizeof(value)));
+    CHECK_EQUAL(0x12345678, value);
+
+    /* The latest record wins */
+    value = 0xcafe;
+    CHECK(store.store(1, &value, sizeof(value)));
+    CHECK(store.load(1, &value, sizeof(value)));
+    CHECK_EQUAL(0xcafe, value);
+
+    /* Lengths that aren't a multiple of a word, and empty values */
+    CHECK(store.store(2, "abc", 3));
+    memset(bytes, 0, sizeof(bytes));
+    CHECK(store.load(2, bytes, sizeof(bytes)));
+    CHECK(!memcmp(bytes, "abc", 3));
+    CHECK_EQUAL(0, bytes[3]);
+    CHECK(store.store(3, NULL, 0));
+    CHECK(store.load(3, bytes, sizeof(bytes)));
+
+    /* Short buffers get the beginning of the value */
+    CHECK(store.store(4, "0123456789", 10));
+    memset(bytes, 0, sizeof(bytes));
+    CHECK(store.load(4, bytes, 4));
+    CHECK(!memcmp(bytes, "0123", 4));
+    CHECK_EQUAL(0, bytes[4]);
+
+    /* Values that store() can't write */
+    uint8_t large[KVSTORE_MAX_VALUE_SIZE + 1];
+
+    memset(large, 0, sizeof(large));
+    CHECK(!store.store(5, large, sizeof(large)));
+    CHECK(store.store(5, large, KVSTORE_MAX_VALUE_SIZE));
+    CHECK(!store.store(0xffff, &value, sizeof(value)));
+    CHECK(!store.load(0xffff, &value, sizeof(value)));
+}
+
+static void test_compaction(void)
+{
+    unlink(path);
+
+    FileKeyValueStore store(path, PAGE_SIZE);
+    uint32_t values[3];
+    bool consistent = true;
+
+    /* Far more writes than a page holds */
+    for (uint32_t i = 0; i < 1000; i++) {
+        uint16_t key = 10 + i % 3;
+
+        values[i % 3] = i;
+        if (!store.store(key, &i, sizeof(i)))
+            consistent = false;
+
+        for (unsigned k = 0; k <= i && k < 3; k++) {
+            uint32_t value;
+
+            if (!store.load(10 + k, &value, sizeof(value)) || value != values[k])
+                consistent = false;
+        }
+    }
+    CHECK(consistent);
+
+    /* The file is still two pages */
+    FILE *file = fopen(path, "rb");
+
+    CHECK(file != NULL);
+    if (file) {
+        fseek(file, 0, SEEK_END);
+        CHECK_EQUAL(2 * PAGE_SIZE, (uint32_t)ftell(file));
+        fclose(file);
+    }
+}
+
+static void test_full(void)
+{
+    unlink(path);
+
+    FileKeyValueStore store(path, PAGE_SIZE);
+    uint8_t value[KVSTORE_MAX_VALUE_SIZE];
+    unsigned stored = 0;
+
+    /* Distinct keys, until the page is full of live records */
+    for (uint16_t key = 0; key < 100; key++) {
+        memset(value, key, sizeof(value));
+        if (!store.store(key, value, sizeof(value)))
+            break;
+        stored++;
+    }
+
+    /* The page header, then records of a header and the value */
+    CHECK_EQUAL((PAGE_SIZE - 4) / (4 + KVSTORE_MAX_VALUE_SIZE), stored);
+
+    /* A failed store loses nothing */
+    bool intact = true;
+
+    for (uint16_t key = 0; key < stored; key++) {
+        uint8_t expected[KVSTORE_MAX_VALUE_SIZE];
+
+        memset(expected, key, sizeof(expected));
+        if (!store.load(key, value, sizeof(value)) || memcmp(value, expected, sizeof(value)))
+            intact = false;
+    }
+    CHECK(intact);
+}
+
+static void test_persistence(void)
+{
+    unlink(path);
+
+    /* Enough writes to compact a few times, so that the second page is active */
+    {
+        FileKeyValueStore store(path, PAGE_SIZE);
+
+        for (uint32_t i = 0; i < 100; i++)
+            CHECK(store.store(20 + i % 2, &i, sizeof(i)));
+    }
+
+    FileKeyValueStore store(path, PAGE_SIZE);
+    uint32_t value;
+
+    CHECK(store.load(20, &value, sizeof(value)));
+    CHECK_EQUAL(98, value);
+    CHECK(store.load(21, &value, sizeof(value)));
+    CHECK_EQUAL(99, value);
+
+    /* Appending after a reopen */
+    value = 100;
+    CHECK(store.store(20, &value, sizeof(value)));
+    CHECK(store.load(20, &value, sizeof(value)));
+    CHECK_EQUAL(100, value);
+}
+
+/**
+ * Store a value with a power loss after each possible flash operation, then check on a reopen
+ * that the key holds either the previous value or the new one, and that the store still works.
+ */
+static void test_power_loss(void)
+{
+    unsigned bad = 0;
+    unsigned failures = 0;
+
+    for (unsigned operations = 0; operations < 24; operations++) {
+        unlink(path);
+
+        {
+            FileKeyValueStore store(path, PAGE_SIZE);
+
+            /* Just short of a compaction */
+            for (uint32_t i = 0; i < 28; i++)
+                store.store(30 + i % 4, &i, sizeof(i));
+        }
+
+        uint32_t previous[4];
+        {
+            FileKeyValueStore store(path, PAGE_SIZE);
+
+            for (uint16_t k = 0; k < 4; k++)
+                store.load(30 + k, &previous[k], sizeof(previous[k]));
+        }
+
+        /*
+         * Each store takes two operations, and the compaction of the fourth one an erase, two
+         * per live record, and the page header
+         */
+        uint32_t attempt = 0;
+        {
+            FailingKeyValueStore failing(path, operations);
+
+            for (uint32_t i = 100; i < 104 && !attempt; i++) {
+                if (failing.store(30 + i % 4, &i, sizeof(i)))
+                    previous[i % 4] = i;
+                else
+                    attempt = i;
+            }
+        }
+        if (attempt)
+            failures++;
+
+        FileKeyValueStore store(path, PAGE_SIZE);
+
+        for (uint16_t k = 0; k < 4; k++) {
+            uint32_t value;
+
+            /* The interrupted store may or may not have made it */
+            if (!store.load(30 + k, &value, sizeof(value))
+                    || (value != previous[k] && !(attempt % 4 == k && value == attempt)))
+                bad++;
+        }
+
+        uint32_t value = 200;
+
+        if (!store.store(31, &value, sizeof(value)) || !store.load(31, &value, sizeof(value))
+                || value != 200)
+            bad++;
+    }
+
+    printf("power loss: %u interrupted stores, %u bad outcomes\n", failures, bad);
+    CHECK(failures > 0);
+    CHECK_EQUAL(0, bad);
+}
+
+int main(void)
+{
+    snprintf(path, sizeof(path), "/tmp/test_key_value_store.%u", (unsigned)getpid());
+    unlink(path);
+
+    test_values();
+    test_compaction();
+    test_full();
+    test_persistence();
+    test_power_loss();
+
+    unlink(path);
+
+    return host_summary("key_value_store");
+}
@@ -0,0 +1,338 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Macros: playback over the simulated link, size, and decoding time.
+ *
+ * Reports received by the peer are turned back into text: each key that goes down is written as
+ * its character when the keymap has one for it and the modifiers of the report, and as
+ * <modifiers:usage> otherwise.
+ */
+
+#include <errno.h>
+#include <string>
+#include <time.h>
+
+#include "host.h"
+#include "KeyboardService.h"
+
+class TestKeyboardService: public KeyboardService {
+public:
+    TestKeyboardService(BLE &_ble) :
+        KeyboardService(_ble)
+    {
+    }
+
+    GattAttribute::Handle_t inputHandle(void) const
+    {
+        return inputReportCharacteristic->getValueHandle();
+    }
+};
+
+static BLE ble;
+static TestKeyboardService kbd(ble);
+
+/* Typical macros of a macro pad */
+static const uint8_t login[] = {
+    'a', 'l', 'i', 'c', 'e', KEY_MACRO_TAP(0x2b),
+    's', '3', 'c', 'r', '3', 't', '!', '\n',
+    KEY_MACRO_END
+};
+
+static const uint8_t openUrl[] = {
+    KEY_MACRO_DOWN(0xe0), KEY_MACRO_TAP(0x0f), KEY_MACRO_UP(0xe0),
+    KEY_MACRO_PAUSE(200),
+    'm', 'b', 'e', 'd', '.', 'o', 'r', 'g', '\n',
+    KEY_MACRO_END
+};
+
+static const uint8_t lockScreen[] = {
+    KEY_MACRO_MODIFIERS(KEY_CTRL | KEY_ALT), KEY_MACRO_TAP(0x4c), KEY_MACRO_MODIFIERS(0),
+    KEY_MACRO_END
+};
+
+static const uint8_t holdAndType[] = {
+    KEY_MACRO_HOLD(0xe1, 300), 'x',
+    KEY_MACRO_END
+};
+
+/* String literal, with a pause of 500ms */
+static const uint8_t greeting[] = "Hello\xfd\x32 world";
+
+static const struct {
+    const char *name;
+    const uint8_t *macro;
+    size_t size;
+    const char *typed;
+} macros[] = {
+    { "login",      login,          sizeof(login),          "alice\ts3cr3t!\n" },
+    { "open URL",   openUrl,        sizeof(openUrl),        "<01:0f>mbed.org\n" },
+    { "lock",       lockScreen,     sizeof(lockScreen),     "<05:4c>" },
+    { "hold",       holdAndType,    sizeof(holdAndType),    "<02:e1>x" },
+    { "greeting",   greeting,       sizeof(greeting),       "Hello world" },
+};
+
+static const unsigned MACROS = sizeof(macros) / sizeof(macros[0]);
+
+static bool hasKey(const host_notification_t &report, uint8_t usage)
+{
+#if KEYBOARD_NKRO
+    return report.data[KEY_REPORT_KEYS_OFFSET + usage / 8] & (1 << (usage % 8));
+#else
+    for (unsigned i = KEY_REPORT_KEYS_OFFSET; i < report.length; i++) {
+        if (report.data[i] == usage)
+            return true;
+    }
+
+    return false;
+#endif
+}
+
+/**
+ * @return true if any key other than modifiers is down, in either report format
+ */
+static bool hasKeys(const host_notification_t &report)
+{
+    for (unsigned i = KEY_REPORT_KEYS_OFFSET; i < report.length; i++) {
+        if (report.data[i])
+            return true;
+    }
+
+    return false;
+}
+
+/**
+ * Text typed by the reports received since a given one
+ */
+static std::string decode(unsigned from, unsigned to)
+{
+    GattServer &server = ble.gattServer();
+    host_notification_t previous;
+    std::string text;
+
+    memset(&previous, 0, sizeof(previous));
+    previous.length = KEYBOARD_INPUT_REPORT_SIZE;
+
+    for (unsigned i = from; i < to; i++) {
+        const host_notification_t &report = server.received[i];
+        uint8_t modifiers = report.data[0];
+
+        /* A modifier pressed and released on its own, such as a hold */
+        for (unsigned bit = 0; bit < 8; bit++) {
+            if ((modifiers & ~previous.data[0] & (1 << bit)) && modifiers == (1 << bit)
+                    && !hasKeys(report)
+                    && i + 1 < to && server.received[i + 1].data[0] == 0) {
+                char token[16];
+
+                snprintf(token, sizeof(token), "<%02x:%02x>", modifiers,
+                         KEY_USAGE_MODIFIER_MIN + bit);
+                text += token;
+            }
+        }
+
+        for (unsigned usage = 1; usage < KEY_USAGE_MODIFIER_MIN; usage++) {
+            if (!hasKey(report, usage) || hasKey(previous, usage))
+                continue;
+
+            int c = 0;
+
+            for (int k = 1; k < 128 && !c; k++) {
+                if (keymap[k].usage == usage && keymap[k].modifier == modifiers)
+                    c = k;
+            }
+
+            if (c) {
+                text += (char)c;
+            } else {
+                char token[16];
+
+                snprintf(token, sizeof(token), "<%02x:%02x>", modifiers, usage);
+                text += token;
+            }
+        }
+
+        previous = report;
+    }
+
+    return text;
+}
+
+static bool isDone(void)
+{
+    return !kbd.isPlayingMacro();
+}
+
+/**
+ * Play a macro, and wait until its reports are on air
+ *
+ * @return the index of the first report of the macro
+ */
+static unsigned play(const uint8_t *macro)
+{
+    unsigned from = ble.gattServer().receivedCount;
+
+    CHECK_EQUAL(0, kbd.playMacro(macro));
+    CHECK(host_run_until(isDone, 30000000));
+    host_run(200000);
+
+    return from;
+}
+
+static void test_playback(void)
+{
+    for (unsigned i = 0; i < MACROS; i++) {
+        unsigned from = play(macros[i].macro);
+        std::string typed = decode(from, ble.gattServer().receivedCount);
+
+        if (typed != macros[i].typed)
+            printf("%s: typed \"%s\"\n", macros[i].name, typed.c_str());
+        CHECK(typed == macros[i].typed);
+    }
+}
+
+static void test_timing(void)
+{
+    GattServer &server = ble.gattServer();
+
+    /* The pause of openUrl: from the report releasing Ctrl to the one pressing 'm' */
+    unsigned from = play(openUrl);
+    uint32_t released = 0;
+    uint32_t resumed = 0;
+
+    for (unsigned i = from; i < server.receivedCount; i++) {
+        if (!released && i > from && server.received[i].data[0] == 0
+                && server.received[i - 1].data[0] != 0)
+            released = server.received[i].sentAt;
+        if (released && hasKey(server.received[i], 0x10)) {
+            resumed = server.received[i].sentAt;
+            break;
+        }
+    }
+
+    printf("timing: 200ms pause lasted %.1fms on air\n", (resumed - released) / 1000.0);
+    CHECK(resumed - released >= 200000);
+    CHECK(resumed - released < 200000 + 3 * 24000);
+
+    /* Shift is held for 300ms */
+    from = play(holdAndType);
+    uint32_t down = 0;
+    uint32_t up = 0;
+
+    for (unsigned i = from; i < server.receivedCount; i++) {
+        if (!down && (server.received[i].data[0] & 0x02))
+            down = server.received[i].sentAt;
+        if (down && !(server.received[i].data[0] & 0x02)) {
+            up = server.received[i].sentAt;
+            break;
+        }
+    }
+
+    printf("timing: 300ms hold lasted %.1fms on air\n", (up - down) / 1000.0);
+    CHECK(up - down >= 300000);
+    CHECK(up - down < 300000 + 3 * 24000);
+}
+
+static void test_throughput(void)
+{
+    static uint8_t text[401];
+    GattServer &server = ble.gattServer();
+
+    /* Typical text: letters, with some repeated ones, which need a release in between */
+    for (unsigned i = 0; i < sizeof(text) - 1; i++)
+        text[i] = "the quick brown fox jumps over a lazy dog, then sleeps. "[i % 56];
+    text[sizeof(text) - 1] = KEY_MACRO_END;
+
+    uint32_t start = us_ticker_read();
+    unsigned from = server.receivedCount;
+
+    CHECK_EQUAL(0, kbd.playMacro(text));
+    CHECK(host_run_until(isDone, 60000000));
+
+    uint32_t elapsed = us_ticker_read() - start;
+    unsigned reports = server.receivedCount - from;
+    double chars = sizeof(text) - 1;
+
+    host_run(200000);
+    CHECK(decode(from, server.receivedCount) == std::string((const char *)text));
+
+    printf("throughput: %.0f characters/s, %.2f reports per character, %.1f reports/s\n",
+           chars * 1000000 / elapsed, reports / chars, reports * 1000000.0 / elapsed);
+
+    /* A character shares its press with the release of the previous one, unless they're equal */
+    CHECK(reports < chars * 3 / 2);
+}
+
+static void test_busy(void)
+{
+    CHECK_EQUAL(0, kbd.playMacro(login));
+    CHECK_EQUAL(EBUSY, kbd.playMacro(openUrl));
+    CHECK(host_run_until(isDone, 30000000));
+    host_run(200000);
+}
+
+static void benchmark(void)
+{
+    size_t total = 0;
+    unsigned records = 0;
+
+    for (unsigned i = 0; i < MACROS; i++) {
+        printf("size: %s, %u bytes\n", macros[i].name, (unsigned)macros[i].size);
+        total += macros[i].size;
+    }
+
+    /* One byte per character, two per tap, press or release, two per pause, one for the end */
+    CHECK_EQUAL(13 + 2 + 1, sizeof(login));
+    CHECK_EQUAL(9 + 3 * 2 + 2 + 1, sizeof(openUrl));
+
+    printf("size: %u macros like these fit in 64KB of flash\n",
+           (unsigned)(65536 / (total / MACROS)));
+
+    static const unsigned ROUNDS = 1000000;
+    volatile unsigned checksum = 0;
+    clock_t start = clock();
+
+    for (unsigned round = 0; round < ROUNDS; round++) {
+        const uint8_t *p = openUrl;
+        key_event_t event;
+        unsigned length;
+
+        while ((length = decodeKeyEvent(p, event)) != 0) {
+            checksum += event.type + event.data + event.duration;
+            p += length;
+            records++;
+        }
+    }
+
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("decoding: %.1f ns per record on this host\n", seconds * 1e9 / records);
+}
+
+int main(void)
+{
+    ble.hostConnect(7.5, 4);
+    host_run(1000);
+    ble.hostSubscribe(kbd.inputHandle());
+    host_run(100000);
+
+    test_playback();
+    test_timing();
+    test_throughput();
+    test_busy();
+    benchmark();
+
+    return host_summary("macro");
+}
@@ -0,0 +1,297 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * MotionPipeline: behaviour on accelerometer traces, and cost per sample.
+ *
+ * Traces are generated like those of the micro:bit's MMA8653 at 50Hz, in 1/256g: the board lies
+ * flat (Z at -1g), then is tilted and put back, with a few units of sensor noise. A recorded trace
+ * can be replayed instead, with one "x y z" sample per line:
+ *
+ *     build/test_motion_pipeline trace.txt
+ *
+ * prints the output of the pipeline for each sample, with the tuning of microbit_joystick.cpp.
+ */
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "host.h"
+#include "MotionPipeline.h"
+
+/* Same tuning as examples/microbit_joystick.cpp */
+static const motion_config_t mouseConfig = { 64, 20, 2, 2, true, 10, 3, 2, 32 };
+
+/* Joystick-like: the curve output is used directly */
+static const motion_config_t joystickConfig = { 128, 10, 256, 0, false, 0, 0, 2, 127 };
+
+static const unsigned SAMPLE_RATE = 50;
+
+static int16_t noise(void)
+{
+    return (int16_t)(host_random() % 9) - 4;
+}
+
+static void sample(int16_t out[MOTION_AXES], int16_t x, int16_t y, bool noisy = true)
+{
+    out[0] = x + (noisy ? noise() : 0);
+    out[1] = y + (noisy ? noise() : 0);
+    out[2] = -256 + (noisy ? noise() : 0);
+}
+
+/**
+ * Push samples at rest, and use them as origin, as the example does on startup
+ */
+static void calibrate(MotionPipeline &pipeline, int16_t x = 0, int16_t y = 0)
+{
+    int16_t s[MOTION_AXES];
+
+    for (unsigned i = 0; i < SAMPLE_RATE; i++) {
+        sample(s, x, y);
+        pipeline.push(s);
+    }
+
+    pipeline.calibrate();
+}
+
+static void test_rest(void)
+{
+    MotionPipeline pipeline(mouseConfig);
+    int16_t s[MOTION_AXES];
+    int8_t out[MOTION_AXES];
+    unsigned moves = 0;
+
+    /* A board that isn't perfectly flat, and noise well inside the dead zone */
+    calibrate(pipeline, 7, -5);
+
+    for (unsigned i = 0; i < 10 * SAMPLE_RATE; i++) {
+        sample(s, 7, -5);
+        pipeline.push(s);
+        pipeline.read(out);
+
+        if (out[0] || out[1] || out[2])
+            moves++;
+    }
+
+    CHECK_EQUAL(0, moves);
+}
+
+static void test_tilt(void)
+{
+    MotionPipeline pipeline(mouseConfig);
+    int16_t s[MOTION_AXES];
+    int8_t out[MOTION_AXES];
+    int8_t previous = 0;
+    bool monotonic = true;
+    bool firstMove = true;
+    unsigned latency = 0;
+
+    calibrate(pipeline);
+
+    /* Tilted by about 23 degrees to the right for 2s */
+    for (unsigned i = 0; i < 2 * SAMPLE_RATE; i++) {
+        sample(s, 100, 0, false);
+        pipeline.push(s);
+        pipeline.read(out);
+
+        if (out[0] < previous)
+            monotonic = false;
+        if (firstMove && out[0] > 0) {
+            firstMove = false;
+            latency = i;
+        }
+        previous = out[0];
+
+        CHECK_EQUAL(0, out[1]);
+        CHECK(out[0] <= mouseConfig.outputMax);
+    }
+
+    CHECK(monotonic);
+    CHECK(previous > 0);
+    /* The filter and the integration delay the first move by less than 200ms */
+    CHECK(latency < SAMPLE_RATE / 5);
+
+    /* Back to horizontal: the speed drops to 0 quickly, and stays there */
+    unsigned stopped = 0;
+
+    for (unsigned i = 0; i < 2 * SAMPLE_RATE; i++) {
+        sample(s, 0, 0);
+        pipeline.push(s);
+        pipeline.read(out);
+
+        if (out[0] != 0)
+            stopped = i + 1;
+    }
+
+    printf("tilt: first move after %u samples, stopped %u samples after the tilt\n",
+           latency, stopped);
+    CHECK(stopped < SAMPLE_RATE);
+    CHECK_EQUAL(0, out[0]);
+}
+
+static void test_symmetry(void)
+{
+    MotionPipeline right(mouseConfig);
+    MotionPipeline left(mouseConfig);
+    int16_t s[MOTION_AXES];
+    int8_t outRight[MOTION_AXES];
+    int8_t outLeft[MOTION_AXES];
+    unsigned mismatches = 0;
+
+    /* Every stage rounds both directions the same way: left and right moves are identical */
+    for (unsigned i = 0; i < 4 * SAMPLE_RATE; i++) {
+        int16_t x = i < 2 * SAMPLE_RATE ? 60 + (int16_t)i : 0;
+
+        sample(s, x, 0, false);
+        right.push(s);
+        sample(s, -x, 0, false);
+        left.push(s);
+
+        right.read(outRight);
+        left.read(outLeft);
+
+        if (outRight[0] != -outLeft[0])
+            mismatches++;
+    }
+
+    CHECK_EQUAL(0, mismatches);
+    CHECK_EQUAL(0, outLeft[0]);
+}
+
+static void test_saturation(void)
+{
+    MotionPipeline pipeline(mouseConfig);
+    int16_t s[MOTION_AXES];
+    int8_t out[MOTION_AXES];
+
+    /* 16g, twice the widest range of the sensor: the acceleration curve saturates */
+    for (unsigned i = 0; i < 10 * SAMPLE_RATE; i++) {
+        s[0] = 4096;
+        s[1] = -4096;
+        s[2] = (i & 1) ? 4096 : -4096;
+        pipeline.push(s);
+        pipeline.read(out);
+
+        CHECK(out[0] >= 0 && out[0] <= mouseConfig.outputMax);
+        CHECK(out[1] <= 0 && out[1] >= -mouseConfig.outputMax);
+        CHECK(out[2] >= -mouseConfig.outputMax && out[2] <= mouseConfig.outputMax);
+    }
+
+    /* The integrated speed is clamped, then leaks a little */
+    CHECK_EQUAL(mouseConfig.outputMax - 1, out[0]);
+    CHECK_EQUAL(-mouseConfig.outputMax + 1, out[1]);
+}
+
+static void test_joystick(void)
+{
+    MotionPipeline pipeline(joystickConfig);
+    int16_t s[MOTION_AXES];
+    int8_t out[MOTION_AXES];
+
+    /* Within the dead zone */
+    for (unsigned i = 0; i < SAMPLE_RATE; i++) {
+        sample(s, 8, -8, false);
+        pipeline.push(s);
+    }
+    pipeline.read(out);
+    CHECK_EQUAL(0, out[0]);
+    CHECK_EQUAL(0, out[1]);
+
+    /* Without integration, a constant tilt settles to a constant value: (v - deadZone) / 4 */
+    for (unsigned i = 0; i < SAMPLE_RATE; i++) {
+        sample(s, 90, -90, false);
+        pipeline.push(s);
+    }
+    pipeline.read(out);
+    CHECK_EQUAL(20, out[0]);
+    CHECK_EQUAL(-20, out[1]);
+
+    pipeline.reset();
+    pipeline.read(out);
+    CHECK_EQUAL(0, out[0]);
+}
+
+static void benchmark(void)
+{
+    MotionPipeline pipeline(mouseConfig);
+    static const unsigned SAMPLES = 2000000;
+    int16_t s[MOTION_AXES];
+    int8_t out[MOTION_AXES];
+    int checksum = 0;
+
+    clock_t start = clock();
+
+    for (unsigned i = 0; i < SAMPLES; i++) {
+        /* A slow swing, so that all stages of the pipeline work */
+        int16_t x = (int16_t)((i % 400) < 200 ? (i % 200) : -(int)(i % 200));
+
+        sample(s, x, -x / 2, false);
+        pipeline.push(s);
+        pipeline.read(out);
+        checksum += out[0];
+    }
+
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    /* The Cortex-M0 has no 64-bit multiplier either: compare the relative cost of changes */
+    printf("benchmark: %.1f ns per sample on this host (checksum %d)\n",
+           seconds * 1e9 / SAMPLES, checksum);
+}
+
+static int replay(const char *path)
+{
+    MotionPipeline pipeline(mouseConfig);
+    FILE *file = fopen(path, "r");
+    int x, y, z;
+    unsigned count = 0;
+
+    if (!file) {
+        perror(path);
+        return 1;
+    }
+
+    while (fscanf(file, "%d %d %d", &x, &y, &z) == 3) {
+        int16_t s[MOTION_AXES] = { (int16_t)x, (int16_t)y, (int16_t)z };
+        int8_t out[MOTION_AXES];
+
+        pipeline.push(s);
+        pipeline.read(out);
+
+        /* Calibrate on the first second, which must be at rest */
+        if (++count == SAMPLE_RATE)
+            pipeline.calibrate();
+
+        printf("%d %d %d\n", out[0], out[1], out[2]);
+    }
+
+    fclose(file);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1)
+        return replay(argv[1]);
+
+    test_rest();
+    test_tilt();
+    test_symmetry();
+    test_saturation();
+    test_joystick();
+    benchmark();
+
+    return host_summary("motion_pipeline");
+}
@@ -0,0 +1,265 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * MotionResampler: jitter benchmark, and limits.
+ *
+ * The benchmark replays the setup of microbit_joystick.cpp: a sensor sampled every 20ms, and a
+ * report ticker of 20ms on another clock, whose reports are delayed by a few ms by the main loop.
+ * Each report is compared with the distance the pointer should have covered since the previous
+ * one, for reports that carry the latest sample (as the services do without a resampler) and for
+ * reports computed by the resampler.
+ */
+
+#include <math.h>
+
+#include "host.h"
+#include "MotionResampler.h"
+
+static const uint32_t PERIOD_US = 20000;
+static const uint32_t SAMPLE_PERIOD_US = 20000;
+
+/* Not a multiple of the sample period, so that rounding errors of the sensor average out */
+static const double SWING_US = 713000.0;
+
+/**
+ * Speed of the pointer, in units per PERIOD_US: a steady move with a slow swing
+ */
+static double speed(double t)
+{
+    return 4.0 + 3.0 * sin(2 * M_PI * t / SWING_US);
+}
+
+/**
+ * Distance covered at time t, integral of speed()
+ */
+static double position(double t)
+{
+    double omega = 2 * M_PI / SWING_US;
+
+    return (4.0 * t + 3.0 * (1 - cos(omega * t)) / omega) / PERIOD_US;
+}
+
+struct jitter_result_t {
+    double judder;      ///< RMS error of the reports, in units
+    double drift;       ///< Error of the total distance, in units
+};
+
+/**
+ * Run the pointer for 20s
+ *
+ * @param reportPeriod  Period of the report ticker, in us
+ * @param jitterUs      Reports are delayed by up to this
+ * @param resample      Use the resampler, or send the latest sample
+ */
+static jitter_result_t run(uint32_t reportPeriod, uint32_t jitterUs, bool resample)
+{
+    MotionResampler resampler(RESAMPLER_RELATIVE, PERIOD_US / 1000);
+    jitter_result_t result;
+    uint32_t nextSample = 7000;
+    uint32_t nextReport = reportPeriod;
+    uint32_t previousReport = 0;
+    int8_t latest = 0;
+    long total = 0;
+    double squares = 0;
+    unsigned reports = 0;
+
+    host_seed(33);
+    resampler.reset(0);
+
+    while (nextReport < 20000000) {
+        uint32_t reportTime = nextReport + host_random() % (jitterUs + 1);
+
+        while (nextSample <= reportTime) {
+            const int8_t sample[RESAMPLER_AXES] = { (int8_t)lround(speed(nextSample)), 0, 0 };
+
+            resampler.push(sample, nextSample);
+            latest = sample[0];
+            nextSample += SAMPLE_PERIOD_US;
+        }
+
+        int8_t out[RESAMPLER_AXES];
+
+        if (resample) {
+            resampler.take(out, reportTime);
+        } else {
+            out[0] = latest;
+        }
+
+        double error = out[0] - (position(reportTime) - position(previousReport));
+
+        squares += error * error;
+        total += out[0];
+        reports++;
+
+        previousReport = reportTime;
+        nextReport += reportPeriod;
+    }
+
+    result.judder = sqrt(squares / reports);
+    result.drift = total - position(previousReport);
+
+    return result;
+}
+
+static void benchmark(const char *name, uint32_t reportPeriod, uint32_t jitterUs)
+{
+    jitter_result_t latest = run(reportPeriod, jitterUs, false);
+    jitter_result_t resampled = run(reportPeriod, jitterUs, true);
+
+    printf("%s: judder %.2f -> %.2f units, drift over 20s %.1f -> %.1f units\n",
+           name, latest.judder, resampled.judder, latest.drift, resampled.drift);
+
+    /* Reports are within rounding of the move, whatever the rates */
+    CHECK(resampled.judder < 0.6);
+    /* Only the sub-unit remainder and the move since the last sample are still owed */
+    CHECK(fabs(resampled.drift) < 8);
+    CHECK(fabs(resampled.drift) < fabs(latest.drift));
+}
+
+static void test_jitter(void)
+{
+    /*
+     * The report ticker runs on another clock, a little slower than the sensor's. Each report is
+     * about as accurate with the latest sample, but a skipped sample is lost for good.
+     */
+    benchmark("jitter", 20300, 3000);
+    /* Reports slowed down by congestion control: the latest sample loses a third of the move */
+    benchmark("congested", 30000, 3000);
+    /* Reports aligned on connection events of 7.5ms: one every 3 events, with no extra delay */
+    benchmark("aligned", 22500, 0);
+}
+
+static void test_distance(void)
+{
+    MotionResampler resampler(RESAMPLER_RELATIVE, 20);
+    const int8_t sample[RESAMPLER_AXES] = { 3, -5, 1 };
+    int8_t out[RESAMPLER_AXES];
+    long total[RESAMPLER_AXES] = { 0, 0, 0 };
+    uint32_t t = 0;
+
+    resampler.reset(0);
+
+    /* Constant speeds, taken at irregular times: the distance is exact, up to the remainder */
+    for (unsigned i = 0; i < 1000; i++) {
+        if (i % 2 == 0)
+            resampler.push(sample, t);
+
+        t += 5000 + host_random() % 20000;
+        resampler.take(out, t);
+
+        for (unsigned axis = 0; axis < RESAMPLER_AXES; axis++)
+            total[axis] += out[axis];
+    }
+
+    for (unsigned axis = 0; axis < RESAMPLER_AXES; axis++) {
+        long expected = (long)sample[axis] * (long)t / 20000;
+
+        CHECK(labs(total[axis] - expected) <= 1);
+    }
+}
+
+static void test_absolute(void)
+{
+    MotionResampler resampler(RESAMPLER_ABSOLUTE, 20);
+    int8_t sample[RESAMPLER_AXES] = { 40, -40, 0 };
+    int8_t out[RESAMPLER_AXES];
+
+    resampler.reset(0);
+    resampler.push(sample, 0);
+    resampler.take(out, 20000);
+
+    /* A held position is reported as is */
+    CHECK_EQUAL(40, out[0]);
+    CHECK_EQUAL(-40, out[1]);
+
+    /* The sample at 40ms shows a ramp from 40 to 80: its second half averages to 70 */
+    sample[0] = 80;
+    resampler.push(sample, 40000);
+    resampler.take(out, 40000);
+    CHECK_EQUAL(70, out[0]);
+    CHECK_EQUAL(-40, out[1]);
+
+    /* Without new samples or time, the previous average is repeated */
+    resampler.take(out, 40000);
+    CHECK_EQUAL(70, out[0]);
+
+    CHECK(!resampler.idle());
+}
+
+static void test_stall(void)
+{
+    MotionResampler resampler(RESAMPLER_RELATIVE, 20);
+    const int8_t moving[RESAMPLER_AXES] = { 10, 0, 0 };
+    int8_t out[RESAMPLER_AXES];
+    long total = 0;
+    uint32_t t;
+
+    resampler.reset(0);
+    resampler.push(moving, 0);
+
+    /* The sensor stops for 3s: the last speed is only held for RESAMPLER_MAX_GAP_US */
+    for (t = 20000; t <= 3000000; t += 20000) {
+        resampler.take(out, t);
+        total += out[0];
+    }
+
+    CHECK_EQUAL(10 * RESAMPLER_MAX_GAP_US / 20000, total);
+    CHECK_EQUAL(0, out[0]);
+
+    /* A sample after the stall doesn't reach back to the previous one */
+    const int8_t stopped[RESAMPLER_AXES] = { 0, 0, 0 };
+
+    resampler.push(stopped, t);
+    resampler.take(out, t + 20000);
+    CHECK_EQUAL(0, out[0]);
+    CHECK(resampler.idle());
+}
+
+static void test_backlog(void)
+{
+    MotionResampler resampler(RESAMPLER_RELATIVE, 20);
+    const int8_t fast[RESAMPLER_AXES] = { 100, -100, 0 };
+    int8_t out[RESAMPLER_AXES];
+
+    resampler.reset(0);
+
+    /* Nothing is taken for 10s (e.g. disconnected): only 127 units are kept */
+    for (uint32_t t = 0; t <= 10000000; t += 20000)
+        resampler.push(fast, t);
+
+    resampler.take(out, 10000000);
+    CHECK_EQUAL(127, out[0]);
+    CHECK_EQUAL(-127, out[1]);
+
+    const int8_t stopped[RESAMPLER_AXES] = { 0, 0, 0 };
+
+    resampler.push(stopped, 10000000);
+    resampler.take(out, 10020000);
+    CHECK_EQUAL(0, out[0]);
+    CHECK(resampler.idle());
+}
+
+int main(void)
+{
+    test_jitter();
+    test_distance();
+    test_absolute();
+    test_stall();
+    test_backlog();
+
+    return host_summary("motion_resampler");
+}
@@ -0,0 +1,140 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * PointerState: stress test with concurrent writers.
+ *
+ * Writer threads stand for interrupt handlers: they publish states whose axes all hold the same
+ * value, and toggle all buttons at once. The reader checks that no snapshot mixes two updates.
+ * On the device, writers are serialized by disabling interrupts, which the host stubs can't do:
+ * they take a mutex instead.
+ */
+
+#include <pthread.h>
+
+#include "host.h"
+#include "PointerState.h"
+
+static PointerState state;
+static pthread_mutex_t irqLock = PTHREAD_MUTEX_INITIALIZER;
+static volatile bool stop;
+static volatile unsigned writersDone;
+
+static const unsigned WRITERS = 3;
+static const unsigned UPDATES = 1000000;
+
+static void *axesWriter(void *arg)
+{
+    unsigned id = (unsigned)(size_t)arg;
+
+    for (unsigned i = 0; i < UPDATES; i++) {
+        int8_t value = (int8_t)(i * WRITERS + id);
+        const int8_t axes[POINTER_AXES] = { value, value, value, value };
+
+        pthread_mutex_lock(&irqLock);
+        state.setAxes(axes, POINTER_AXES);
+        pthread_mutex_unlock(&irqLock);
+    }
+
+    __sync_fetch_and_add(&writersDone, 1);
+    return NULL;
+}
+
+static void *buttonWriter(void *arg)
+{
+    for (unsigned i = 0; !stop; i++) {
+        pthread_mutex_lock(&irqLock);
+        state.setButtons(0xff, i & 1);
+        pthread_mutex_unlock(&irqLock);
+    }
+
+    return NULL;
+}
+
+static void test_stress(void)
+{
+    pthread_t writers[WRITERS];
+    pthread_t buttons;
+    unsigned snapshots = 0;
+    unsigned torn = 0;
+    unsigned badButtons = 0;
+
+    for (unsigned i = 0; i < WRITERS; i++)
+        pthread_create(&writers[i], NULL, axesWriter, (void *)(size_t)i);
+    pthread_create(&buttons, NULL, buttonWriter, NULL);
+
+    /* Read while all axis writers are running */
+    while (!writersDone) {
+        pointer_state_t snapshot;
+
+        state.read(snapshot);
+        snapshots++;
+
+        for (unsigned i = 1; i < POINTER_AXES; i++) {
+            if (snapshot.axis[i] != snapshot.axis[0]) {
+                torn++;
+                break;
+            }
+        }
+
+        if (snapshot.buttons != 0 && snapshot.buttons != 0xff)
+            badButtons++;
+    }
+
+    for (unsigned i = 0; i < WRITERS; i++)
+        pthread_join(writers[i], NULL);
+    stop = true;
+    pthread_join(buttons, NULL);
+
+    printf("stress: %u snapshots, %u torn\n", snapshots, torn);
+    CHECK_EQUAL(0, torn);
+    CHECK_EQUAL(0, badButtons);
+    CHECK(snapshots > 0);
+}
+
+static void test_updates(void)
+{
+    PointerState pointer;
+    pointer_state_t snapshot;
+    const int8_t axes[POINTER_AXES] = { 1, -2, 3, -4 };
+    const int8_t xy[2] = { 10, 20 };
+
+    pointer.read(snapshot);
+    CHECK_EQUAL(0, snapshot.buttons);
+    CHECK_EQUAL(0, snapshot.axis[0]);
+
+    pointer.setAxes(axes, POINTER_AXES);
+    pointer.setButtons(0x05, true);
+    pointer.setButtons(0x01, false);
+
+    /* Only the first axes are set */
+    pointer.setAxes(xy, 2);
+
+    pointer.read(snapshot);
+    CHECK_EQUAL(0x04, snapshot.buttons);
+    CHECK_EQUAL(10, snapshot.axis[0]);
+    CHECK_EQUAL(20, snapshot.axis[1]);
+    CHECK_EQUAL(3, snapshot.axis[2]);
+    CHECK_EQUAL(-4, snapshot.axis[3]);
+}
+
+int main(void)
+{
+    test_updates();
+    test_stress();
+
+    return host_summary("pointer_state");
+}
@@ -0,0 +1,139 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Report emission aligned on connection events: latency, compared with the report ticker.
+ *
+ * MouseService gets a new speed at random times. For each one, the latency is the time until a
+ * report carrying it goes on air. The time reports wait in the stack's buffers is measured too.
+ */
+
+#include "host.h"
+#include "MouseService.h"
+
+class TestMouseService: public MouseService {
+public:
+    TestMouseService(BLE &_ble) :
+        MouseService(_ble)
+    {
+    }
+
+    GattAttribute::Handle_t inputHandle(void) const
+    {
+        return inputReportCharacteristic->getValueHandle();
+    }
+};
+
+static BLE ble;
+static TestMouseService mouse(ble);
+
+struct latency_t {
+    double inputToAir;      ///< Average, in us
+    uint32_t inputToAirMax;
+    double buffered;        ///< Average time in the stack's buffers, in us
+    unsigned reports;
+};
+
+static const unsigned INPUTS = 200;
+
+static latency_t run(bool aligned, float intervalMs)
+{
+    GattServer &server = ble.gattServer();
+    uint32_t inputTime[INPUTS];
+    int8_t inputValue[INPUTS];
+    latency_t result;
+
+    host_seed(39);
+    mouse.setRadioAlignment(aligned);
+    ble.hostConnect(intervalMs, 4);
+    host_run(1000);
+    ble.hostSubscribe(mouse.inputHandle());
+    host_run(100000);
+    server.receivedCount = 0;
+
+    for (unsigned i = 0; i < INPUTS; i++) {
+        host_run(50000 + host_random() % 50000);
+
+        inputTime[i] = us_ticker_read();
+        inputValue[i] = 1 + i % 100;
+        mouse.setSpeed(inputValue[i], 0, 0);
+    }
+    host_run(100000);
+
+    MBED_ASSERT(server.receivedCount <= HOST_MAX_NOTIFICATIONS);
+
+    uint64_t total = 0;
+    uint64_t buffered = 0;
+    unsigned found = 0;
+
+    result.inputToAirMax = 0;
+
+    for (unsigned i = 0; i < server.receivedCount; i++)
+        buffered += server.received[i].sentAt - server.received[i].queuedAt;
+
+    for (unsigned i = 0, n = 0; i < INPUTS; i++) {
+        /* First report on air with the new speed */
+        while (n < server.receivedCount && (server.received[n].sentAt < inputTime[i]
+                || (int8_t)server.received[n].data[1] != inputValue[i]))
+            n++;
+
+        if (n == server.receivedCount)
+            break;
+
+        uint32_t latency = server.received[n].sentAt - inputTime[i];
+
+        total += latency;
+        if (latency > result.inputToAirMax)
+            result.inputToAirMax = latency;
+        found++;
+    }
+
+    CHECK_EQUAL(INPUTS, found);
+
+    result.inputToAir = found ? (double)total / found : 0;
+    result.buffered = server.receivedCount ? (double)buffered / server.receivedCount : 0;
+    result.reports = server.receivedCount;
+
+    ble.hostDisconnect(Gap::REMOTE_USER_TERMINATED_CONNECTION);
+    host_run(1000);
+
+    return result;
+}
+
+static void compare(float intervalMs)
+{
+    latency_t ticker = run(false, intervalMs);
+    latency_t aligned = run(true, intervalMs);
+
+    printf("%.1fms interval: input to air %.1f -> %.1fms (max %.1f -> %.1fms), "
+           "buffered %.1f -> %.1fms, %u -> %u reports\n", intervalMs,
+           ticker.inputToAir / 1000, aligned.inputToAir / 1000,
+           ticker.inputToAirMax / 1000.0, aligned.inputToAirMax / 1000.0,
+           ticker.buffered / 1000, aligned.buffered / 1000, ticker.reports, aligned.reports);
+
+    /* Aligned reports are built during the radio notification lead time, and leave right away */
+    CHECK(aligned.buffered <= ble.radioLead);
+    CHECK(aligned.buffered < ticker.buffered);
+    CHECK(aligned.inputToAir < ticker.inputToAir);
+}
+
+int main(void)
+{
+    compare(7.5);
+    compare(20);
+
+    return host_summary("radio_alignment");
+}
@@ -0,0 +1,336 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * RawHIDService: transfers with a reference client, over the simulated link.
+ *
+ * The client does what a host application does through hidraw: it reads input reports, writes an
+ * acknowledgement for each packet received in order, and writes blobs as output reports. Throughput
+ * is compared with the payload the link can carry.
+ */
+
+#include <errno.h>
+
+#include "host.h"
+#include "RawHIDService.h"
+
+class TestRawHIDService: public RawHIDService {
+public:
+    TestRawHIDService(BLE &_ble) :
+        RawHIDService(_ble)
+    {
+    }
+
+    GattAttribute::Handle_t inputHandle(void) const
+    {
+        return inputReportCharacteristic->getValueHandle();
+    }
+
+    GattAttribute::Handle_t outputHandle(void) const
+    {
+        return outputReportCharacteristic->getValueHandle();
+    }
+};
+
+static BLE ble;
+static TestRawHIDService raw(ble);
+
+/*
+ * Reference client
+ */
+static uint8_t clientBuffer[8192];
+static size_t clientLength;
+static uint8_t clientSeq;
+static bool clientDone;
+static uint8_t clientTxSeq;
+
+/**
+ * Sequence numbers go on from one blob to the next, and start over with each connection
+ */
+static void clientReset(bool connection)
+{
+    clientLength = 0;
+    clientDone = false;
+
+    if (connection) {
+        clientSeq = 0;
+        clientTxSeq = 0;
+    }
+}
+
+static void clientOnNotification(const host_notification_t *notification)
+{
+    if (notification->handle != raw.inputHandle() || notification->length < RAWHID_HEADER_SIZE)
+        return;
+
+    uint8_t seq = notification->data[0];
+    uint8_t control = notification->data[1];
+    uint8_t length = control & RAWHID_LENGTH_MASK;
+
+    /* Packets after a lost one are ignored: they will be sent again */
+    if (seq == clientSeq) {
+        MBED_ASSERT(clientLength + length <= sizeof(clientBuffer));
+        memcpy(&clientBuffer[clientLength], &notification->data[RAWHID_HEADER_SIZE], length);
+        clientLength += length;
+        clientSeq++;
+
+        if (control & RAWHID_END)
+            clientDone = true;
+    }
+
+    /* Acknowledge the last packet received in order */
+    const uint8_t ack[RAWHID_HEADER_SIZE] = { (uint8_t)(clientSeq - 1), RAWHID_ACK };
+
+    ble.hostWrite(raw.outputHandle(), ack, sizeof(ack));
+}
+
+/**
+ * Write a blob to the device, as output reports
+ *
+ * @param skip  Sequence number of a packet to lose, or -1
+ */
+static void clientWrite(const uint8_t *data, size_t length, int skip = -1)
+{
+    size_t offset = 0;
+
+    do {
+        uint8_t packet[RAWHID_REPORT_SIZE] = { 0 };
+        size_t chunk = length - offset;
+
+        if (chunk > RAWHID_PAYLOAD_SIZE)
+            chunk = RAWHID_PAYLOAD_SIZE;
+
+        packet[0] = clientTxSeq;
+        packet[1] = chunk;
+        if (offset + chunk == length)
+            packet[1] |= RAWHID_END;
+        memcpy(&packet[RAWHID_HEADER_SIZE], data + offset, chunk);
+
+        if (clientTxSeq != skip)
+            ble.hostWrite(raw.outputHandle(), packet, sizeof(packet));
+
+        clientTxSeq++;
+        offset += chunk;
+
+        /* Write commands go out at the pace of connection events */
+        host_run(2000);
+    } while (offset < length);
+}
+
+/*
+ * Device side
+ */
+static int sentStatus;
+static bool sent;
+
+static void onSent(int status)
+{
+    sentStatus = status;
+    sent = true;
+}
+
+static uint8_t receiveBuffer[2048];
+static size_t receivedLength;
+static unsigned receivedBlobs;
+
+static void onReceived(const uint8_t *data, size_t length)
+{
+    receivedLength = length;
+    receivedBlobs++;
+}
+
+static bool isSent(void)
+{
+    return sent;
+}
+
+static void fill(uint8_t *data, size_t length, uint8_t seed)
+{
+    for (size_t i = 0; i < length; i++)
+        data[i] = (uint8_t)(i * 7 + seed + (i >> 8));
+}
+
+static void connect(void)
+{
+    clientReset(true);
+    ble.hostConnect(7.5, 4);
+    host_run(1000);
+    ble.hostSubscribe(raw.inputHandle());
+    host_run(1000);
+}
+
+/**
+ * Send a blob to the client, and measure the throughput
+ *
+ * @return bytes per second
+ */
+static unsigned transfer(const uint8_t *data, size_t length)
+{
+    clientReset(false);
+    sent = false;
+
+    uint32_t start = us_ticker_read();
+
+    CHECK_EQUAL(0, raw.write(data, length, onSent));
+    CHECK(host_run_until(isSent, 30000000));
+
+    uint32_t elapsed = us_ticker_read() - start;
+
+    CHECK_EQUAL(0, sentStatus);
+    CHECK(clientDone);
+    CHECK_EQUAL(length, clientLength);
+    CHECK(!memcmp(data, clientBuffer, length));
+
+    return (uint64_t)length * 1000000 / elapsed;
+}
+
+static void test_feature_report(void)
+{
+    CHECK_EQUAL(RAWHID_PROTOCOL_VERSION, rawFeatureReportData[0]);
+    CHECK_EQUAL(RAWHID_WINDOW, rawFeatureReportData[1]);
+    CHECK_EQUAL(RAWHID_PAYLOAD_SIZE, rawFeatureReportData[2]);
+}
+
+static void test_to_host(void)
+{
+    static uint8_t blob[4096];
+    /* Payload of all the notifications of a connection event */
+    unsigned linkMax = ble.notificationsPerEvent * RAWHID_PAYLOAD_SIZE * 1000000 / 7500;
+
+    fill(blob, sizeof(blob), 1);
+
+    unsigned throughput = transfer(blob, sizeof(blob));
+
+    printf("to host: %u bytes/s, link carries %u bytes/s of payload\n", throughput, linkMax);
+    CHECK_EQUAL(0, raw.retransmissions);
+    CHECK(throughput * 10 >= linkMax * 8);
+
+    /* The peer loses 2% of the packets: the duplicate acknowledgements get them back quickly */
+    ble.dropRate = 2;
+    throughput = transfer(blob, sizeof(blob));
+    ble.dropRate = 0;
+
+    printf("to host, 2%% lost: %u bytes/s, %u retransmissions\n", throughput,
+           (unsigned)raw.retransmissions);
+    CHECK(raw.retransmissions > 0);
+    CHECK(throughput * 2 >= linkMax);
+
+    /* Empty blobs and single packets */
+    transfer(blob, 0);
+    transfer(blob, RAWHID_PAYLOAD_SIZE);
+    transfer(blob, RAWHID_PAYLOAD_SIZE + 1);
+}
+
+static void test_busy_and_cancel(void)
+{
+    static uint8_t blob[1024];
+
+    fill(blob, sizeof(blob), 2);
+    sent = false;
+
+    CHECK_EQUAL(0, raw.write(blob, sizeof(blob), onSent));
+    CHECK_EQUAL(EBUSY, raw.write(blob, sizeof(blob), onSent));
+    CHECK(raw.isWriting());
+
+    host_run(20000);
+    raw.cancelWrite();
+    CHECK(!raw.isWriting());
+
+    /* The callback runs from the main loop */
+    CHECK(!sent);
+    host_run(1000);
+    CHECK(sent);
+    CHECK_EQUAL(-ECANCELED, sentStatus);
+
+    /* Sequence numbers go on after the cancelled packets: the client starts over */
+    host_run(100000);
+    ble.hostDisconnect(Gap::REMOTE_USER_TERMINATED_CONNECTION);
+    host_run(1000);
+    connect();
+}
+
+static void test_reconnection(void)
+{
+    static uint8_t blob[2048];
+
+    fill(blob, sizeof(blob), 3);
+    sent = false;
+
+    CHECK_EQUAL(0, raw.write(blob, sizeof(blob), onSent));
+    host_run(50000);
+    CHECK(!sent);
+
+    /* A transfer interrupted by a disconnection starts over on the next connection */
+    ble.hostDisconnect(Gap::CONNECTION_TIMEOUT);
+    host_run(1000000);
+    CHECK(!sent);
+
+    connect();
+    CHECK(host_run_until(isSent, 10000000));
+    CHECK_EQUAL(0, sentStatus);
+    CHECK_EQUAL(sizeof(blob), clientLength);
+    CHECK(!memcmp(blob, clientBuffer, sizeof(blob)));
+}
+
+static void test_from_host(void)
+{
+    static uint8_t blob[1500];
+
+    fill(blob, sizeof(blob), 4);
+    raw.setReceiveBuffer(receiveBuffer, sizeof(receiveBuffer), onReceived);
+
+    clientWrite(blob, sizeof(blob));
+    host_run(1000);
+    CHECK_EQUAL(1, receivedBlobs);
+    CHECK_EQUAL(sizeof(blob), receivedLength);
+    CHECK(!memcmp(blob, receiveBuffer, sizeof(blob)));
+
+    /* A lost packet drops the blob; the next one is received */
+    uint32_t errors = raw.rxErrors;
+
+    clientWrite(blob, sizeof(blob), clientTxSeq + 3);
+    host_run(1000);
+    CHECK_EQUAL(1, receivedBlobs);
+    CHECK(raw.rxErrors > errors);
+
+    fill(blob, sizeof(blob), 5);
+    clientWrite(blob, 100);
+    host_run(1000);
+    CHECK_EQUAL(2, receivedBlobs);
+    CHECK_EQUAL(100, receivedLength);
+    CHECK(!memcmp(blob, receiveBuffer, 100));
+
+    /* Larger than the receive buffer */
+    static uint8_t large[sizeof(receiveBuffer) + 100];
+
+    clientWrite(large, sizeof(large));
+    host_run(1000);
+    CHECK_EQUAL(2, receivedBlobs);
+}
+
+int main(void)
+{
+    ble.notificationCallback = clientOnNotification;
+    connect();
+
+    test_feature_report();
+    test_to_host();
+    test_busy_and_cancel();
+    test_reconnection();
+    test_from_host();
+
+    return host_summary("raw_hid");
+}
@@ -0,0 +1,155 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Suspend through the HID Control Point: reports stop while the host is suspended, and resume
+ * when it exits suspend, or when it reconnects after disconnecting while suspended.
+ */
+
+#include "host.h"
+#include "JoystickService.h"
+
+class TestJoystickService: public JoystickService {
+public:
+    TestJoystickService(BLE &_ble) :
+        JoystickService(_ble)
+    {
+    }
+
+    GattAttribute::Handle_t inputHandle(void) const
+    {
+        return inputReportCharacteristic->getValueHandle();
+    }
+
+    GattAttribute::Handle_t controlPointHandle(void)
+    {
+        return HIDControlPointCharacteristic.getValueHandle();
+    }
+
+    bool isTickerActive(void) const
+    {
+        return reportTickerIsActive;
+    }
+};
+
+static BLE ble;
+static TestJoystickService joystick(ble);
+
+static void connect(void)
+{
+    ble.hostConnect(7.5, 4);
+    host_run(1000);
+    ble.hostSubscribe(joystick.inputHandle());
+    host_run(1000);
+}
+
+static void sendCommand(uint8_t command)
+{
+    ble.hostWrite(joystick.controlPointHandle(), &command, 1);
+    host_run(1000);
+}
+
+/**
+ * @return the number of reports sent by the service in a second of joystick movement. Reports
+ * already in the stack's buffers when it starts don't count.
+ */
+static unsigned reportsPerSecond(void)
+{
+    GattServer &server = ble.gattServer();
+    unsigned from = server.receivedCount;
+    uint32_t start = us_ticker_read();
+    unsigned reports = 0;
+
+    for (unsigned i = 0; i < 50; i++) {
+        joystick.setSpeed(i, -(int8_t)i, 0);
+        host_run(20000);
+    }
+
+    for (unsigned i = from; i < server.receivedCount; i++) {
+        if (server.received[i].queuedAt >= start)
+            reports++;
+    }
+
+    return reports;
+}
+
+static void test_suspend(void)
+{
+    connect();
+    CHECK(reportsPerSecond() > 40);
+
+    sendCommand(CONTROL_POINT_SUSPEND);
+    CHECK(joystick.isSuspended());
+    CHECK(!joystick.isTickerActive());
+    CHECK_EQUAL(0, reportsPerSecond());
+
+    sendCommand(CONTROL_POINT_EXIT_SUSPEND);
+    CHECK(!joystick.isSuspended());
+    CHECK(reportsPerSecond() > 40);
+
+    ble.hostDisconnect();
+    host_run(1000);
+}
+
+static void test_disconnect_while_suspended(void)
+{
+    connect();
+    sendCommand(CONTROL_POINT_SUSPEND);
+    CHECK_EQUAL(0, reportsPerSecond());
+
+    ble.hostDisconnect();
+    host_run(1000);
+    CHECK(!joystick.isSuspended());
+    CHECK(!joystick.isTickerActive());
+
+    /* The host doesn't send EXIT_SUSPEND on the new connection */
+    connect();
+    CHECK(!joystick.isSuspended());
+    CHECK(joystick.isTickerActive());
+    CHECK(reportsPerSecond() > 40);
+
+    ble.hostDisconnect();
+    host_run(1000);
+}
+
+static void test_reconnect_before_dispatch(void)
+{
+    connect();
+    sendCommand(CONTROL_POINT_SUSPEND);
+
+    /* Both link events are handled by the same dispatch */
+    ble.hostDisconnect(Gap::CONNECTION_TIMEOUT);
+    ble.hostConnect(7.5, 4);
+    host_run(1000);
+    ble.hostSubscribe(joystick.inputHandle());
+    host_run(1000);
+
+    CHECK(!joystick.isSuspended());
+    CHECK(joystick.isTickerActive());
+    CHECK(reportsPerSecond() > 40);
+
+    ble.hostDisconnect();
+    host_run(1000);
+}
+
+int main(void)
+{
+    test_suspend();
+    test_disconnect_while_suspended();
+    test_reconnect_before_dispatch();
+
+    return host_summary("suspend");
+}
@@ -0,0 +1,309 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * TaskScheduler: order of the tasks, shared wakeups, and timer usage.
+ */
+
+#include "host.h"
+#include "TaskScheduler.h"
+
+static TaskScheduler &scheduler = TaskScheduler::instance();
+
+/*
+ * Log of the runs: which task, and when
+ */
+struct run_t {
+    char task;
+    uint32_t time;
+};
+
+static run_t runs[256];
+static unsigned runCount;
+
+static void record(char task)
+{
+    if (runCount < sizeof(runs) / sizeof(runs[0])) {
+        runs[runCount].task = task;
+        runs[runCount].time = us_ticker_read();
+    }
+    runCount++;
+}
+
+static void clearRuns(void)
+{
+    runCount = 0;
+}
+
+static unsigned countRuns(char task)
+{
+    unsigned count = 0;
+
+    for (unsigned i = 0; i < runCount; i++) {
+        if (runs[i].task == task)
+            count++;
+    }
+
+    return count;
+}
+
+static void runA(void) { record('a'); }
+static void runB(void) { record('b'); }
+static void runC(void) { record('c'); }
+
+/* Tasks must outlive their schedule: they are all static */
+static ScheduledTask a, b, c;
+
+static void test_order(void)
+{
+    uint32_t start = us_ticker_read();
+
+    clearRuns();
+    scheduler.schedule(a, 3000);
+    scheduler.schedule(b, 1000);
+    scheduler.schedule(c, 2000);
+    host_run(10000);
+
+    CHECK_EQUAL(3, runCount);
+    CHECK_EQUAL('b', runs[0].task);
+    CHECK_EQUAL('c', runs[1].task);
+    CHECK_EQUAL('a', runs[2].task);
+    CHECK_EQUAL(start + 1000, runs[0].time);
+    CHECK_EQUAL(start + 2000, runs[1].time);
+    CHECK_EQUAL(start + 3000, runs[2].time);
+
+    /* Rescheduling moves a task */
+    clearRuns();
+    scheduler.schedule(a, 1000);
+    scheduler.schedule(b, 2000);
+    scheduler.schedule(a, 3000);
+    host_run(10000);
+
+    CHECK_EQUAL(2, runCount);
+    CHECK_EQUAL('b', runs[0].task);
+    CHECK_EQUAL('a', runs[1].task);
+}
+
+static void test_coalescing(void)
+{
+    /* Two 100Hz tasks, 1ms apart */
+    uint32_t wakeups = host_timer_wakeups;
+    uint32_t start = us_ticker_read();
+
+    clearRuns();
+    scheduler.schedule(a, 10000, 10000, 0);
+    scheduler.schedule(b, 11000, 10000, 0);
+    host_run(1000000);
+    scheduler.cancel(a);
+    scheduler.cancel(b);
+
+    unsigned strict = host_timer_wakeups - wakeups;
+
+    /* Same, if they accept to run 2ms late: they share each wakeup */
+    wakeups = host_timer_wakeups;
+    start = us_ticker_read();
+    clearRuns();
+    scheduler.schedule(a, 10000, 10000, 2000);
+    scheduler.schedule(b, 11000, 10000, 2000);
+    host_run(1000000);
+    scheduler.cancel(a);
+    scheduler.cancel(b);
+
+    unsigned shared = host_timer_wakeups - wakeups;
+
+    printf("coalescing: %u wakeups without tolerance, %u with\n", strict, shared);
+    /* The last run of b falls after the second */
+    CHECK_EQUAL(100 + 99, strict);
+    CHECK_EQUAL(99, shared);
+    CHECK_EQUAL(99, countRuns('a'));
+    CHECK_EQUAL(99, countRuns('b'));
+
+    /* Never later than the tolerance, never earlier than the deadline */
+    bool inTime = true;
+
+    for (unsigned i = 0; i < runCount; i++) {
+        uint32_t offset = runs[i].task == 'a' ? 10000 : 11000;
+        uint32_t late = (runs[i].time - start - offset) % 10000;
+
+        if (late > 2000)
+            inTime = false;
+    }
+    CHECK(inTime);
+}
+
+static void test_tickless(void)
+{
+    uint32_t wakeups = host_timer_wakeups;
+
+    /* Nothing scheduled: the timer is stopped */
+    host_run(10000000);
+    CHECK_EQUAL(0, host_timer_wakeups - wakeups);
+
+    /* A cancelled task doesn't leave a wakeup behind */
+    scheduler.schedule(a, 5000);
+    scheduler.cancel(a);
+    host_run(10000);
+    CHECK_EQUAL(0, host_timer_wakeups - wakeups);
+}
+
+static void test_post(void)
+{
+    clearRuns();
+
+    /* Posted tasks run in order, on the next dispatch, once each */
+    scheduler.post(c);
+    scheduler.post(a);
+    scheduler.post(c);
+    b.post();
+    CHECK_EQUAL(0, runCount);
+
+    uint32_t wakeups = host_timer_wakeups;
+
+    host_run(0);
+    CHECK_EQUAL(0, host_timer_wakeups - wakeups);
+    CHECK_EQUAL(3, runCount);
+    CHECK_EQUAL('a', runs[0].task);
+    CHECK_EQUAL('c', runs[1].task);
+    CHECK_EQUAL('b', runs[2].task);
+
+    /* Posting a periodic task makes it one-shot */
+    clearRuns();
+    scheduler.schedule(a, 1000, 1000);
+    scheduler.post(a);
+    host_run(10000);
+    CHECK_EQUAL(1, runCount);
+    CHECK(!a.isScheduled());
+}
+
+static unsigned selfRuns;
+static ScheduledTask self;
+
+static void runSelf(void)
+{
+    record('s');
+
+    /* Periodic, then one-shot, then cancelled */
+    if (++selfRuns == 3)
+        scheduler.schedule(self, 5000);
+    else if (selfRuns == 5)
+        scheduler.cancel(self);
+    else if (selfRuns == 4)
+        scheduler.schedule(self, 1000, 1000);
+}
+
+static void test_from_callbacks(void)
+{
+    clearRuns();
+    selfRuns = 0;
+
+    scheduler.schedule(self, 1000, 1000);
+    host_run(100000);
+
+    CHECK_EQUAL(5, runCount);
+    CHECK_EQUAL(runs[2].time + 5000, runs[3].time);
+    CHECK(!self.isScheduled());
+}
+
+static unsigned slowRuns;
+static uint32_t slowWork;
+static ScheduledTask slow;
+
+static void runSlow(void)
+{
+    record('w');
+    slowRuns++;
+    wait_us(slowWork);
+}
+
+static void test_phase(void)
+{
+    uint32_t start = us_ticker_read();
+
+    /* Callbacks that take 3ms don't shift a 10ms period */
+    clearRuns();
+    slowWork = 3000;
+    scheduler.schedule(slow, 10000, 10000);
+    host_run(100000);
+    scheduler.cancel(slow);
+
+    CHECK_EQUAL(10, runCount);
+    bool inPhase = true;
+    for (unsigned i = 0; i < runCount; i++) {
+        if (runs[i].time != start + (i + 1) * 10000)
+            inPhase = false;
+    }
+    CHECK(inPhase);
+
+    /* Callbacks that take longer than the period skip runs, rather than run back to back */
+    clearRuns();
+    slowWork = 25000;
+    scheduler.schedule(slow, 10000, 10000);
+    host_run(200000);
+    scheduler.cancel(slow);
+
+    bool spaced = true;
+    for (unsigned i = 1; i < runCount; i++) {
+        if (runs[i].time - runs[i - 1].time < 10000)
+            spaced = false;
+    }
+    CHECK(runCount > 1);
+    CHECK(spaced);
+    CHECK(runCount < 200000 / 25000 + 1);
+}
+
+static void test_wraparound(void)
+{
+    /* us_ticker_read() wraps around after 71 minutes: get there in two steps */
+    uint32_t remaining = 0xffffffff - us_ticker_read() - 1500;
+
+    host_run(remaining / 2);
+    host_run(remaining - remaining / 2);
+
+    uint32_t start = us_ticker_read();
+
+    clearRuns();
+    scheduler.schedule(a, 3000);
+    scheduler.schedule(b, 1000);
+    scheduler.schedule(c, 2000, 2000);
+    host_run(6000);
+    scheduler.cancel(c);
+
+    CHECK(us_ticker_read() < start);
+    CHECK_EQUAL(5, runCount);
+    CHECK_EQUAL('b', runs[0].task);
+    CHECK_EQUAL('c', runs[1].task);
+    CHECK_EQUAL('a', runs[2].task);
+    CHECK_EQUAL(start + 3000, runs[2].time);
+}
+
+int main(void)
+{
+    a.attach(runA);
+    b.attach(runB);
+    c.attach(runC);
+    self.attach(runSelf);
+    slow.attach(runSlow);
+
+    test_order();
+    test_coalescing();
+    test_tickless();
+    test_post();
+    test_from_callbacks();
+    test_phase();
+    test_wraparound();
+
+    return host_summary("task_scheduler");
+}